@@ -0,0 +1,65 @@
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "bitstream.h"
+
+#define ADAPTIVE_NUM_SYMBOLS 256
+#define ADAPTIVE_NYT ADAPTIVE_NUM_SYMBOLS // escape for symbols not yet transmitted
+#define ADAPTIVE_NUM_NODES (2 * (ADAPTIVE_NUM_SYMBOLS + 1) - 1)
+#define ADAPTIVE_ROOT (ADAPTIVE_NUM_NODES - 1)
+
+/// Adaptive Huffman coder (FGK). Encoder and decoder start from a tree holding only the
+/// NYT leaf and apply the same update after every symbol, so no code is transmitted and
+/// output starts with the first symbol. A new symbol is sent as the NYT code and 8 raw bits.
+/// Nodes are numbered by weight with siblings adjacent (the sibling property), which an
+/// update keeps by swapping each node on the path with the highest numbered node of equal
+/// weight before incrementing it. Nodes of equal weight are numbered contiguously and share
+/// a block that records that leader, so the swap needs no search
+typedef struct
+{
+    uint32_t weight[ADAPTIVE_NUM_NODES];
+    uint16_t parent[ADAPTIVE_NUM_NODES];
+    uint16_t child[ADAPTIVE_NUM_NODES];     // right child of a branch, the left one is numbered one lower
+    uint16_t block[ADAPTIVE_NUM_NODES];     // block of each node
+    uint16_t leader[ADAPTIVE_NUM_NODES];    // highest numbered node of each block in use
+    uint16_t free_blocks[ADAPTIVE_NUM_NODES];
+    uint16_t num_free;
+    uint16_t leaf[ADAPTIVE_NUM_SYMBOLS + 1]; // node of each symbol, UINT16_MAX if not yet seen
+    uint16_t nyt;                            // node of the NYT leaf
+} adaptive_huffman_t;
+
+/// @brief Allocate new coder with the initial tree
+/// @return ptr to new coder
+adaptive_huffman_t *adaptive_huffman_new(void);
+
+/// @brief Return the coder to the initial tree, e.g. to start another stream
+/// @param ah ptr to the coder
+void adaptive_huffman_reset(adaptive_huffman_t *ah);
+
+/// @brief Encode data, updating the code after every symbol. Consecutive calls continue the stream
+/// @param ah ptr to the coder
+/// @param bs ptr to bitstream, written least significant bit first
+/// @param data data to encode
+/// @param size size of data
+/// @return 0 if successful, -1 if not or the stream exceeds 2^32 - 1 symbols
+int adaptive_huffman_encode(adaptive_huffman_t *ah, bitstream_t *bs, const uint8_t *data, const size_t size);
+
+/// @brief Decode size symbols. Consecutive calls continue the stream
+/// @param ah ptr to the coder
+/// @param src encoded data
+/// @param src_size size of src
+/// @param bit_pos ptr to the position of the next bit in src, advanced past the symbols read
+/// @param dst buffer for size symbols
+/// @param size number of symbols to decode
+/// @return 0 if successful, -1 if src ends first
+int adaptive_huffman_decode(adaptive_huffman_t *ah, const uint8_t *src, const size_t src_size, size_t *bit_pos,
+                            uint8_t *dst, const size_t size);
+
+/// @brief Free the coder
+/// @param ah ptr to the coder
+void adaptive_huffman_free(adaptive_huffman_t *ah);
+
+#endif
\ No newline at end of file
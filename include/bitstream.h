@@ -4,15 +4,16 @@
 #include <stddef.h>
 #include <inttypes.h>
 
-#define UINT8_BIT_COUNT sizeof(uint8_t) * __CHAR_BIT__
-#define UINT16_BIT_COUNT sizeof(uint16_t) * __CHAR_BIT__
-#define UINT32_BIT_COUNT sizeof(uint32_t) * __CHAR_BIT__
-#define UINT64_BIT_COUNT sizeof(uint64_t) * __CHAR_BIT__
+#define UINT8_BIT_COUNT (sizeof(uint8_t) * __CHAR_BIT__)
+#define UINT16_BIT_COUNT (sizeof(uint16_t) * __CHAR_BIT__)
+#define UINT32_BIT_COUNT (sizeof(uint32_t) * __CHAR_BIT__)
+#define UINT64_BIT_COUNT (sizeof(uint64_t) * __CHAR_BIT__)
 
 typedef struct
 {
     uint8_t *stream;
-    size_t size; // in bits
+    size_t size;     // in bits
+    size_t capacity; // in bytes
     uint8_t bit_offset;
     size_t byte_offset;
 } bitstream_t;
@@ -61,6 +62,40 @@ void bitstream_write_32(bitstream_t *bs, const uint32_t data, const size_t num_b
 /// @param num_bits number of bits to write
 void bitstream_write_64(bitstream_t *bs, const uint64_t data, const size_t num_bits);
 
+/// @brief Write num_bits from data to the bitstream, least significant bit first
+///        (DEFLATE bit order). The stream grows as needed
+/// @param bs ptr to the stream
+/// @param data data to be written
+/// @param num_bits number of bits to write
+/// @return 0 if successful, -1 if not
+int bitstream_write_lsb(bitstream_t *bs, const uint64_t data, const size_t num_bits);
+
+/// @brief Pad the current byte with zero bits
+/// @param bs ptr to the stream
+void bitstream_align(bitstream_t *bs);
+
+/// @brief Append whole bytes to a byte aligned stream. The stream grows as needed
+/// @param bs ptr to the stream
+/// @param data bytes to be written
+/// @param size number of bytes
+/// @return 0 if successful, -1 if not
+int bitstream_write_bytes(bitstream_t *bs, const uint8_t *data, const size_t size);
+
+/// @brief Empty the stream, keeping its storage
+/// @param bs ptr to the stream
+void bitstream_clear(bitstream_t *bs);
+
+/// @brief Make room for at least size more bytes
+/// @param bs ptr to the stream
+/// @param size number of bytes
+/// @return 0 if successful, -1 if not
+int bitstream_reserve(bitstream_t *bs, const size_t size);
+
+/// @brief Drop complete bytes from the front of the stream, e.g. once they were handed out
+/// @param bs ptr to the stream
+/// @param size number of bytes, at most the complete bytes written
+void bitstream_discard(bitstream_t *bs, const size_t size);
+
 /// @brief Get the size of the stream in bits
 /// @param bs ptr to the stream
 /// @return number of bits in stream
@@ -0,0 +1,114 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "hashmap.h"
+#include "zip.h"
+
+#define CACHE_INDEX_SIG 0x33435a50u // "PZC3"
+#define CACHE_SIZE_DEFAULT (1024ull * 1024 * 1024)
+
+/// What an entry was made from: the input's size, content hash and CRC-32, the level asked
+/// for and whether zip_choose_level was let pick another per entry
+typedef struct
+{
+    uint64_t size;
+    uint64_t hash; // from cache_hash
+    uint32_t crc;
+    int32_t level;
+    bool choose;
+} cache_key_t;
+
+/// Compressed data of an entry, in a file of the cache directory named after its key.
+/// Entries that were stored keep no file, their data is the input itself
+typedef struct
+{
+    cache_key_t key;
+    uint64_t csize;
+    uint64_t used; // tick of the last use, the least recently used are evicted first
+    uint16_t method;
+} cache_blob_t;
+
+/// What a path held when it was last archived
+typedef struct
+{
+    char *path; // resolved by realpath, so relative paths from different directories differ
+    uint64_t size;
+    int64_t mtime; // nanoseconds since the epoch
+    cache_key_t key;
+} cache_record_t;
+
+typedef HASHMAP(cache_key_t, cache_blob_t) cache_blob_map_t;
+typedef HASHMAP(char, cache_record_t) cache_record_map_t;
+
+/// On-disk cache of compressed archive entries, shared by the threads of one archive build.
+/// A file whose path, size and time match a record is spliced in without being read, any
+/// other file is looked up by content before it is compressed. The cache directory holds
+/// an index, rewritten on close, and one file of compressed data per blob
+typedef struct
+{
+    char *dir;
+    uint64_t max_size; // bytes of blobs kept once closed
+    uint64_t size;     // bytes of blobs, each counting its data and bookkeeping
+    uint64_t tick;     // use counter, persists across builds
+    cache_blob_map_t blobs;
+    cache_record_map_t records;
+    pthread_mutex_t lock;
+} cache_t;
+
+/// @brief Open a cache directory, creating it if needed. A missing or damaged index starts an empty cache
+/// @param dir cache directory
+/// @param max_size bytes of compressed data to keep, the least recently used is evicted beyond it
+/// @return ptr to new cache, nullptr if the directory cannot be created
+cache_t *cache_open(const char *dir, const uint64_t max_size);
+
+/// @brief Hash content for a cache key. The key holds the CRC-32 as well, a collision must hit both
+/// @param data data
+/// @param size size of data
+/// @return content hash, XXH64 of data
+uint64_t cache_hash(const uint8_t *data, const size_t size);
+
+/// @brief Look up the entry made from a file when it last had this size and time
+/// @param c ptr to the cache
+/// @param path path of the file, relative or not, its record is found under the resolved path
+/// @param st ptr to the file's status
+/// @param level level the entry is wanted at
+/// @param choose whether the entry's level is picked with zip_choose_level
+/// @param entry ptr to the entry receiving method, crc, size and csize
+/// @param data ptr receiving a mapping of the csize bytes of compressed data, nullptr for a stored entry
+/// @return 0 if found, -1 if not or the blob's file does not hold csize bytes, which drops it
+int cache_find(cache_t *c, const char *path, const struct stat *st, const int level, const bool choose,
+               zip_entry_t *entry, uint8_t **data);
+
+/// @brief Look up an entry by content, and remember that the file now holds it
+/// @param c ptr to the cache
+/// @param path path of the file
+/// @param st ptr to the file's status
+/// @param key ptr to the content's key
+/// @param entry ptr to the entry receiving method, crc, size and csize
+/// @param data ptr receiving a mapping of the csize bytes of compressed data, nullptr for a stored entry
+/// @return 0 if found, -1 if not or the blob's file does not hold csize bytes, which drops it
+int cache_find_content(cache_t *c, const char *path, const struct stat *st, const cache_key_t *key,
+                       zip_entry_t *entry, uint8_t **data);
+
+/// @brief Keep a newly made entry
+/// @param c ptr to the cache
+/// @param path path of the file
+/// @param st ptr to the file's status
+/// @param key ptr to the content's key
+/// @param entry ptr to the entry's method, crc, size and csize
+/// @param data csize bytes of compressed data, unused for a stored entry
+/// @return 0 if successful, -1 if not
+int cache_add(cache_t *c, const char *path, const struct stat *st, const cache_key_t *key, const zip_entry_t *entry,
+              const uint8_t *data);
+
+/// @brief Evict the least recently used blobs beyond the size limit, write the index and free the cache
+/// @param c ptr to the cache
+/// @return 0 if successful, -1 if the index cannot be written
+int cache_close(cache_t *c);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define ADLER32_INIT 1
+#define CRC32_INIT 0
+
+/// @brief Update an Adler-32 checksum (RFC 1950)
+/// @param adler checksum so far, ADLER32_INIT for none
+/// @param data data to checksum
+/// @param size size of data
+/// @return updated checksum
+uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size);
+
+/// @brief Update a CRC-32 checksum (ISO 3309, as used by gzip and ZIP)
+/// @param crc checksum so far, CRC32_INIT for none
+/// @param data data to checksum
+/// @param size size of data
+/// @return updated checksum
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+/// @brief Get the CRC-32 of two concatenated pieces from their own checksums
+/// @param crc1 checksum of the first piece
+/// @param crc2 checksum of the second piece
+/// @param size2 size of the second piece
+/// @return checksum of both pieces
+uint32_t crc32_combine(const uint32_t crc1, const uint32_t crc2, const uint64_t size2);
+
+/// @brief Hash data with XXH64, a 64 bit non-cryptographic hash with good dispersion,
+///        for content keys where a checksum is too easy to collide
+/// @param data data to hash
+/// @param size size of data
+/// @param seed seed, 0 for the standard hash
+/// @return hash
+uint64_t xxh64(const uint8_t *data, size_t size, const uint64_t seed);
+
+#endif
\ No newline at end of file
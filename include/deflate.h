@@ -0,0 +1,299 @@
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "bitstream.h"
+#include "dict.h"
+#include "lz77.h"
+
+#define DEFLATE_LEVEL_MIN 1
+#define DEFLATE_LEVEL_DEFAULT 6
+#define DEFLATE_LEVEL_MAX 12
+
+#define DEFLATE_NUM_LITLEN 286
+#define DEFLATE_NUM_DIST 30
+#define DEFLATE_NUM_CODELEN 19
+#define DEFLATE_END_OF_BLOCK 256
+#define DEFLATE_MAX_BITS 15
+#define DEFLATE_MAX_CODELEN_BITS 7
+
+#define DEFLATE_BLOCK_SIZE (1 << 16) // input bytes per block
+#define DEFLATE_STORED_MAX 65535     // bytes per stored block
+
+typedef enum
+{
+    DEFLATE_GREEDY,
+    DEFLATE_LAZY,
+    DEFLATE_OPTIMAL,
+} deflate_strategy_t;
+
+typedef struct
+{
+    lz77_params_t lz77;
+    deflate_strategy_t strategy;
+    uint32_t iterations; // cost model refinements for optimal parsing
+} deflate_level_t;
+
+typedef struct
+{
+    size_t litlen[DEFLATE_NUM_LITLEN];
+    size_t dist[DEFLATE_NUM_DIST];
+} deflate_freq_t;
+
+/// Huffman codes of one block, codes are bit reversed ready for LSB first output
+typedef struct
+{
+    uint8_t litlen_lens[DEFLATE_NUM_LITLEN];
+    uint16_t litlen_codes[DEFLATE_NUM_LITLEN];
+    uint8_t dist_lens[DEFLATE_NUM_DIST];
+    uint16_t dist_codes[DEFLATE_NUM_DIST];
+    uint8_t codelen_lens[DEFLATE_NUM_CODELEN];
+    uint16_t codelen_codes[DEFLATE_NUM_CODELEN];
+    uint8_t rle[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST]; // run length coded code lengths
+    uint8_t rle_extra[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST];
+    size_t rle_size;
+    size_t hlit;
+    size_t hdist;
+    size_t hclen;
+} deflate_code_t;
+
+typedef enum
+{
+    DEFLATE_STREAM_RUNNING,
+    DEFLATE_STREAM_FLUSHING,
+    DEFLATE_STREAM_FINISHING,
+    DEFLATE_STREAM_DONE,
+} deflate_stream_state_t;
+
+typedef enum
+{
+    DEFLATE_SYNC_FLUSH, // end the block and byte align, everything so far decodes
+    DEFLATE_FULL_FLUSH, // sync flush and drop the history, decoding may start after it
+} deflate_flush_t;
+
+/// Incremental compressor. Holds the window, at most one block of pending input and
+/// the compressed output of one block, which is handed out as output space allows
+typedef struct
+{
+    const deflate_level_t *cfg;
+    int level;
+    lz77_matcher_t *m;
+    uint8_t *buf;     // history followed by pending input
+    size_t start;     // first pending byte in buf
+    size_t end;       // end of data in buf
+    bitstream_t *out; // compressed output not yet handed out
+    deflate_stream_state_t state;
+    size_t latency_bytes;     // unflushed input that triggers a sync flush, 0 for no limit
+    uint64_t latency_us;      // age of unflushed input that triggers a sync flush, 0 for no limit
+    size_t unflushed;         // input taken since the last flush
+    uint64_t unflushed_since; // when the first of it was taken, in microseconds
+    bool adapt;               // level follows adapt_rate or the output backlog
+    int adapt_min, adapt_max;
+    uint64_t adapt_rate;  // target bytes per second, 0 to follow the backlog
+    size_t adapt_bytes;   // input compressed since the last level decision
+    uint64_t adapt_us;    // time spent compressing it
+    bool backlogged;      // an update returned with output left over since the last decision
+} deflate_stream_t;
+
+extern const uint16_t deflate_length_base[29];
+extern const uint8_t deflate_length_extra[29];
+extern const uint16_t deflate_dist_base[30];
+extern const uint8_t deflate_dist_extra[30];
+
+/// @brief Get the length code (0-28, symbol minus 257) of a match length
+/// @param length match length, 3-258
+/// @return length code
+static inline size_t deflate_length_code(const size_t length)
+{
+    size_t l = length - LZ77_MIN_MATCH;
+    size_t nb;
+
+    if (l < 8)
+        return l;
+    if (length == LZ77_MAX_MATCH)
+        return 28;
+
+    nb = 31 - __builtin_clz((unsigned)l);
+    return 4 * (nb - 1) + ((l >> (nb - 2)) & 3);
+}
+
+/// @brief Get the distance code (0-29) of a match distance
+/// @param dist match distance, 1-32768
+/// @return distance code
+static inline size_t deflate_dist_code(const size_t dist)
+{
+    size_t d = dist - 1;
+    size_t nb;
+
+    if (d < 4)
+        return d;
+
+    nb = 31 - __builtin_clz((unsigned)d);
+    return 2 * nb + ((d >> (nb - 1)) & 1);
+}
+
+/// @brief Get the parameters of a compression level
+/// @param level compression level, clamped to DEFLATE_LEVEL_MIN-DEFLATE_LEVEL_MAX
+/// @return ptr to the level's parameters
+const deflate_level_t *deflate_level(const int level);
+
+/// @brief Count the symbols a parse emits, including end of block
+/// @param seqs the literals and matches
+/// @param freq ptr to zeroed frequencies
+void deflate_count(const lz77_seqs_t *seqs, deflate_freq_t *freq);
+
+/// @brief Get length limited Huffman code lengths for an alphabet
+/// @param freq occurrence count of each symbol
+/// @param num_symbols size of the alphabet
+/// @param lens ptr to num_symbols code lengths
+/// @param max_bits longest code permitted
+/// @return 0 if successful, -1 if not
+int deflate_code_lengths(const size_t *freq, const size_t num_symbols, uint8_t *lens, const size_t max_bits);
+
+/// @brief Get the code lengths of the fixed Huffman code (RFC 1951, 3.2.6)
+/// @param litlen_lens ptr to DEFLATE_NUM_LITLEN code lengths
+/// @param dist_lens ptr to DEFLATE_NUM_DIST code lengths
+void deflate_fixed_lengths(uint8_t *litlen_lens, uint8_t *dist_lens);
+
+/// @brief Build length limited dynamic Huffman codes for a block
+/// @param freq symbol frequencies of the block
+/// @param code ptr to code to fill in
+/// @return 0 if successful, -1 if not
+int deflate_build_dynamic(const deflate_freq_t *freq, deflate_code_t *code);
+
+/// @brief Get the size of a dynamic block, header included
+/// @param freq symbol frequencies of the block
+/// @param code the block's codes
+/// @return size in bits
+size_t deflate_dynamic_bits(const deflate_freq_t *freq, const deflate_code_t *code);
+
+/// @brief Write a parse as one block, fixed, dynamic or stored whichever is smallest
+/// @param bs ptr to bitstream
+/// @param seqs the literals and matches
+/// @param raw the bytes the parse decodes to, nullptr to rule out a stored block
+/// @param raw_size number of bytes the parse decodes to
+/// @param final whether this is the last block of the stream
+/// @return 0 if successful, -1 if not
+int deflate_write_block(bitstream_t *bs, const lz77_seqs_t *seqs, const uint8_t *raw, const size_t raw_size,
+                        const bool final);
+
+/// @brief Write data as stored blocks, as many as its size needs
+/// @param bs ptr to bitstream
+/// @param data data to store
+/// @param size size of data
+/// @param final whether the last block ends the stream
+/// @return 0 if successful, -1 if not
+int deflate_write_stored(bitstream_t *bs, const uint8_t *data, const size_t size, const bool final);
+
+/// @brief Guess from a sample whether data is already compressed or random: its byte
+///        entropy is close to 8 bits and sampled runs share no 4 byte strings
+/// @param data data to test
+/// @param size size of data
+/// @return whether compressing data is likely to be wasted work
+bool deflate_incompressible(const uint8_t *data, const size_t size);
+
+/// @brief Compress data into a raw DEFLATE stream (RFC 1951)
+/// @param bs ptr to bitstream receiving the compressed data
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level
+/// @return 0 if successful, -1 if not
+int deflate_compress(bitstream_t *bs, const uint8_t *data, const size_t size, const int level);
+
+/// @brief Compress window[start, size) as DEFLATE blocks whose matches may reach back
+///        into window[0, start), e.g. the tail of the previous chunk of a stream
+/// @param bs ptr to bitstream receiving the compressed data
+/// @param m ptr to a matcher, reset before use
+/// @param window history followed by the data to compress
+/// @param start size of the history
+/// @param size size of the window
+/// @param level compression level
+/// @param final whether the last block ends the stream
+/// @return 0 if successful, -1 if not
+int deflate_compress_window(bitstream_t *bs, lz77_matcher_t *m, const uint8_t *window, const size_t start,
+                            const size_t size, const int level, const bool final);
+
+/// @brief End the current block with an empty stored block, byte aligning the stream
+///        so that everything written so far can be decoded (sync flush)
+/// @param bs ptr to bitstream
+/// @return 0 if successful, -1 if not
+int deflate_sync_flush(bitstream_t *bs);
+
+/// @brief Compress data into a raw DEFLATE stream whose matches may reference a preset dictionary
+/// @param bs ptr to bitstream receiving the compressed data
+/// @param dict ptr to the dictionary, nullptr for none
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level
+/// @return 0 if successful, -1 if not
+int deflate_compress_dict(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level);
+
+/// @brief Allocate a streaming compressor
+/// @param level compression level
+/// @return ptr to new stream
+deflate_stream_t *deflate_stream_new(const int level);
+
+/// @brief Start a new stream, keeping the storage, level and latency and adapt settings
+/// @param s ptr to the stream
+void deflate_stream_reset(deflate_stream_t *s);
+
+/// @brief Change the level of the stream, from its next block on
+/// @param s ptr to the stream
+/// @param level compression level, clamped to DEFLATE_LEVEL_MIN-DEFLATE_LEVEL_MAX
+void deflate_stream_set_level(deflate_stream_t *s, const int level);
+
+/// @brief Bound the latency of the stream: update sync flushes as soon as max_bytes of input
+///        or input older than max_us microseconds have not been flushed. The age is checked
+///        on every update, so an idle stream calls update with no input to let it expire
+/// @param s ptr to the stream
+/// @param max_bytes unflushed input that triggers a flush, 0 for no limit
+/// @param max_us age of unflushed input that triggers a flush, 0 for no limit
+void deflate_stream_set_latency(deflate_stream_t *s, const size_t max_bytes, const uint64_t max_us);
+
+/// @brief Let the stream move its level between blocks, one step per block's worth of input.
+///        With a rate the level goes down while compression is slower than it and up while
+///        it is faster. Without one it goes up while the caller leaves output behind, being
+///        limited by the writer, and down while the writer waits on the compressor
+/// @param s ptr to the stream
+/// @param rate target compression speed in bytes per second, 0 to follow the output backlog
+/// @param min_level lowest level to use
+/// @param max_level highest level to use
+void deflate_stream_set_adapt(deflate_stream_t *s, const uint64_t rate, const int min_level, const int max_level);
+
+/// @brief Compress a chunk of input. Returns once all input is taken or the output span is full
+/// @param s ptr to the stream
+/// @param in input chunk
+/// @param in_size size of the input chunk
+/// @param in_used ptr receiving the number of input bytes taken
+/// @param out output span
+/// @param out_cap size of the output span
+/// @param out_used ptr receiving the number of bytes written to out
+/// @return 0 if successful, -1 if not
+int deflate_stream_update(deflate_stream_t *s, const uint8_t *in, const size_t in_size, size_t *in_used,
+                          uint8_t *out, const size_t out_cap, size_t *out_used);
+
+/// @brief Compress all pending input and flush, so the output so far decodes completely
+/// @param s ptr to the stream
+/// @param flush DEFLATE_SYNC_FLUSH to keep the history, DEFLATE_FULL_FLUSH to drop it
+/// @param out output span
+/// @param out_cap size of the output span
+/// @param out_used ptr receiving the number of bytes written to out
+/// @return 0 if done, 1 if output remains and flush must be called again, -1 on error
+int deflate_stream_flush(deflate_stream_t *s, const deflate_flush_t flush, uint8_t *out, const size_t out_cap,
+                         size_t *out_used);
+
+/// @brief Compress all pending input and end the stream
+/// @param s ptr to the stream
+/// @param out output span
+/// @param out_cap size of the output span
+/// @param out_used ptr receiving the number of bytes written to out
+/// @return 0 if done, 1 if output remains and finish must be called again, -1 on error
+int deflate_stream_finish(deflate_stream_t *s, uint8_t *out, const size_t out_cap, size_t *out_used);
+
+/// @brief Free the streaming compressor
+/// @param s ptr to the stream
+void deflate_stream_free(deflate_stream_t *s);
+
+#endif
\ No newline at end of file
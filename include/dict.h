@@ -0,0 +1,29 @@
+#ifndef __DICT_H__
+#define __DICT_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "lz77.h"
+
+/// Preset dictionary. Compressing with a dictionary starts from a clone of its
+/// primed hash chains instead of hashing the dictionary again for every message
+typedef struct
+{
+    uint8_t *data;           // the last LZ77_WINDOW_SIZE bytes of the dictionary
+    size_t size;
+    uint32_t id;             // Adler-32 of the whole dictionary
+    lz77_matcher_t *matcher; // hash chains primed with the dictionary
+} dict_t;
+
+/// @brief Create a dictionary, priming the match finder with its contents
+/// @param data dictionary contents, most likely strings last
+/// @param size size of data
+/// @return ptr to new dictionary
+dict_t *dict_new(const uint8_t *data, const size_t size);
+
+/// @brief Free the dictionary
+/// @param dict ptr to the dictionary
+void dict_free(dict_t *dict);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef __FAST_H__
+#define __FAST_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/// Byte aligned LZ77 without entropy coding, for speed over ratio. Each sequence is a
+/// token byte (literal count high nibble, match length - FAST_MIN_MATCH low nibble, 15
+/// meaning more follows in bytes up to 255), the literals, then a 2 byte little endian
+/// offset. The last sequence is literals only and ends the block
+#define FAST_MIN_MATCH 4
+#define FAST_MAX_OFFSET 65535
+#define FAST_HASH_BITS 13
+#define FAST_LAST_LITERALS 5 // a block always ends in this many literals
+#define FAST_MATCH_LIMIT 12  // no match starts this close to the end of a block
+
+/// @brief Largest compressed size of size bytes
+#define FAST_BOUND(size) ((size) + (size) / 255 + 16)
+
+/// @brief Compress src[start, size) as one block, matches may reach back into src[0, start)
+/// @param src data to compress, preceded by start bytes of history
+/// @param start first position to compress
+/// @param size end of data to compress
+/// @param dst buffer for the block
+/// @param dst_cap capacity of dst, FAST_BOUND(size - start) always suffices
+/// @param dst_size ptr receiving the size of the block
+/// @return 0 if successful, -1 if the block does not fit in dst
+int fast_compress(const uint8_t *src, const size_t start, const size_t size, uint8_t *dst, const size_t dst_cap,
+                  size_t *dst_size);
+
+/// @brief Decompress one block. Matches reaching before dst continue into the end of dict
+/// @param dict history preceding dst, nullptr for none
+/// @param dict_size size of dict
+/// @param src the block
+/// @param src_size size of the block
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if the block is malformed or does not fit in dst
+int fast_decompress(const uint8_t *dict, const size_t dict_size, const uint8_t *src, const size_t src_size,
+                    uint8_t *dst, const size_t dst_cap, size_t *dst_size);
+
+#endif
\ No newline at end of file
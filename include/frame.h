@@ -0,0 +1,89 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "bitstream.h"
+#include "dict.h"
+#include "ldm.h"
+
+/// plzip frame: "PLZ", flags, [dictionary ID, 4 bytes little endian], [long matches], raw DEFLATE stream.
+/// Long matches are a varint count followed by (literals, length, offset) varints for each; the
+/// DEFLATE stream then holds only the literal bytes between them, and the trailing ones.
+/// Fast frames hold fast codec blocks instead of DEFLATE: each a 4 byte size, a 4 byte
+/// compressed size (FRAME_FAST_STORED if kept as is) and the block, until a zero size.
+/// A block's matches may reach into the 64 KiB before it, or the dictionary for the first.
+/// Adaptive frames hold a varint size and the bytes coded with adaptive Huffman codes
+#define FRAME_MAGIC "PLZ"
+#define FRAME_MAGIC_SIZE 3
+#define FRAME_FLAG_DICT 0x01
+#define FRAME_FLAG_LDM 0x02
+#define FRAME_FLAG_FAST 0x04
+#define FRAME_FLAG_ADAPTIVE 0x08
+#define FRAME_FAST_BLOCK_SIZE (1 << 22)
+#define FRAME_FAST_STORED 0x80000000u
+
+typedef struct
+{
+    uint8_t flags;
+    uint32_t dict_id; // valid if flags has FRAME_FLAG_DICT
+    size_t size;      // size of the header in bytes
+} frame_header_t;
+
+/// @brief Compress data into a plzip frame
+/// @param bs ptr to bitstream receiving the frame
+/// @param dict ptr to preset dictionary, nullptr for none
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level
+/// @return 0 if successful, -1 if not
+int frame_compress(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level);
+
+/// @brief Compress data into a plzip frame, finding repeats beyond the DEFLATE window first
+/// @param bs ptr to bitstream receiving the frame
+/// @param dict ptr to preset dictionary, nullptr for none
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level of the bytes between long matches
+/// @param params long distance matching parameters, nullptr for defaults
+/// @return 0 if successful, -1 if not
+int frame_compress_ldm(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level,
+                       const ldm_params_t *params);
+
+/// @brief Compress data into a plzip frame with the byte aligned fast codec, for decoding
+///        speed over ratio
+/// @param bs ptr to bitstream receiving the frame
+/// @param dict ptr to preset dictionary, nullptr for none
+/// @param data data to compress
+/// @param size size of data
+/// @return 0 if successful, -1 if not
+int frame_compress_fast(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size);
+
+/// @brief Compress data into a plzip frame in a single pass with adaptive Huffman codes,
+///        for tiny messages where output must not wait for a whole block
+/// @param bs ptr to bitstream receiving the frame
+/// @param data data to compress
+/// @param size size of data
+/// @return 0 if successful, -1 if not
+int frame_compress_adaptive(bitstream_t *bs, const uint8_t *data, const size_t size);
+
+/// @brief Parse the header of a plzip frame, e.g. to find the dictionary it needs
+/// @param src the frame
+/// @param src_size size of the frame
+/// @param hdr ptr to header to fill in
+/// @return 0 if successful, -1 if src is not a plzip frame
+int frame_read_header(const uint8_t *src, const size_t src_size, frame_header_t *hdr);
+
+/// @brief Decompress a plzip frame
+/// @param dict ptr to the dictionary named in the frame header, nullptr for none
+/// @param src the frame
+/// @param src_size size of the frame
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if the frame is malformed, needs another dictionary or does not fit in dst
+int frame_decompress(const dict_t *dict, const uint8_t *src, const size_t src_size,
+                     uint8_t *dst, const size_t dst_cap, size_t *dst_size);
+
+#endif
\ No newline at end of file
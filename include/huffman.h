@@ -19,7 +19,7 @@ struct sym_code_t
 
 struct huffman_node_t
 {
-    uint8_t symbol;
+    uint16_t symbol;
     double weight;         // Probability of symbol occurrance
     huffman_node_t *left;  // 0
     huffman_node_t *right; // 1
@@ -27,7 +27,7 @@ struct huffman_node_t
     size_t pq_i; // used for priority queue position function
 };
 
-typedef HASHMAP(uint8_t, sym_code_t) huffman_enc_map_t;
+typedef HASHMAP(uint16_t, sym_code_t) huffman_enc_map_t;
 
 /// @brief Print huffman tree
 /// @param root root of tree
@@ -46,6 +46,26 @@ void __print_huffman(const huffman_node_t *root, const size_t depth);
 /// @return root of huffman tree
 huffman_node_t *huffman_generate(const uint8_t *data, const size_t size);
 
+/// @brief Creates huffman tree from symbol frequencies
+/// @param freq occurrence count of each symbol
+/// @param num_symbols size of the alphabet
+/// @return root of huffman tree, nullptr if no symbol occurs
+huffman_node_t *huffman_generate_freq(const size_t *freq, const size_t num_symbols);
+
+/// @brief Get the code length of every symbol in the tree, limited to max_bits
+/// @param root root of huffman tree
+/// @param lens ptr to num_symbols code lengths, 0 for symbols not in the tree
+/// @param num_symbols size of the alphabet
+/// @param max_bits longest code permitted
+/// @return 0 if successful, -1 if not
+int huffman_code_lengths(const huffman_node_t *root, uint8_t *lens, const size_t num_symbols, const size_t max_bits);
+
+/// @brief Assign canonical codes (RFC 1951, 3.2.2) from code lengths
+/// @param lens code length of each symbol, at most 15
+/// @param codes ptr to num_symbols codes
+/// @param num_symbols size of the alphabet
+void huffman_canonical_codes(const uint8_t *lens, uint16_t *codes, const size_t num_symbols);
+
 /// @brief Generate an encoding map from a huffman tree
 /// @param root root of the huffman tree
 /// @param enc_map ptr to empty dict
@@ -78,13 +98,13 @@ void huffman_print_enc_map(huffman_enc_map_t* enc_map);
 /// @brief Default hash function for huffman_enc_map_t
 /// @param data data to hash
 /// @return hash
-size_t sym_hash(const uint8_t *data);
+size_t sym_hash(const uint16_t *data);
 
 /// @brief Default symbol compare for huffman_enc_map_t
 /// @param lhs lhs
 /// @param rhs rhs
 /// @return 1 if lhs > rhs, -1 if lhs < rhs, 0 otherwise
-int sym_compare(const uint8_t *lhs, const uint8_t *rhs);
+int sym_compare(const uint16_t *lhs, const uint16_t *rhs);
 
 /// @brief Free the huffman tree
 /// @param root ptr to the root
@@ -0,0 +1,104 @@
+#ifndef __INFLATE_H__
+#define __INFLATE_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "deflate.h"
+#include "dict.h"
+#include "lz77.h"
+
+#define INFLATE_NUM_FIXED_LITLEN 288
+
+/// Canonical code as the number of codes of each length and the symbols in code order
+typedef struct
+{
+    uint16_t count[DEFLATE_MAX_BITS + 1];
+    uint16_t symbol[INFLATE_NUM_FIXED_LITLEN];
+} inflate_table_t;
+
+typedef enum
+{
+    INFLATE_HEADER,      // block header bits
+    INFLATE_STORED,      // stored block lengths
+    INFLATE_STORED_COPY, // stored block bytes
+    INFLATE_TABLE,       // dynamic block code counts
+    INFLATE_LENLENS,     // code length code lengths
+    INFLATE_CODELENS,    // literal/length and distance code lengths
+    INFLATE_CODES,       // compressed data symbols
+    INFLATE_MATCH,       // match bytes not yet written
+    INFLATE_DONE,
+    INFLATE_ERROR,
+} inflate_mode_t;
+
+/// Push-style decompressor. Every item is decoded only once all of its bits are buffered,
+/// so input and output may run out anywhere and decoding resumes at the same spot
+typedef struct
+{
+    inflate_mode_t mode;
+    bool final;                // the current block is the last one
+    uint64_t bitbuf;
+    size_t bitcnt;
+    size_t length;             // stored or match bytes left
+    size_t dist;               // distance of the current match
+    size_t hlit, hdist, hclen; // dynamic block header
+    size_t have;               // code lengths read so far
+    uint8_t lens[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST];
+    inflate_table_t litlen, distcode, codelen;
+    uint8_t window[LZ77_WINDOW_SIZE]; // the last output, for matches
+    size_t wpos;
+    size_t whave;
+    const uint8_t *in; // spans of the current call
+    size_t in_size;
+    size_t in_pos;
+    uint8_t *out;
+    size_t out_cap;
+    size_t out_pos;
+} inflate_stream_t;
+
+/// @brief Decompress a raw DEFLATE stream (RFC 1951)
+/// @param src compressed data
+/// @param src_size size of compressed data
+/// @param src_used ptr receiving the number of compressed bytes consumed, may be nullptr
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if the stream is malformed or does not fit in dst
+int inflate_decompress(const uint8_t *src, const size_t src_size, size_t *src_used,
+                       uint8_t *dst, const size_t dst_cap, size_t *dst_size);
+
+/// @brief Decompress a raw DEFLATE stream compressed with a preset dictionary
+/// @param dict ptr to the dictionary the stream was compressed with, nullptr for none
+/// @param src compressed data
+/// @param src_size size of compressed data
+/// @param src_used ptr receiving the number of compressed bytes consumed, may be nullptr
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if the stream is malformed or does not fit in dst
+int inflate_decompress_dict(const dict_t *dict, const uint8_t *src, const size_t src_size, size_t *src_used,
+                            uint8_t *dst, const size_t dst_cap, size_t *dst_size);
+
+/// @brief Allocate a streaming decompressor for a raw DEFLATE stream
+/// @param dict ptr to the dictionary the stream was compressed with, nullptr for none
+/// @return ptr to new stream
+inflate_stream_t *inflate_stream_new(const dict_t *dict);
+
+/// @brief Decompress a chunk of input. Returns once the input is used up, the output span
+///        is full or the stream ends; bytes after the end of the stream are not taken
+/// @param s ptr to the stream
+/// @param in input chunk
+/// @param in_size size of the input chunk
+/// @param in_used ptr receiving the number of input bytes taken
+/// @param out output span
+/// @param out_cap size of the output span
+/// @param out_used ptr receiving the number of bytes written to out
+/// @return 1 if the stream has ended, 0 if it needs more input or output space, -1 if malformed
+int inflate_stream_update(inflate_stream_t *s, const uint8_t *in, const size_t in_size, size_t *in_used,
+                          uint8_t *out, const size_t out_cap, size_t *out_used);
+
+/// @brief Free the streaming decompressor
+/// @param s ptr to the stream
+void inflate_stream_free(inflate_stream_t *s);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __LDM_H__
+#define __LDM_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define LDM_MIN_MATCH 64
+#define LDM_WINDOW_LOG_DEFAULT 27
+#define LDM_WINDOW_LOG_MAX 31
+#define LDM_HASH_LOG_MAX 24
+
+/// A long match and the literals before it, which are left to the regular LZ77 parser
+typedef struct
+{
+    size_t literals; // bytes since the end of the previous match
+    size_t length;
+    size_t offset;   // distance back to the start of the repeat
+} ldm_seq_t;
+
+typedef struct
+{
+    ldm_seq_t *seqs;
+    size_t size;
+    size_t capacity;
+} ldm_seqs_t;
+
+typedef struct
+{
+    uint32_t window_log; // log2 of the largest match offset, up to LDM_WINDOW_LOG_MAX
+    uint32_t min_match;  // shortest match reported, 0 for LDM_MIN_MATCH
+    uint32_t hash_log;   // log2 of the hash table entries, 0 to derive it from window_log
+} ldm_params_t;
+
+/// @brief Find long repeats over a large window with a rolling hash over min_match bytes.
+///        Only positions whose hash has a set of tag bits are remembered, so the table
+///        covers the whole window at a fraction of its size
+/// @param data data to search
+/// @param size size of data
+/// @param params search parameters, nullptr for defaults
+/// @param seqs ptr to sequence buffer, sequences are appended
+/// @return 0 if successful, -1 if not
+int ldm_find(const uint8_t *data, const size_t size, const ldm_params_t *params, ldm_seqs_t *seqs);
+
+/// @brief Free the sequence buffer's storage
+/// @param seqs ptr to sequence buffer
+void ldm_seqs_free(ldm_seqs_t *seqs);
+
+#endif
\ No newline at end of file
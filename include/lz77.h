@@ -0,0 +1,142 @@
+#ifndef __LZ77_H__
+#define __LZ77_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define LZ77_WINDOW_SIZE 32768
+#define LZ77_MIN_MATCH 3
+#define LZ77_MAX_MATCH 258
+#define LZ77_HASH_BITS 15
+#define LZ77_NIL UINT32_MAX
+#define LZ77_SKIP_MAX 64 // widest stride between searches in match-poor data
+
+/// Parser output as separate streams, filled per block and reused across blocks: the
+/// literal bytes in order, and for each match the number of literals before it, its
+/// length and its distance. Literals after the last match form the trailing run
+typedef struct
+{
+    uint8_t *literals;
+    uint32_t *lit_runs;
+    uint16_t *lengths;
+    uint16_t *dists;
+    size_t num_literals;
+    size_t size; // number of matches
+    size_t tail; // literals since the last match
+    size_t literals_capacity;
+    size_t capacity;
+} lz77_seqs_t;
+
+typedef struct
+{
+    uint32_t max_chain;   // hash chain links followed per search
+    uint32_t nice_length; // stop searching once a match is this long
+    uint32_t lazy_length; // look one position ahead unless a match is this long, 0 for greedy
+    uint32_t skip_log;    // search every (1 + misses >> skip_log)th position after misses in a row, 0 for all
+} lz77_params_t;
+
+/// Hash chains over positions relative to a caller provided base pointer.
+/// Every position handed to the matcher must have its preceding window
+/// (up to LZ77_WINDOW_SIZE bytes) readable at the same base
+typedef struct
+{
+    uint32_t *head; // most recent position for each hash
+    uint32_t *prev; // previous position with the same hash, indexed by position in window
+    size_t hash_bits;
+    size_t next;    // next position to insert
+} lz77_matcher_t;
+
+/// @brief Allocate new matcher with empty hash chains
+/// @param hash_bits log2 of the number of hash heads
+/// @return ptr to new matcher
+lz77_matcher_t *lz77_matcher_new(const size_t hash_bits);
+
+/// @brief Copy a matcher's hash chains, for reuse of a primed matcher
+/// @param src ptr to the matcher to copy
+/// @return ptr to new matcher
+lz77_matcher_t *lz77_matcher_clone(const lz77_matcher_t *src);
+
+/// @brief Forget all inserted positions
+/// @param m ptr to the matcher
+void lz77_matcher_reset(lz77_matcher_t *m);
+
+/// @brief Insert every position before pos into the hash chains
+/// @param m ptr to the matcher
+/// @param base base of the positions
+/// @param pos first position not to insert
+/// @param end end of readable data
+void lz77_insert_until(lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end);
+
+/// @brief Move past positions before pos without inserting them, e.g. data stored uncompressed
+/// @param m ptr to the matcher
+/// @param pos first position to insert later
+void lz77_skip(lz77_matcher_t *m, const size_t pos);
+
+/// @brief Rebase all positions, forgetting those which fall below delta
+/// @param m ptr to the matcher
+/// @param delta amount subtracted from every position
+void lz77_slide(lz77_matcher_t *m, const size_t delta);
+
+/// @brief Find the longest match for pos among the inserted positions
+/// @param m ptr to the matcher
+/// @param base base of the positions
+/// @param pos position to match
+/// @param end matches do not extend past end
+/// @param params search limits
+/// @param dist ptr receiving the distance of the match
+/// @return length of the match, 0 if shorter than LZ77_MIN_MATCH
+size_t lz77_longest_match(const lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end,
+                          const lz77_params_t *params, size_t *dist);
+
+/// @brief Find the closest match of every length for pos among the inserted positions
+/// @param m ptr to the matcher
+/// @param base base of the positions
+/// @param pos position to match
+/// @param end matches do not extend past end
+/// @param max_chain hash chain links to follow
+/// @param sublen ptr to LZ77_MAX_MATCH + 1 distances, sublen[l] is set for every
+///        l from LZ77_MIN_MATCH up to the returned length
+/// @return length of the longest match, 0 if shorter than LZ77_MIN_MATCH
+size_t lz77_all_matches(const lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end,
+                        const size_t max_chain, uint16_t *sublen);
+
+/// @brief Parse base[start, end) into sequences, greedily or lazily depending on params.
+///        With params->skip_log set, runs of failed searches widen the stride between
+///        searched positions and only those are hashed, until a match is found
+/// @param m ptr to the matcher, positions before start must already be inserted
+/// @param base base of the positions
+/// @param start first position to parse
+/// @param end end of data to parse
+/// @param params search limits
+/// @param seqs ptr to sequence buffer, literals and matches are appended
+/// @return 0 if successful, -1 if not
+int lz77_parse(lz77_matcher_t *m, const uint8_t *base, const size_t start, const size_t end,
+               const lz77_params_t *params, lz77_seqs_t *seqs);
+
+/// @brief Append literals to the current run
+/// @param seqs ptr to sequence buffer
+/// @param data literal bytes
+/// @param size number of literals
+/// @return 0 if successful, -1 if not
+int lz77_seqs_push_literals(lz77_seqs_t *seqs, const uint8_t *data, const size_t size);
+
+/// @brief Append a match, ending the current run of literals
+/// @param seqs ptr to sequence buffer
+/// @param length match length
+/// @param distance match distance
+/// @return 0 if successful, -1 if not
+int lz77_seqs_push_match(lz77_seqs_t *seqs, const size_t length, const size_t distance);
+
+/// @brief Empty the sequence buffer, keeping its storage for the next block
+/// @param seqs ptr to sequence buffer
+void lz77_seqs_clear(lz77_seqs_t *seqs);
+
+/// @brief Free the sequence buffer's storage
+/// @param seqs ptr to sequence buffer
+void lz77_seqs_free(lz77_seqs_t *seqs);
+
+/// @brief Free the matcher
+/// @param m ptr to the matcher
+void lz77_matcher_free(lz77_matcher_t *m);
+
+#endif
\ No newline at end of file
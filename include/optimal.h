@@ -0,0 +1,24 @@
+#ifndef __OPTIMAL_H__
+#define __OPTIMAL_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "deflate.h"
+#include "lz77.h"
+
+/// @brief Parse base[start, end) into the literals and matches which are cheapest under a
+///        bit cost model, by forward dynamic programming over every candidate match.
+///        The model starts from the fixed Huffman code and is refined from the
+///        Huffman code lengths of each pass's result (Zopfli-style)
+/// @param m ptr to the matcher, positions before start must already be inserted
+/// @param base base of the positions
+/// @param start first position to parse
+/// @param end end of data to parse
+/// @param level search limits and number of refinement passes
+/// @param seqs ptr to sequence buffer, literals and matches are appended
+/// @return 0 if successful, -1 if not
+int optimal_parse(lz77_matcher_t *m, const uint8_t *base, const size_t start, const size_t end,
+                  const deflate_level_t *level, lz77_seqs_t *seqs);
+
+#endif
\ No newline at end of file
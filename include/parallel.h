@@ -0,0 +1,84 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "cache.h"
+#include "unzip.h"
+#include "zip.h"
+
+#define PARALLEL_CHUNK_MIN (128 * 1024)
+#define PARALLEL_CHUNK_MAX (1024 * 1024)
+#define PARALLEL_CHUNK_DEFAULT PARALLEL_CHUNK_MIN
+
+typedef struct
+{
+    int level;
+    size_t threads;    // worker threads, 0 for one per online CPU
+    size_t chunk_size; // input bytes per worker job, clamped to PARALLEL_CHUNK_MIN-PARALLEL_CHUNK_MAX
+    cache_t *cache;    // archive entries to reuse and keep, may be nullptr
+} parallel_options_t;
+
+/// Archive entries compressed on a pool of threads, each into its own buffer (or a temporary
+/// file when large), and written in submission order by a writer thread
+typedef struct parallel_zip_t parallel_zip_t;
+
+/// @brief Compress data into one gzip member on several threads (pigz-style).
+///        Chunks are compressed independently, each primed with the last 32 KiB
+///        of the chunk before it, and end byte aligned with a sync flush so they
+///        concatenate into a single standard DEFLATE stream
+/// @param out file receiving the gzip stream
+/// @param data data to compress
+/// @param size size of data
+/// @param opts ptr to options
+/// @return 0 if successful, -1 if not
+int parallel_gzip_compress(FILE *out, const uint8_t *data, const size_t size, const parallel_options_t *opts);
+
+/// @brief Start compressing archive entries in parallel
+/// @param zw ptr to the writer receiving the entries, at whose level they are compressed
+/// @param opts ptr to options, only threads and cache are used
+/// @return ptr to new pool
+parallel_zip_t *parallel_zip_new(zip_writer_t *zw, const parallel_options_t *opts);
+
+/// @brief Queue a file or directory as an entry. Blocks while the bounded queue is full
+/// @param pz ptr to the pool
+/// @param path path of the file or directory to read
+/// @param name entry name, ending in '/' for a directory
+/// @return 0 if successful, -1 if not or an earlier entry failed
+int parallel_zip_add(parallel_zip_t *pz, const char *path, const char *name);
+
+/// @brief Wait until every queued entry has been written. The writer can then be finished
+/// @param pz ptr to the pool
+/// @return 0 if successful, -1 if any entry failed
+int parallel_zip_finish(parallel_zip_t *pz);
+
+/// @brief Finish and free the pool
+/// @param pz ptr to the pool
+void parallel_zip_free(parallel_zip_t *pz);
+
+/// @brief Extract every entry of an archive, or only check them, on several threads. Entries
+///        go to the threads largest first so no large one is left running alone at the end.
+///        Threads create directories and write files independently, sharing no lock
+/// @param uz ptr to the reader
+/// @param dest directory to extract into, nullptr to check the entries without writing them
+/// @param opts ptr to options, only threads is used
+/// @param failed array of an entry's failure flags set for each entry that failed, may be nullptr
+/// @return 0 if every entry succeeded, -1 if not
+int parallel_unzip(const unzip_t *uz, const char *dest, const parallel_options_t *opts, bool *failed);
+
+/// @brief Extract every entry of an archive read front to back, as from a pipe, or only check them.
+///        Entries are found by their local headers and decoded as their data arrives, while a
+///        thread reads ahead. Deflated entries whose sizes follow in a data descriptor are decoded
+///        to their end of stream, stored ones up to the first descriptor matching their data. An entry
+///        that fails does not stop the rest unless its end cannot be found. Local headers carry no
+///        Unix mode, so files are created with the default one
+/// @param fd file to read the archive from, read to its end
+/// @param dest directory to extract into, nullptr to check the entries without writing them
+/// @param failed function called with the terminated name of each entry that failed, may be nullptr
+/// @param arg argument passed to failed
+/// @return 0 if every entry succeeded, -1 if not or the archive is cut short or malformed
+int parallel_unzip_stream(const int fd, const char *dest, void (*failed)(const char *name, void *arg), void *arg);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef __UNZIP_H__
+#define __UNZIP_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "zip.h"
+
+#define UNZIP_NOT_FOUND SIZE_MAX
+
+/// Archive reader. The archive is memory mapped and its central directory parsed
+/// once into entries whose names point into the mapping; entries are then
+/// decoded straight from the mapping, in any order and without further I/O
+typedef struct
+{
+    const uint8_t *map;
+    size_t map_size;
+    zip_entry_t *entries;
+    size_t num_entries;
+    uint64_t cd_offset; // central directory
+    uint64_t cd_size;
+    const zip_index_slot_t *slots; // name index, in the mapping if the archive carries one
+    size_t num_slots;
+    bool slots_mapped;
+} unzip_t;
+
+/// @brief Map an archive and read its central directory
+/// @param path path of the archive
+/// @return ptr to new reader, nullptr if the file cannot be mapped or is not a ZIP archive
+unzip_t *unzip_open(const char *path);
+
+/// @brief Get the name of an entry
+/// @param uz ptr to the reader
+/// @param index entry index
+/// @return ptr to the name in the mapping, not terminated, the length is the entry's name_len
+static inline const char *unzip_name(const unzip_t *uz, const size_t index)
+{
+    return (const char *)uz->map + uz->entries[index].name_pos;
+}
+
+/// @brief Build the name index unless the archive carries one. Done by the first unzip_find,
+///        threads sharing a reader call it before looking up concurrently
+/// @param uz ptr to the reader
+/// @return 0 if successful, -1 if not
+int unzip_index(unzip_t *uz);
+
+/// @brief Find an entry by name through the name index, or by a scan if it cannot be built
+/// @param uz ptr to the reader
+/// @param name entry name
+/// @param name_len length of name
+/// @return entry index, UNZIP_NOT_FOUND if there is none
+size_t unzip_find(unzip_t *uz, const char *name, const size_t name_len);
+
+/// @brief Locate the compressed data of an entry in the mapping
+/// @param uz ptr to the reader
+/// @param index entry index
+/// @return ptr to csize bytes of compressed data, nullptr if the local header is malformed
+const uint8_t *unzip_data(const unzip_t *uz, const size_t index);
+
+/// @brief Decompress an entry and check its CRC
+/// @param uz ptr to the reader
+/// @param index entry index
+/// @param dst buffer for the entry's size bytes
+/// @param dst_cap capacity of dst
+/// @return 0 if successful, -1 if the entry is malformed, corrupt, uses an unsupported method or does not fit in dst
+int unzip_extract(const unzip_t *uz, const size_t index, uint8_t *dst, const size_t dst_cap);
+
+/// @brief Decompress an entry piecewise only to check its CRC and size, using little memory whatever its size
+/// @param uz ptr to the reader
+/// @param index entry index
+/// @return 0 if the entry is intact, -1 if it is malformed, corrupt or uses an unsupported method
+int unzip_verify(const unzip_t *uz, const size_t index);
+
+/// @brief Unmap the archive and free the reader
+/// @param uz ptr to the reader
+void unzip_close(unzip_t *uz);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef __WRAPPER_H__
+#define __WRAPPER_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "bitstream.h"
+#include "dict.h"
+
+#define GZIP_ID1 0x1f
+#define GZIP_ID2 0x8b
+#define GZIP_CM_DEFLATE 8
+#define GZIP_OS_UNIX 3
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+#define GZIP_FLAG_TEXT 0x01
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+#define ZLIB_CM_DEFLATE 8
+#define ZLIB_CINFO_32K 7
+#define ZLIB_FLAG_DICT 0x20
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_TRAILER_SIZE 4
+
+/// Optional gzip member header fields. When read, the pointers address the source buffer
+typedef struct
+{
+    uint32_t mtime;       // modification time in seconds since the epoch, 0 for none
+    uint8_t os;           // GZIP_OS_UNIX etc.
+    bool text;            // data is probably text
+    bool hcrc;            // header carries a CRC-16
+    const uint8_t *extra; // FEXTRA subfields, nullptr for none
+    size_t extra_size;
+    const char *name;     // original file name, nullptr for none
+    const char *comment;  // nullptr for none
+    size_t size;          // size of the header in bytes, set when read
+} gzip_header_t;
+
+/// @brief Write a gzip member header (RFC 1952)
+/// @param bs ptr to bitstream
+/// @param hdr ptr to optional header fields, nullptr for a minimal header
+/// @param level compression level of the member, recorded in XFL
+/// @return 0 if successful, -1 if not
+int gzip_write_header(bitstream_t *bs, const gzip_header_t *hdr, const int level);
+
+/// @brief Write a gzip member trailer
+/// @param bs ptr to byte aligned bitstream
+/// @param crc CRC-32 of the uncompressed data
+/// @param size size of the uncompressed data
+/// @return 0 if successful, -1 if not
+int gzip_write_trailer(bitstream_t *bs, const uint32_t crc, const uint64_t size);
+
+/// @brief Parse a gzip member header
+/// @param src the member
+/// @param src_size size of src
+/// @param hdr ptr to header to fill in
+/// @return 0 if successful, -1 if src does not start with a valid gzip header
+int gzip_read_header(const uint8_t *src, const size_t src_size, gzip_header_t *hdr);
+
+/// @brief Compress data into a single gzip member
+/// @param bs ptr to bitstream receiving the member
+/// @param hdr ptr to optional header fields, nullptr for a minimal header
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level
+/// @return 0 if successful, -1 if not
+int gzip_compress(bitstream_t *bs, const gzip_header_t *hdr, const uint8_t *data, const size_t size,
+                  const int level);
+
+/// @brief Decompress a gzip file, concatenating the data of all its members
+/// @param src the gzip file
+/// @param src_size size of src
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if a member is malformed, fails its checks or does not fit in dst
+int gzip_decompress(const uint8_t *src, const size_t src_size, uint8_t *dst, const size_t dst_cap,
+                    size_t *dst_size);
+
+/// @brief Compress data into a zlib stream (RFC 1950)
+/// @param bs ptr to bitstream receiving the stream
+/// @param dict ptr to preset dictionary, nullptr for none
+/// @param data data to compress
+/// @param size size of data
+/// @param level compression level
+/// @return 0 if successful, -1 if not
+int zlib_compress(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level);
+
+/// @brief Decompress a zlib stream
+/// @param dict ptr to the dictionary named in the stream header, nullptr for none
+/// @param src the stream
+/// @param src_size size of src
+/// @param dst buffer for decompressed data
+/// @param dst_cap capacity of dst
+/// @param dst_size ptr receiving the size of the decompressed data
+/// @return 0 if successful, -1 if the stream is malformed, needs another dictionary,
+///         fails its checksum or does not fit in dst
+int zlib_decompress(const dict_t *dict, const uint8_t *src, const size_t src_size, uint8_t *dst,
+                    const size_t dst_cap, size_t *dst_size);
+
+#endif
\ No newline at end of file
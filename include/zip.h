@@ -0,0 +1,220 @@
+#ifndef __ZIP_H__
+#define __ZIP_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "deflate.h"
+
+#define ZIP_LOCAL_SIG 0x04034b50u
+#define ZIP_DESCRIPTOR_SIG 0x08074b50u
+#define ZIP_CENTRAL_SIG 0x02014b50u
+#define ZIP_EOCD_SIG 0x06054b50u
+#define ZIP64_EOCD_SIG 0x06064b50u
+#define ZIP64_LOCATOR_SIG 0x07064b50u
+
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_DESCRIPTOR_SIZE 16
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_EOCD_SIZE 22
+#define ZIP64_DESCRIPTOR_SIZE 24
+#define ZIP64_EOCD_SIZE 56
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP64_EXTRA_SIZE 28 // header and up to three 64 bit values
+
+#define ZIP_METHOD_STORE 0
+#define ZIP_METHOD_DEFLATE 8
+
+#define ZIP_FLAG_DESCRIPTOR 0x0008 // crc and sizes follow the data
+#define ZIP_FLAG_UTF8 0x0800
+
+#define ZIP_VERSION 20   // 2.0: deflate, directories
+#define ZIP64_VERSION 45 // 4.5: ZIP64
+#define ZIP_OS_UNIX 3
+#define ZIP_NAME_MAX UINT16_MAX
+
+// Counts, sizes and offsets from these up go in ZIP64 records, leaving the value all ones in the 16 or 32 bit field
+#define ZIP_ENTRIES_MAX UINT16_MAX
+#define ZIP_OFFSET_MAX UINT32_MAX
+
+// Name index block (plzip specific): slots followed by a trailer of signature, slot
+// count and entry count, ending right where the central directory starts. Indexes
+// under the earlier "PIDX" signature used a host dependent hash and are ignored
+#define ZIP_INDEX_SIG 0x32584950u // "PIX2"
+#define ZIP_INDEX_TRAILER_SIZE 16
+#define ZIP_INDEX_ALIGN 8
+#define ZIP_INDEX_EMPTY UINT32_MAX
+#define ZIP_INDEX_HASH_PREFIX 255 // name bytes hashed, longer names share the hash of their prefix
+
+/// One central directory record. The name is name_len bytes at name_pos in the
+/// writer's name buffer or the reader's mapping, not terminated
+typedef struct
+{
+    uint64_t offset; // of the local header
+    uint64_t size;
+    uint64_t csize;
+    uint64_t name_pos;
+    uint32_t crc;
+    uint32_t dos_time; // MS-DOS date in the high half, time in the low half
+    uint32_t attr;     // external attributes, the Unix mode in the high half
+    uint16_t name_len;
+    uint16_t method;
+    uint16_t flags;
+} zip_entry_t;
+
+/// Slot of the open addressed name index, linearly probed from the slot the hash selects
+typedef struct
+{
+    uint32_t hash;
+    uint32_t index; // entry index, ZIP_INDEX_EMPTY for a free slot
+} zip_index_slot_t;
+
+/// Archive writer. Output only ever goes forward, so the archive may be a pipe:
+/// local headers of entries compressed on the fly leave crc and sizes zero and a
+/// data descriptor follows the data. The central directory is written at the end.
+/// ZIP64 records are only written for the entries and archives that need them;
+/// the descriptor of a streamed entry has 64 bit sizes if it turned out to need them
+typedef struct
+{
+    FILE *out;
+    uint64_t offset; // bytes written so far
+    int level;       // 0 stores every entry
+    zip_entry_t *entries;
+    size_t num_entries;
+    size_t capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    deflate_stream_t *ds; // stream of the open entry
+    uint8_t *buf;         // compressed output on its way to out
+    bool open;            // an entry has been begun and not ended
+    bool index;           // write a name index before the central directory
+    bool choose;          // pick each added entry's method and level with zip_choose_level
+} zip_writer_t;
+
+/// @brief Convert a time to the MS-DOS date and time ZIP stores, local time with 2 second resolution
+/// @param t time in seconds since the epoch
+/// @return date in the high half, time in the low half
+uint32_t zip_dos_time(const time_t t);
+
+/// @brief Hash an entry name for the name index: the one-at-a-time hash of its first ZIP_INDEX_HASH_PREFIX
+/// bytes, read unsigned in 32 bit arithmetic so that every host agrees on it
+/// @param name entry name, not necessarily terminated
+/// @param name_len length of name
+/// @return hash
+uint32_t zip_index_hash(const char *name, const size_t name_len);
+
+/// @brief Get the number of slots of a name index
+/// @param num_entries number of entries
+/// @return a power of two at least twice num_entries
+size_t zip_index_slots(const size_t num_entries);
+
+/// @brief Fill a name index. Entries of equal names are found in entry order
+/// @param slots zip_index_slots(num_entries) slots
+/// @param num_slots number of slots
+/// @param entries entries to index
+/// @param num_entries number of entries
+/// @param names base that the entries' name_pos is relative to
+void zip_index_fill(zip_index_slot_t *slots, const size_t num_slots, const zip_entry_t *entries,
+                    const size_t num_entries, const char *names);
+
+/// @brief Set the time and external attributes of an entry
+/// @param e ptr to the entry
+/// @param mtime modification time in seconds since the epoch
+/// @param mode Unix mode, 0 for the default of a file or directory
+/// @param dir whether the entry is a directory
+void zip_entry_stamp(zip_entry_t *e, const time_t mtime, uint32_t mode, const bool dir);
+
+/// @brief Pick the level to compress an entry at from its magic number, the extension of its
+///        name and a sample of its data: already compressed data is stored, data of a
+///        compressed format that still looks compressible gets the fastest level, the rest level
+/// @param name entry name
+/// @param data entry data
+/// @param size size of data
+/// @param level level for data that compresses
+/// @return 0 to store the entry, otherwise the level to compress it at
+int zip_choose_level(const char *name, const uint8_t *data, const size_t size, const int level);
+
+/// @brief Allocate an archive writer. It picks each entry's method unless choose is cleared
+/// @param out file receiving the archive, may be a pipe
+/// @param level compression level, 0 to store entries uncompressed
+/// @return ptr to new writer
+zip_writer_t *zip_writer_new(FILE *out, const int level);
+
+/// @brief Add an entry whose data is at hand. Stored entries carry crc and sizes in
+///        their local header, compressed ones are streamed like zip_writer_begin.
+///        The method and level are chosen from the data if choose is set
+/// @param zw ptr to the writer
+/// @param name entry name, '/' separated, ending in '/' for a directory
+/// @param mtime modification time in seconds since the epoch
+/// @param mode Unix mode, 0 for the default of a file or directory
+/// @param data entry data
+/// @param size size of data
+/// @return 0 if successful, -1 if not
+int zip_writer_add(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode,
+                   const uint8_t *data, const size_t size);
+
+/// @brief Add an entry whose data is already compressed, e.g. on another thread. Its crc
+///        and sizes are known, so they go in the local header and no data descriptor follows
+/// @param zw ptr to the writer
+/// @param entry ptr to the entry's method, crc, size, csize, dos_time, attr and name_len
+/// @param name entry name of name_len bytes
+/// @param data csize bytes of data as the method left them
+/// @return 0 if successful, -1 if not
+int zip_writer_add_raw(zip_writer_t *zw, const zip_entry_t *entry, const char *name, const uint8_t *data);
+
+/// @brief Add an entry whose compressed data sits in another file, usually another archive,
+///        without decoding it. The data is moved by the kernel, by copy_file_range where it
+///        can and otherwise sendfile, so it does not pass through user space
+/// @param zw ptr to the writer
+/// @param entry ptr to the entry's flags, method, crc, size, csize, dos_time, attr and name_len
+/// @param name entry name of name_len bytes
+/// @param fd file holding the data
+/// @param offset position of the entry's csize bytes of data in fd
+/// @return 0 if successful, -1 if not
+int zip_writer_add_copy(zip_writer_t *zw, const zip_entry_t *entry, const char *name, const int fd,
+                        const uint64_t offset);
+
+/// @brief Record an entry that the output holds already, before the writer's offset, as when
+///        appending to an archive in place, where out is positioned and offset set past the
+///        kept entries first. Only its central record is written, by zip_writer_finish
+/// @param zw ptr to the writer
+/// @param entry ptr to the entry as read from the archive's central directory
+/// @param name entry name of name_len bytes
+/// @return 0 if successful, -1 if not
+int zip_writer_keep(zip_writer_t *zw, const zip_entry_t *entry, const char *name);
+
+/// @brief Start an entry whose data is compressed as it is written
+/// @param zw ptr to the writer
+/// @param name entry name, '/' separated
+/// @param mtime modification time in seconds since the epoch
+/// @param mode Unix mode, 0 for the default of a file
+/// @return 0 if successful, -1 if not or another entry is open
+int zip_writer_begin(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode);
+
+/// @brief Compress more data of the open entry
+/// @param zw ptr to the writer
+/// @param data data
+/// @param size size of data
+/// @return 0 if successful, -1 if not
+int zip_writer_write(zip_writer_t *zw, const uint8_t *data, const size_t size);
+
+/// @brief End the open entry with its data descriptor
+/// @param zw ptr to the writer
+/// @return 0 if successful, -1 if not
+int zip_writer_end(zip_writer_t *zw);
+
+/// @brief Write the name index if enabled, the central directory and end of central directory
+///        record. Flushes but does not close out
+/// @param zw ptr to the writer
+/// @return 0 if successful, -1 if not
+int zip_writer_finish(zip_writer_t *zw);
+
+/// @brief Free the writer
+/// @param zw ptr to the writer
+void zip_writer_free(zip_writer_t *zw);
+
+#endif
\ No newline at end of file
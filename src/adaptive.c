@@ -0,0 +1,206 @@
+#include "adaptive.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+#define ADAPTIVE_LEAF 0x8000 // child of a leaf: flag and symbol
+#define ADAPTIVE_NONE UINT16_MAX
+
+static bool is_leaf(const adaptive_huffman_t *ah, const size_t node)
+{
+    return ah->child[node] & ADAPTIVE_LEAF;
+}
+
+adaptive_huffman_t *adaptive_huffman_new(void)
+{
+    adaptive_huffman_t *ah = malloc(sizeof(adaptive_huffman_t));
+    if (ah == nullptr)
+        return nullptr;
+
+    adaptive_huffman_reset(ah);
+    return ah;
+}
+
+void adaptive_huffman_reset(adaptive_huffman_t *ah)
+{
+    size_t i;
+
+    for (i = 0; i < ADAPTIVE_NUM_NODES - 1; i++)
+        ah->free_blocks[i] = (uint16_t)(i + 1);
+    ah->num_free = ADAPTIVE_NUM_NODES - 1;
+    ah->block[ADAPTIVE_ROOT] = 0;
+    ah->leader[0] = ADAPTIVE_ROOT;
+
+    memset(ah->leaf, 0xff, sizeof(ah->leaf));
+    ah->nyt = ADAPTIVE_ROOT;
+    ah->leaf[ADAPTIVE_NYT] = ADAPTIVE_ROOT;
+    ah->weight[ADAPTIVE_ROOT] = 0;
+    ah->parent[ADAPTIVE_ROOT] = ADAPTIVE_NONE;
+    ah->child[ADAPTIVE_ROOT] = ADAPTIVE_LEAF | ADAPTIVE_NYT;
+}
+
+// Point whatever now sits at node back at it: its symbol, or its children
+static void adopt(adaptive_huffman_t *ah, const size_t node)
+{
+    if (is_leaf(ah, node))
+        ah->leaf[ah->child[node] & ~ADAPTIVE_LEAF] = (uint16_t)node;
+    else
+        ah->parent[ah->child[node]] = ah->parent[ah->child[node] - 1] = (uint16_t)node;
+}
+
+// The NYT leaf becomes a branch over a new NYT leaf and a leaf for symbol, both weight 0
+static size_t split_nyt(adaptive_huffman_t *ah, const size_t symbol)
+{
+    size_t p = ah->nyt;
+
+    ah->child[p] = (uint16_t)(p - 1);
+    ah->child[p - 1] = (uint16_t)(ADAPTIVE_LEAF | symbol);
+    ah->child[p - 2] = ADAPTIVE_LEAF | ADAPTIVE_NYT;
+    ah->weight[p - 1] = ah->weight[p - 2] = 0;
+    ah->parent[p - 1] = ah->parent[p - 2] = (uint16_t)p;
+    ah->block[p - 1] = ah->block[p - 2] = ah->block[p]; // p alone had weight 0, and stays the leader
+    ah->leaf[symbol] = (uint16_t)(p - 1);
+    ah->leaf[ADAPTIVE_NYT] = (uint16_t)(p - 2);
+    ah->nyt = (uint16_t)(p - 2);
+    return p - 1;
+}
+
+// Increment nodes lo to hi, the top of their block, moving them into the block above
+static void promote(adaptive_huffman_t *ah, const size_t lo, const size_t hi)
+{
+    uint16_t b = ah->block[hi];
+    size_t i;
+
+    // The rest of the block keeps its weight, led by the node below
+    if (lo > ah->nyt && ah->block[lo - 1] == b)
+        ah->leader[b] = (uint16_t)(lo - 1);
+    else
+        ah->free_blocks[ah->num_free++] = b;
+
+    for (i = lo; i <= hi; i++)
+        ah->weight[i]++;
+
+    // Weights never decrease with the node number, so only the node above can share the new one
+    if (hi != ADAPTIVE_ROOT && ah->weight[hi + 1] == ah->weight[hi])
+        b = ah->block[hi + 1];
+    else
+    {
+        b = ah->free_blocks[--ah->num_free];
+        ah->leader[b] = (uint16_t)hi;
+    }
+
+    for (i = lo; i <= hi; i++)
+        ah->block[i] = b;
+}
+
+// Increment the weights from node up to the root. Swapping each node with its
+// block leader first lets the increment keep the order
+static void update(adaptive_huffman_t *ah, size_t node)
+{
+    size_t leader;
+    uint16_t child;
+
+    while (node != ADAPTIVE_ROOT)
+    {
+        leader = ah->leader[ah->block[node]];
+
+        // Only the NYT's sibling can share its parent's weight. The parent is numbered
+        // right above it, so when it leads the block both move up together
+        if (leader == ah->parent[node])
+        {
+            promote(ah, node, leader);
+            if (leader == ADAPTIVE_ROOT)
+                return;
+            node = ah->parent[leader];
+            continue;
+        }
+
+        if (leader != node)
+        {
+            child = ah->child[node];
+            ah->child[node] = ah->child[leader];
+            ah->child[leader] = child;
+            adopt(ah, node);
+            adopt(ah, leader);
+            node = leader;
+        }
+
+        promote(ah, node, node);
+        node = ah->parent[node];
+    }
+
+    promote(ah, ADAPTIVE_ROOT, ADAPTIVE_ROOT);
+}
+
+int adaptive_huffman_encode(adaptive_huffman_t *ah, bitstream_t *bs, const uint8_t *data, const size_t size)
+{
+    size_t i, node, len;
+    uint64_t code;
+
+    for (i = 0; i < size; i++)
+    {
+        if (ah->weight[ADAPTIVE_ROOT] == UINT32_MAX)
+            return -1;
+
+        // Walking up yields the bits last first, so the root's ends up least significant.
+        // Weights below 2^32 keep the tree shallower than 64
+        node = ah->leaf[data[i]] != ADAPTIVE_NONE ? ah->leaf[data[i]] : ah->nyt;
+        for (code = 0, len = 0; node != ADAPTIVE_ROOT; node = ah->parent[node], len++)
+            code = (code << 1) | (ah->child[ah->parent[node]] == node);
+
+        if (bitstream_write_lsb(bs, code, len))
+            return -1;
+
+        if (ah->leaf[data[i]] == ADAPTIVE_NONE)
+        {
+            if (bitstream_write_lsb(bs, data[i], UINT8_BIT_COUNT))
+                return -1;
+            node = split_nyt(ah, data[i]);
+        }
+        else
+            node = ah->leaf[data[i]];
+
+        update(ah, node);
+    }
+
+    return 0;
+}
+
+int adaptive_huffman_decode(adaptive_huffman_t *ah, const uint8_t *src, const size_t src_size, size_t *bit_pos,
+                            uint8_t *dst, const size_t size)
+{
+    size_t i, k, node, pos = *bit_pos, end = src_size * UINT8_BIT_COUNT;
+    uint8_t symbol;
+
+    for (i = 0; i < size; i++)
+    {
+        for (node = ADAPTIVE_ROOT; !is_leaf(ah, node); pos++)
+        {
+            if (pos == end)
+                return -1;
+            node = (src[pos >> 3] >> (pos & 7)) & 1 ? ah->child[node] : ah->child[node] - 1u;
+        }
+
+        if (node == ah->nyt)
+        {
+            if (end - pos < UINT8_BIT_COUNT)
+                return -1;
+            for (symbol = 0, k = 0; k < UINT8_BIT_COUNT; k++, pos++)
+                symbol |= (uint8_t)(((src[pos >> 3] >> (pos & 7)) & 1) << k);
+            node = split_nyt(ah, symbol);
+        }
+        else
+            symbol = (uint8_t)(ah->child[node] & ~ADAPTIVE_LEAF);
+
+        dst[i] = symbol;
+        update(ah, node);
+        *bit_pos = pos;
+    }
+
+    return 0;
+}
+
+void adaptive_huffman_free(adaptive_huffman_t *ah)
+{
+    free(ah);
+}
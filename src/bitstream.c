@@ -1,6 +1,7 @@
 #include "bitstream.h"
 
 #include <malloc.h>
+#include <memory.h>
 #include <assert.h>
 
 
@@ -12,6 +13,7 @@ bitstream_t *bitstream_new(const size_t init_size)
     bs->stream = calloc(init_size, sizeof(uint8_t));
     if (bs->stream == nullptr)
         return nullptr;
+    bs->capacity = init_size;
     return bs;
 }
 
@@ -107,6 +109,104 @@ void bitstream_write_64(bitstream_t *bs, const uint64_t bits, const size_t num_b
     bitstream_write_32(bs, (const uint16_t)bits, num_bits - UINT32_BIT_COUNT);
 }
 
+void bitstream_clear(bitstream_t *bs)
+{
+    // Writes OR into the stream, so used bytes must be zeroed again
+    memset(bs->stream, 0, bs->byte_offset + (bs->bit_offset ? 1 : 0));
+    bs->size = 0;
+    bs->bit_offset = 0;
+    bs->byte_offset = 0;
+}
+
+int bitstream_reserve(bitstream_t *bs, const size_t size)
+{
+    uint8_t *stream;
+    size_t capacity;
+    // Keep the partially written byte and one spare for the next write
+    size_t needed = bs->byte_offset + size + 1;
+
+    if (needed <= bs->capacity)
+        return 0;
+
+    capacity = bs->capacity ? bs->capacity : 64;
+    while (capacity < needed)
+        capacity *= 2;
+
+    stream = realloc(bs->stream, capacity);
+    if (stream == nullptr)
+        return -1;
+
+    memset(stream + bs->capacity, 0, capacity - bs->capacity);
+    bs->stream = stream;
+    bs->capacity = capacity;
+    return 0;
+}
+
+void bitstream_discard(bitstream_t *bs, const size_t size)
+{
+    size_t used = bs->byte_offset + (bs->bit_offset ? 1 : 0);
+    assert(size <= bs->byte_offset);
+
+    // The partial byte moves along, freed bytes are zeroed for later writes
+    memmove(bs->stream, bs->stream + size, used - size);
+    memset(bs->stream + used - size, 0, size);
+    bs->byte_offset -= size;
+    bs->size -= size * UINT8_BIT_COUNT;
+}
+
+int bitstream_write_lsb(bitstream_t *bs, const uint64_t data, const size_t num_bits)
+{
+    uint64_t bits = data;
+    size_t n, left = num_bits;
+    assert(num_bits <= UINT64_BIT_COUNT);
+
+    if (bitstream_reserve(bs, num_bits / UINT8_BIT_COUNT + 1))
+        return -1;
+
+    while (left > 0)
+    {
+        // Fill the current byte from its least significant free bit upwards
+        n = UINT8_BIT_COUNT - bs->bit_offset;
+        if (n > left)
+            n = left;
+
+        bs->stream[bs->byte_offset] |= (uint8_t)((bits & ((1u << n) - 1)) << bs->bit_offset);
+        bits >>= n;
+        left -= n;
+        bs->bit_offset += n;
+        if (bs->bit_offset >= UINT8_BIT_COUNT)
+        {
+            bs->bit_offset = 0;
+            bs->byte_offset++;
+        }
+    }
+    bs->size += num_bits;
+    return 0;
+}
+
+void bitstream_align(bitstream_t *bs)
+{
+    if (bs->bit_offset == 0)
+        return;
+
+    bs->size += UINT8_BIT_COUNT - bs->bit_offset;
+    bs->bit_offset = 0;
+    bs->byte_offset++;
+}
+
+int bitstream_write_bytes(bitstream_t *bs, const uint8_t *data, const size_t size)
+{
+    assert(bs->bit_offset == 0);
+
+    if (bitstream_reserve(bs, size))
+        return -1;
+
+    memcpy(bs->stream + bs->byte_offset, data, size);
+    bs->byte_offset += size;
+    bs->size += size * UINT8_BIT_COUNT;
+    return 0;
+}
+
 void print_bitstream(const bitstream_t *bs)
 {
     size_t i;
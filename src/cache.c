@@ -0,0 +1,504 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "checksum.h"
+
+#define CACHE_PATH_SIZE 4096
+#define CACHE_HEADER_SIZE 28 // signature, tick, blob and record counts
+#define CACHE_KEY_SIZE 25
+#define CACHE_BLOB_SIZE 43
+#define CACHE_RECORD_SIZE 43 // and the path
+
+static void put_le16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_le64(uint8_t *p, const uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+// The content hash is well mixed already
+static size_t key_hash(const cache_key_t *key)
+{
+    return (size_t)(key->hash ^ key->size ^ (uint64_t)(uint32_t)key->level << 40 ^ (uint64_t)key->choose << 32);
+}
+
+static int key_compare(const cache_key_t *a, const cache_key_t *b)
+{
+    return a->size != b->size || a->hash != b->hash || a->crc != b->crc || a->level != b->level ||
+           a->choose != b->choose;
+}
+
+static void put_key(uint8_t *p, const cache_key_t *key)
+{
+    put_le64(p, key->size);
+    put_le64(p + 8, key->hash);
+    put_le32(p + 16, key->crc);
+    put_le32(p + 20, (uint32_t)key->level);
+    p[24] = key->choose;
+}
+
+static cache_key_t get_key(const uint8_t *p)
+{
+    return (cache_key_t){get_le64(p), get_le64(p + 8), get_le32(p + 16), (int32_t)get_le32(p + 20), p[24] != 0};
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// Blobs of stored entries have no file but count their bookkeeping, so that they are evicted too
+static uint64_t blob_cost(const cache_blob_t *b)
+{
+    return (b->method == ZIP_METHOD_STORE ? 0 : b->csize) + sizeof(cache_blob_t);
+}
+
+// Blobs made without zip_choose_level, as plzip -f makes them, end in -f
+static int blob_path(const cache_t *c, const cache_key_t *key, char *path)
+{
+    return (size_t)snprintf(path, CACHE_PATH_SIZE, "%s/%016" PRIx64 "-%08" PRIx32 "-%" PRIx64 "-%d%s", c->dir,
+                            key->hash, key->crc, key->size, key->level, key->choose ? "" : "-f") < CACHE_PATH_SIZE
+               ? 0
+               : -1;
+}
+
+static int put_blob(cache_t *c, const cache_blob_t *blob)
+{
+    cache_blob_t *b;
+
+    if (hashmap_get(&c->blobs, &blob->key) != nullptr)
+        return 0;
+
+    b = malloc(sizeof(cache_blob_t));
+    if (b == nullptr)
+        return -1;
+
+    *b = *blob;
+    if (hashmap_put(&c->blobs, &b->key, b))
+    {
+        free(b);
+        return -1;
+    }
+
+    c->size += blob_cost(b);
+    return 0;
+}
+
+static void remove_blob(cache_t *c, cache_blob_t *b)
+{
+    char path[CACHE_PATH_SIZE];
+
+    if (b->method != ZIP_METHOD_STORE && blob_path(c, &b->key, path) == 0)
+        unlink(path);
+    hashmap_remove(&c->blobs, &b->key);
+    c->size -= blob_cost(b);
+    free(b);
+}
+
+// Records are kept under the resolved path: the same relative path run from another
+// directory, or through a link, must not find another file's record
+static int record_path(const char *path, char *real)
+{
+    return realpath(path, real) == nullptr ? -1 : 0;
+}
+
+// Point the record of a resolved path at what it holds now
+static int put_record(cache_t *c, const char *path, const uint64_t size, const int64_t mtime, const cache_key_t *key)
+{
+    cache_record_t *r = hashmap_get(&c->records, path);
+
+    if (r == nullptr)
+    {
+        r = malloc(sizeof(cache_record_t));
+        if (r == nullptr)
+            return -1;
+        r->path = strdup(path);
+        if (r->path == nullptr || hashmap_put(&c->records, r->path, r))
+        {
+            free(r->path);
+            free(r);
+            return -1;
+        }
+    }
+
+    r->size = size;
+    r->mtime = mtime;
+    r->key = *key;
+    return 0;
+}
+
+static void free_records(cache_t *c)
+{
+    cache_record_t *r;
+    cache_blob_t *b;
+
+    hashmap_foreach_data(r, &c->records)
+    {
+        free(r->path);
+        free(r);
+    }
+    hashmap_foreach_data(b, &c->blobs)
+        free(b);
+    hashmap_cleanup(&c->records);
+    hashmap_cleanup(&c->blobs);
+}
+
+// Anything malformed ends the load, keeping what came before it
+static void load_index(cache_t *c)
+{
+    char path[CACHE_PATH_SIZE], name[CACHE_PATH_SIZE];
+    uint64_t i, num_blobs, num_records;
+    const uint8_t *p, *end;
+    uint8_t *buf = nullptr;
+    cache_blob_t blob;
+    cache_key_t key;
+    size_t len;
+    long size;
+    FILE *f;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/index", c->dir) >= sizeof(path) || (f = fopen(path, "rb")) == nullptr)
+        return;
+
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= CACHE_HEADER_SIZE && fseek(f, 0, SEEK_SET) == 0 &&
+        (buf = malloc((size_t)size)) != nullptr && fread(buf, sizeof(uint8_t), (size_t)size, f) == (size_t)size &&
+        get_le32(buf) == CACHE_INDEX_SIG)
+    {
+        c->tick = get_le64(buf + 4);
+        num_blobs = get_le64(buf + 12);
+        num_records = get_le64(buf + 20);
+        p = buf + CACHE_HEADER_SIZE;
+        end = buf + size;
+
+        for (i = 0; i < num_blobs && end - p >= CACHE_BLOB_SIZE; i++, p += CACHE_BLOB_SIZE)
+        {
+            blob = (cache_blob_t){
+                .key = get_key(p),
+                .csize = get_le64(p + CACHE_KEY_SIZE),
+                .used = get_le64(p + CACHE_KEY_SIZE + 8),
+                .method = get_le16(p + CACHE_KEY_SIZE + 16),
+            };
+            if (put_blob(c, &blob))
+                break;
+        }
+
+        for (i = 0; i < num_records && end - p >= CACHE_RECORD_SIZE; i++, p += CACHE_RECORD_SIZE + len)
+        {
+            key = get_key(p + 16);
+            len = get_le16(p + 16 + CACHE_KEY_SIZE);
+            if ((size_t)(end - p) - CACHE_RECORD_SIZE < len || len >= sizeof(name))
+                break;
+            memcpy(name, p + CACHE_RECORD_SIZE, len);
+            name[len] = '\0';
+            if (put_record(c, name, get_le64(p), (int64_t)get_le64(p + 8), &key))
+                break;
+        }
+    }
+
+    free(buf);
+    fclose(f);
+}
+
+cache_t *cache_open(const char *dir, const uint64_t max_size)
+{
+    cache_t *c;
+
+    if (mkdir(dir, 0755) && errno != EEXIST)
+        return nullptr;
+
+    c = calloc(1, sizeof(cache_t));
+    if (c == nullptr)
+        return nullptr;
+
+    c->dir = strdup(dir);
+    if (c->dir == nullptr)
+    {
+        free(c);
+        return nullptr;
+    }
+
+    c->max_size = max_size;
+    hashmap_init(&c->blobs, key_hash, key_compare);
+    hashmap_init(&c->records, hashmap_hash_string, strcmp);
+    pthread_mutex_init(&c->lock, nullptr);
+    load_index(c);
+    return c;
+}
+
+uint64_t cache_hash(const uint8_t *data, const size_t size)
+{
+    return xxh64(data, size, 0);
+}
+
+// Forget a blob whose file is missing or damaged
+static void drop_blob(cache_t *c, const cache_key_t *key)
+{
+    cache_blob_t *b;
+
+    pthread_mutex_lock(&c->lock);
+    b = hashmap_get(&c->blobs, key);
+    if (b != nullptr)
+        remove_blob(c, b);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Take a blob found under the lock, which is released, and map its data. Its file must hold
+// exactly csize bytes: one cut short by a crash would fault when the mapping is read
+static int use_blob(cache_t *c, cache_blob_t *b, zip_entry_t *entry, uint8_t **data)
+{
+    char path[CACHE_PATH_SIZE];
+    cache_blob_t blob = *b;
+    struct stat st;
+    void *map = MAP_FAILED;
+    int fd;
+
+    b->used = ++c->tick;
+    pthread_mutex_unlock(&c->lock);
+
+    *data = nullptr;
+    if (blob.method != ZIP_METHOD_STORE)
+    {
+        if (blob_path(c, &blob.key, path))
+            return -1;
+        fd = open(path, O_RDONLY);
+        if (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size == blob.csize && blob.csize > 0)
+            map = mmap(nullptr, blob.csize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (fd >= 0)
+            close(fd);
+        if (map == MAP_FAILED)
+        {
+            drop_blob(c, &blob.key);
+            return -1;
+        }
+        *data = map;
+    }
+
+    entry->method = blob.method;
+    entry->crc = blob.key.crc;
+    entry->size = blob.key.size;
+    entry->csize = blob.csize;
+    return 0;
+}
+
+int cache_find(cache_t *c, const char *path, const struct stat *st, const int level, const bool choose,
+               zip_entry_t *entry, uint8_t **data)
+{
+    char real[PATH_MAX];
+    cache_record_t *r;
+    cache_blob_t *b;
+
+    if (record_path(path, real))
+        return -1;
+
+    pthread_mutex_lock(&c->lock);
+    r = hashmap_get(&c->records, real);
+    if (r == nullptr || r->size != (uint64_t)st->st_size || r->mtime != mtime_ns(st) || r->key.level != level ||
+        r->key.choose != choose || (b = hashmap_get(&c->blobs, &r->key)) == nullptr)
+    {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+
+    return use_blob(c, b, entry, data);
+}
+
+int cache_find_content(cache_t *c, const char *path, const struct stat *st, const cache_key_t *key,
+                       zip_entry_t *entry, uint8_t **data)
+{
+    char real[PATH_MAX];
+    bool resolved = record_path(path, real) == 0;
+    cache_blob_t *b;
+
+    pthread_mutex_lock(&c->lock);
+    b = hashmap_get(&c->blobs, key);
+    if (b == nullptr)
+    {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+
+    // The content is found all the same when the path cannot be resolved, it is just not recorded
+    if (resolved)
+        put_record(c, real, (uint64_t)st->st_size, mtime_ns(st), key);
+    return use_blob(c, b, entry, data);
+}
+
+int cache_add(cache_t *c, const char *path, const struct stat *st, const cache_key_t *key, const zip_entry_t *entry,
+              const uint8_t *data)
+{
+    char tmp[CACHE_PATH_SIZE], name[CACHE_PATH_SIZE], real[PATH_MAX];
+    int fd, ret;
+    cache_blob_t blob = {
+        .key = *key,
+        .csize = entry->csize,
+        .method = entry->method,
+    };
+
+    if (record_path(path, real))
+        return -1;
+
+    // Written aside and renamed into place, so a blob file is always complete
+    if (entry->method != ZIP_METHOD_STORE)
+    {
+        if ((size_t)snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", c->dir) >= sizeof(tmp) || blob_path(c, key, name) ||
+            (fd = mkstemp(tmp)) < 0)
+            return -1;
+
+        ret = write(fd, data, entry->csize) == (ssize_t)entry->csize ? 0 : -1;
+        if (close(fd) || ret || rename(tmp, name))
+        {
+            unlink(tmp);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&c->lock);
+    blob.used = ++c->tick;
+    ret = put_blob(c, &blob) == 0 && put_record(c, real, (uint64_t)st->st_size, mtime_ns(st), key) == 0 ? 0 : -1;
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+static int older_first(const void *a, const void *b)
+{
+    const cache_blob_t *x = *(cache_blob_t *const *)a, *y = *(cache_blob_t *const *)b;
+    return x->used < y->used ? -1 : x->used > y->used;
+}
+
+static void evict(cache_t *c)
+{
+    size_t i = 0, n = hashmap_size(&c->blobs);
+    cache_blob_t **order, *b;
+
+    if (c->size <= c->max_size || (order = malloc(n * sizeof(cache_blob_t *))) == nullptr)
+        return;
+
+    hashmap_foreach_data(b, &c->blobs)
+        order[i++] = b;
+    qsort(order, n, sizeof(cache_blob_t *), older_first);
+
+    for (i = 0; i < n && c->size > c->max_size; i++)
+        remove_blob(c, order[i]);
+    free(order);
+}
+
+// Records whose blob was evicted are dropped
+static bool kept(cache_t *c, const cache_record_t *r)
+{
+    return hashmap_get(&c->blobs, &r->key) != nullptr && strlen(r->path) < CACHE_PATH_SIZE;
+}
+
+static int save_index(cache_t *c)
+{
+    char path[CACHE_PATH_SIZE], tmp[CACHE_PATH_SIZE];
+    uint8_t rec[CACHE_HEADER_SIZE + CACHE_BLOB_SIZE + CACHE_RECORD_SIZE];
+    uint64_t num_records = 0;
+    cache_record_t *r;
+    cache_blob_t *b;
+    int fd, ret = 0;
+    size_t len;
+    FILE *f;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/index", c->dir) >= sizeof(path) ||
+        (size_t)snprintf(tmp, sizeof(tmp), "%s/index.XXXXXX", c->dir) >= sizeof(tmp) || (fd = mkstemp(tmp)) < 0)
+        return -1;
+    f = fdopen(fd, "wb");
+    if (f == nullptr)
+    {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    hashmap_foreach_data(r, &c->records)
+        num_records += kept(c, r);
+
+    put_le32(rec, CACHE_INDEX_SIG);
+    put_le64(rec + 4, c->tick);
+    put_le64(rec + 12, hashmap_size(&c->blobs));
+    put_le64(rec + 20, num_records);
+    ret |= fwrite(rec, sizeof(uint8_t), CACHE_HEADER_SIZE, f) != CACHE_HEADER_SIZE;
+
+    hashmap_foreach_data(b, &c->blobs)
+    {
+        put_key(rec, &b->key);
+        put_le64(rec + CACHE_KEY_SIZE, b->csize);
+        put_le64(rec + CACHE_KEY_SIZE + 8, b->used);
+        put_le16(rec + CACHE_KEY_SIZE + 16, b->method);
+        ret |= fwrite(rec, sizeof(uint8_t), CACHE_BLOB_SIZE, f) != CACHE_BLOB_SIZE;
+    }
+
+    hashmap_foreach_data(r, &c->records)
+    {
+        if (!kept(c, r))
+            continue;
+
+        len = strlen(r->path);
+        put_le64(rec, r->size);
+        put_le64(rec + 8, (uint64_t)r->mtime);
+        put_key(rec + 16, &r->key);
+        put_le16(rec + 16 + CACHE_KEY_SIZE, (uint16_t)len);
+        ret |= fwrite(rec, sizeof(uint8_t), CACHE_RECORD_SIZE, f) != CACHE_RECORD_SIZE;
+        ret |= fwrite(r->path, sizeof(char), len, f) != len;
+    }
+
+    if (fclose(f) || ret || rename(tmp, path))
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int cache_close(cache_t *c)
+{
+    int ret;
+
+    if (c == nullptr)
+        return 0;
+
+    evict(c);
+    ret = save_index(c);
+    free_records(c);
+    pthread_mutex_destroy(&c->lock);
+    free(c->dir);
+    free(c);
+    return ret;
+}
@@ -0,0 +1,376 @@
+#include "checksum.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+#define ADLER32_BASE 65521
+// Most bytes summed before s2 can overflow 32 bits
+#define ADLER32_NMAX 5552
+
+// Reflected CRC-32 polynomial
+#define CRC32_POLY 0xedb88320
+
+// XXH64 primes
+#define XXH64_PRIME1 0x9e3779b185ebca87ull
+#define XXH64_PRIME2 0xc2b2ae3d27d4eb4full
+#define XXH64_PRIME3 0x165667b19e3779f9ull
+#define XXH64_PRIME4 0x85ebca77c2b2ae63ull
+#define XXH64_PRIME5 0x27d4eb2f165667c5ull
+
+// x^(2^n) modulo the CRC polynomial
+static const uint32_t crc32_x2n_table[32] = {
+    0x40000000, 0x20000000, 0x08000000, 0x00800000, 0x00008000, 0xedb88320,
+    0xb1e6b092, 0xa06a2517, 0xed627dae, 0x88d14467, 0xd7bbfe6a, 0xec447f11,
+    0x8e7ea170, 0x6427800e, 0x4d47bae0, 0x09fe548f, 0x83852d0f, 0x30362f1a,
+    0x7b5a9cc3, 0x31fec169, 0x9fec022a, 0x6c8dedc4, 0x15d6874d, 0x5fde7a4e,
+    0xbad90e37, 0x2e4e5eef, 0x4eaba214, 0xa8a472c0, 0x429a969e, 0x148d302a,
+    0xc40ba6d0, 0xc4e22c3c,
+};
+
+// Slice-by-8 tables, crc32_table[k][n] is the CRC of byte n followed by k zero bytes
+static uint32_t crc32_table[8][256];
+static bool has_clmul;
+static bool has_ssse3;
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+static void checksum_init(void)
+{
+    size_t n, k;
+    uint32_t c;
+
+    for (n = 0; n < 256; n++)
+    {
+        c = (uint32_t)n;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        crc32_table[0][n] = c;
+    }
+
+    for (n = 0; n < 256; n++)
+        for (k = 1; k < 8; k++)
+            crc32_table[k][n] = (crc32_table[k - 1][n] >> 8) ^ crc32_table[0][crc32_table[k - 1][n] & 0xff];
+
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    has_clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    has_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static uint32_t adler32_scalar(uint32_t adler, const uint8_t *data, size_t size)
+{
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    size_t n;
+
+    while (size > 0)
+    {
+        n = size < ADLER32_NMAX ? size : ADLER32_NMAX;
+        size -= n;
+        for (; n > 0; n--)
+        {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    return (s2 << 16) | s1;
+}
+
+// Slice-by-8 over a pre-inverted CRC
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, size_t size)
+{
+    uint64_t w;
+
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        w = (uint64_t)data[0] | ((uint64_t)data[1] << 8) | ((uint64_t)data[2] << 16) | ((uint64_t)data[3] << 24) |
+            ((uint64_t)data[4] << 32) | ((uint64_t)data[5] << 40) | ((uint64_t)data[6] << 48) |
+            ((uint64_t)data[7] << 56);
+        w ^= crc;
+        crc = crc32_table[7][w & 0xff] ^ crc32_table[6][(w >> 8) & 0xff] ^ crc32_table[5][(w >> 16) & 0xff] ^
+              crc32_table[4][(w >> 24) & 0xff] ^ crc32_table[3][(w >> 32) & 0xff] ^
+              crc32_table[2][(w >> 40) & 0xff] ^ crc32_table[1][(w >> 48) & 0xff] ^ crc32_table[0][w >> 56];
+    }
+
+    for (; size > 0; size--)
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xff];
+
+    return crc;
+}
+
+#ifdef CHECKSUM_X86
+
+// Adler-32 over 32 byte blocks: s1 gathers byte sums, s2 each byte weighted
+// by its distance to the block end plus 32 times s1 before every block
+__attribute__((target("ssse3"))) static uint32_t adler32_ssse3(uint32_t adler, const uint8_t *data, size_t size)
+{
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    size_t blocks = size / 32;
+    size_t n;
+    __m128i v_ps, v_s1, v_s2, b1, b2;
+
+    size -= blocks * 32;
+    while (blocks > 0)
+    {
+        n = ADLER32_NMAX / 32 < blocks ? ADLER32_NMAX / 32 : blocks;
+        blocks -= n;
+
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = zero;
+
+        for (; n > 0; n--, data += 32)
+        {
+            b1 = _mm_loadu_si128((const __m128i *)data);
+            b2 = _mm_loadu_si128((const __m128i *)(data + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(b1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(b2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(b2, tap2), ones));
+        }
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        // Horizontal sums
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += (uint32_t)_mm_cvtsi128_si32(v_s1);
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = (uint32_t)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    return adler32_scalar((s2 << 16) | s1, data, size);
+}
+
+// CRC-32 by carry-less multiplication, folding four 128 bit lanes at a time
+// (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ").
+// Takes a pre-inverted CRC and a size of at least 64, a multiple of 16
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_clmul(uint32_t crc, const uint8_t *data, size_t size)
+{
+    // Bit reflected x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64
+    // and the Barrett pair P(x), floor(x^64 / P(x))
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4, 0x01c6e41596};
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0, 0x00ccaa009e};
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124, 0x0000000000};
+    static const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641, 0x01f7011641};
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)data), _mm_cvtsi32_si128((int)crc));
+    x2 = _mm_loadu_si128((const __m128i *)(data + 16));
+    x3 = _mm_loadu_si128((const __m128i *)(data + 32));
+    x4 = _mm_loadu_si128((const __m128i *)(data + 48));
+    data += 64;
+    size -= 64;
+
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    for (; size >= 64; size -= 64, data += 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)data));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 48)));
+    }
+
+    // Fold the four lanes into one, then any remaining 16 byte blocks
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x4), x5);
+
+    for (; size >= 16; size -= 16, data += 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x5);
+        x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data));
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, x3), x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size)
+{
+    pthread_once(&checksum_once, checksum_init);
+
+#ifdef CHECKSUM_X86
+    if (has_ssse3 && size >= 64)
+        return adler32_ssse3(adler, data, size);
+#endif
+
+    return adler32_scalar(adler, data, size);
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    pthread_once(&checksum_once, checksum_init);
+    crc = ~crc;
+
+#ifdef CHECKSUM_X86
+    if (has_clmul && size >= 64)
+    {
+        size_t n = size & ~(size_t)15;
+        crc = crc32_clmul(crc, data, n);
+        data += n;
+        size -= n;
+    }
+#endif
+
+    return ~crc32_slice8(crc, data, size);
+}
+
+// a * b modulo the CRC polynomial, bit reflected
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+// x^(n * 2^k) modulo the CRC polynomial
+static uint32_t x2nmodp(uint64_t n, size_t k)
+{
+    uint32_t p = (uint32_t)1 << 31; // x^0
+
+    for (; n > 0; n >>= 1, k++)
+        if (n & 1)
+            p = multmodp(crc32_x2n_table[k & 31], p);
+
+    return p;
+}
+
+uint32_t crc32_combine(const uint32_t crc1, const uint32_t crc2, const uint64_t size2)
+{
+    // Shift crc1 over size2 zero bytes, then add crc2
+    return multmodp(x2nmodp(size2, 3), crc1) ^ crc2;
+}
+
+static uint64_t rotl64(const uint64_t x, const int r)
+{
+    return x << r | x >> (64 - r);
+}
+
+static uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_le64(const uint8_t *p)
+{
+    return read_le32(p) | (uint64_t)read_le32(p + 4) << 32;
+}
+
+static uint64_t xxh64_round(uint64_t acc, const uint64_t input)
+{
+    acc += input * XXH64_PRIME2;
+    return rotl64(acc, 31) * XXH64_PRIME1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, const uint64_t v)
+{
+    acc ^= xxh64_round(0, v);
+    return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+uint64_t xxh64(const uint8_t *data, size_t size, const uint64_t seed)
+{
+    const uint8_t *end = data + size;
+    uint64_t h, v1, v2, v3, v4;
+
+    // Four lanes over 32 byte stripes
+    if (size >= 32)
+    {
+        v1 = seed + XXH64_PRIME1 + XXH64_PRIME2;
+        v2 = seed + XXH64_PRIME2;
+        v3 = seed;
+        v4 = seed - XXH64_PRIME1;
+        for (; end - data >= 32; data += 32)
+        {
+            v1 = xxh64_round(v1, read_le64(data));
+            v2 = xxh64_round(v2, read_le64(data + 8));
+            v3 = xxh64_round(v3, read_le64(data + 16));
+            v4 = xxh64_round(v4, read_le64(data + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+        h = seed + XXH64_PRIME5;
+
+    h += (uint64_t)size;
+    for (; end - data >= 8; data += 8)
+        h = rotl64(h ^ xxh64_round(0, read_le64(data)), 27) * XXH64_PRIME1 + XXH64_PRIME4;
+    if (end - data >= 4)
+    {
+        h = rotl64(h ^ read_le32(data) * XXH64_PRIME1, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+        data += 4;
+    }
+    for (; data < end; data++)
+        h = rotl64(h ^ *data * XXH64_PRIME5, 11) * XXH64_PRIME1;
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= XXH64_PRIME2;
+    h ^= h >> 29;
+    h *= XXH64_PRIME3;
+    return h ^ h >> 32;
+}
@@ -0,0 +1,917 @@
+#include "deflate.h"
+
+#include <malloc.h>
+#include <memory.h>
+#include <time.h>
+
+#include "huffman.h"
+#include "optimal.h"
+
+const uint16_t deflate_length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t deflate_length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t deflate_dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t deflate_dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which code length code lengths are transmitted
+static const uint8_t codelen_order[DEFLATE_NUM_CODELEN] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+static const uint8_t codelen_extra[DEFLATE_NUM_CODELEN] = {[16] = 2, [17] = 3, [18] = 7};
+
+// Block splitting: symbol classes observed, and how often the recent ones are
+// compared against the block so far
+#define SPLIT_LITERAL_TYPES 8
+#define SPLIT_TYPES (SPLIT_LITERAL_TYPES + 2)
+#define SPLIT_CHECK_INTERVAL 512
+#define SPLIT_MIN_BLOCK 4096 // input bytes
+// Split once the class distributions differ by 200/512 of their mass
+#define SPLIT_THRESHOLD 200
+#define SPLIT_SCALE 512
+
+typedef struct
+{
+    uint32_t block[SPLIT_TYPES];  // observations of the current block
+    uint32_t recent[SPLIT_TYPES]; // observations since the last check
+    size_t num_block;
+    size_t num_recent;
+} split_stats_t;
+
+// Incompressible data detection: sampled runs, the entropy in 1/2^16 bits per byte
+// above which data is stored, and the share of repeated strings that rules that out
+#define INCOMPRESSIBLE_MIN_SIZE 4096
+#define INCOMPRESSIBLE_RUNS 32
+#define INCOMPRESSIBLE_RUN_SIZE 64
+#define INCOMPRESSIBLE_HASH_BITS 12
+#define INCOMPRESSIBLE_ENTROPY ((uint32_t)(7.8 * 65536))
+#define INCOMPRESSIBLE_HIT_SCALE 64
+
+// Streams keep up to two windows of history after sliding, plus a block of input
+#define STREAM_BUFFER_SIZE (2 * LZ77_WINDOW_SIZE + DEFLATE_BLOCK_SIZE)
+// Adaptive streams step up only when faster than the target by 1/8, so they settle
+#define ADAPT_HEADROOM 8
+
+// {max_chain, nice_length, lazy_length, skip_log}, strategy, iterations
+static const deflate_level_t levels[DEFLATE_LEVEL_MAX + 1] = {
+    [1] = {{4, 8, 0, 4}, DEFLATE_GREEDY, 0},
+    [2] = {{8, 16, 0, 5}, DEFLATE_GREEDY, 0},
+    [3] = {{32, 32, 0, 6}, DEFLATE_GREEDY, 0},
+    [4] = {{16, 16, 4, 0}, DEFLATE_LAZY, 0},
+    [5] = {{32, 32, 16, 0}, DEFLATE_LAZY, 0},
+    [6] = {{128, 128, 16, 0}, DEFLATE_LAZY, 0},
+    [7] = {{256, 128, 32, 0}, DEFLATE_LAZY, 0},
+    [8] = {{1024, 258, 128, 0}, DEFLATE_LAZY, 0},
+    [9] = {{4096, 258, 258, 0}, DEFLATE_LAZY, 0},
+    [10] = {{1024, 258, 0, 0}, DEFLATE_OPTIMAL, 3},
+    [11] = {{4096, 258, 0, 0}, DEFLATE_OPTIMAL, 8},
+    [12] = {{8192, 258, 0, 0}, DEFLATE_OPTIMAL, 15},
+};
+
+const deflate_level_t *deflate_level(const int level)
+{
+    if (level < DEFLATE_LEVEL_MIN)
+        return &levels[DEFLATE_LEVEL_MIN];
+    if (level > DEFLATE_LEVEL_MAX)
+        return &levels[DEFLATE_LEVEL_MAX];
+    return &levels[level];
+}
+
+void deflate_count(const lz77_seqs_t *seqs, deflate_freq_t *freq)
+{
+    size_t i;
+
+    // One pass per stream
+    for (i = 0; i < seqs->num_literals; i++)
+        freq->litlen[seqs->literals[i]]++;
+    for (i = 0; i < seqs->size; i++)
+        freq->litlen[DEFLATE_END_OF_BLOCK + 1 + deflate_length_code(seqs->lengths[i])]++;
+    for (i = 0; i < seqs->size; i++)
+        freq->dist[deflate_dist_code(seqs->dists[i])]++;
+
+    freq->litlen[DEFLATE_END_OF_BLOCK]++;
+}
+
+int deflate_code_lengths(const size_t *freq, const size_t num_symbols, uint8_t *lens, const size_t max_bits)
+{
+    size_t i, used = 0;
+    size_t f[DEFLATE_NUM_LITLEN];
+    huffman_node_t *root;
+    int ret;
+
+    memcpy(f, freq, num_symbols * sizeof(size_t));
+    for (i = 0; i < num_symbols; i++)
+        used += f[i] != 0;
+
+    // Some decoders reject a code with a single symbol, so always build two
+    for (i = 0; used < 2 && i < num_symbols; i++)
+        if (f[i] == 0)
+        {
+            f[i] = 1;
+            used++;
+        }
+
+    // With two symbols in use, no tree means the allocation failed
+    root = huffman_generate_freq(f, num_symbols);
+    if (root == nullptr)
+        return -1;
+    ret = huffman_code_lengths(root, lens, num_symbols, max_bits);
+    huffman_free(root);
+    return ret;
+}
+
+static uint16_t reverse_bits(uint16_t code, const size_t len)
+{
+    size_t i;
+    uint16_t r = 0;
+
+    for (i = 0; i < len; i++, code >>= 1)
+        r = (r << 1) | (code & 1);
+
+    return r;
+}
+
+static void canonical_reversed(const uint8_t *lens, uint16_t *codes, const size_t num_symbols)
+{
+    size_t i;
+
+    huffman_canonical_codes(lens, codes, num_symbols);
+    for (i = 0; i < num_symbols; i++)
+        codes[i] = reverse_bits(codes[i], lens[i]);
+}
+
+static void rle_push(deflate_code_t *code, const uint8_t sym, const uint8_t extra)
+{
+    code->rle[code->rle_size] = sym;
+    code->rle_extra[code->rle_size] = extra;
+    code->rle_size++;
+}
+
+// Run length code the concatenated code lengths with symbols 16-18
+static void rle_code_lengths(deflate_code_t *code, const uint8_t *lens, const size_t size)
+{
+    size_t i = 0, run, r;
+
+    code->rle_size = 0;
+    while (i < size)
+    {
+        for (run = 1; i + run < size && lens[i + run] == lens[i]; run++)
+            ;
+
+        r = run;
+        if (lens[i] == 0)
+        {
+            while (r >= 11)
+            {
+                size_t n = r < 138 ? r : 138;
+                rle_push(code, 18, (uint8_t)(n - 11));
+                r -= n;
+            }
+            if (r >= 3)
+            {
+                rle_push(code, 17, (uint8_t)(r - 3));
+                r = 0;
+            }
+        }
+        else
+        {
+            rle_push(code, lens[i], 0);
+            r--;
+            while (r >= 3)
+            {
+                size_t n = r < 6 ? r : 6;
+                rle_push(code, 16, (uint8_t)(n - 3));
+                r -= n;
+            }
+        }
+
+        for (; r > 0; r--)
+            rle_push(code, lens[i], 0);
+
+        i += run;
+    }
+}
+
+int deflate_build_dynamic(const deflate_freq_t *freq, deflate_code_t *code)
+{
+    size_t i;
+    size_t codelen_freq[DEFLATE_NUM_CODELEN] = {0};
+    uint8_t lens[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST];
+
+    if (deflate_code_lengths(freq->litlen, DEFLATE_NUM_LITLEN, code->litlen_lens, DEFLATE_MAX_BITS) ||
+        deflate_code_lengths(freq->dist, DEFLATE_NUM_DIST, code->dist_lens, DEFLATE_MAX_BITS))
+        return -1;
+    canonical_reversed(code->litlen_lens, code->litlen_codes, DEFLATE_NUM_LITLEN);
+    canonical_reversed(code->dist_lens, code->dist_codes, DEFLATE_NUM_DIST);
+
+    // Trailing unused symbols need not be transmitted
+    for (code->hlit = DEFLATE_NUM_LITLEN; code->hlit > 257 && code->litlen_lens[code->hlit - 1] == 0; code->hlit--)
+        ;
+    for (code->hdist = DEFLATE_NUM_DIST; code->hdist > 1 && code->dist_lens[code->hdist - 1] == 0; code->hdist--)
+        ;
+
+    memcpy(lens, code->litlen_lens, code->hlit);
+    memcpy(lens + code->hlit, code->dist_lens, code->hdist);
+    rle_code_lengths(code, lens, code->hlit + code->hdist);
+
+    for (i = 0; i < code->rle_size; i++)
+        codelen_freq[code->rle[i]]++;
+    if (deflate_code_lengths(codelen_freq, DEFLATE_NUM_CODELEN, code->codelen_lens, DEFLATE_MAX_CODELEN_BITS))
+        return -1;
+    canonical_reversed(code->codelen_lens, code->codelen_codes, DEFLATE_NUM_CODELEN);
+
+    for (code->hclen = DEFLATE_NUM_CODELEN; code->hclen > 4 && code->codelen_lens[codelen_order[code->hclen - 1]] == 0;
+         code->hclen--)
+        ;
+    return 0;
+}
+
+// Size of the block's symbols, without header
+static size_t symbol_bits(const deflate_freq_t *freq, const deflate_code_t *code)
+{
+    size_t i;
+    size_t bits = 0;
+
+    for (i = 0; i < DEFLATE_NUM_LITLEN; i++)
+        bits += freq->litlen[i] * code->litlen_lens[i];
+    for (i = 0; i < 29; i++)
+        bits += freq->litlen[DEFLATE_END_OF_BLOCK + 1 + i] * deflate_length_extra[i];
+    for (i = 0; i < DEFLATE_NUM_DIST; i++)
+        bits += freq->dist[i] * (code->dist_lens[i] + deflate_dist_extra[i]);
+
+    return bits;
+}
+
+size_t deflate_dynamic_bits(const deflate_freq_t *freq, const deflate_code_t *code)
+{
+    size_t i;
+    size_t bits = 3 + 5 + 5 + 4 + 3 * code->hclen;
+
+    for (i = 0; i < code->rle_size; i++)
+        bits += code->codelen_lens[code->rle[i]] + codelen_extra[code->rle[i]];
+
+    return bits + symbol_bits(freq, code);
+}
+
+static void write_literals(bitstream_t *bs, const deflate_code_t *code, const uint8_t *literals, const size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        bitstream_write_lsb(bs, code->litlen_codes[literals[i]], code->litlen_lens[literals[i]]);
+}
+
+static void write_seqs(bitstream_t *bs, const deflate_code_t *code, const lz77_seqs_t *seqs)
+{
+    const uint8_t *literals = seqs->literals;
+    size_t i, lc, dc, len, dist;
+
+    for (i = 0; i < seqs->size; i++)
+    {
+        write_literals(bs, code, literals, seqs->lit_runs[i]);
+        literals += seqs->lit_runs[i];
+
+        len = seqs->lengths[i];
+        dist = seqs->dists[i];
+        lc = deflate_length_code(len);
+        dc = deflate_dist_code(dist);
+
+        bitstream_write_lsb(bs, code->litlen_codes[DEFLATE_END_OF_BLOCK + 1 + lc],
+                            code->litlen_lens[DEFLATE_END_OF_BLOCK + 1 + lc]);
+        bitstream_write_lsb(bs, len - deflate_length_base[lc], deflate_length_extra[lc]);
+        bitstream_write_lsb(bs, code->dist_codes[dc], code->dist_lens[dc]);
+        bitstream_write_lsb(bs, dist - deflate_dist_base[dc], deflate_dist_extra[dc]);
+    }
+
+    write_literals(bs, code, literals, (size_t)(seqs->literals + seqs->num_literals - literals));
+    bitstream_write_lsb(bs, code->litlen_codes[DEFLATE_END_OF_BLOCK], code->litlen_lens[DEFLATE_END_OF_BLOCK]);
+}
+
+void deflate_fixed_lengths(uint8_t *litlen_lens, uint8_t *dist_lens)
+{
+    size_t i;
+
+    for (i = 0; i < DEFLATE_NUM_LITLEN; i++)
+        litlen_lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    memset(dist_lens, 5, DEFLATE_NUM_DIST);
+}
+
+int deflate_write_stored(bitstream_t *bs, const uint8_t *data, const size_t size, const bool final)
+{
+    size_t n, pos = 0;
+    uint8_t len[4];
+
+    // An empty stream still needs its final block
+    do
+    {
+        n = size - pos < DEFLATE_STORED_MAX ? size - pos : DEFLATE_STORED_MAX;
+        len[0] = (uint8_t)n;
+        len[1] = (uint8_t)(n >> 8);
+        len[2] = (uint8_t)~n;
+        len[3] = (uint8_t)(~n >> 8);
+
+        if (bitstream_write_lsb(bs, final && pos + n == size, 1) || bitstream_write_lsb(bs, 0, 2))
+            return -1;
+        bitstream_align(bs);
+        if (bitstream_write_bytes(bs, len, sizeof(len)) || bitstream_write_bytes(bs, data + pos, n))
+            return -1;
+        pos += n;
+    } while (pos < size);
+
+    return 0;
+}
+
+// Size of data as stored blocks, assuming each header needs padding to a byte
+static size_t stored_bits(const size_t size)
+{
+    size_t blocks = size ? (size + DEFLATE_STORED_MAX - 1) / DEFLATE_STORED_MAX : 1;
+    return (size + blocks * 5) * UINT8_BIT_COUNT;
+}
+
+int deflate_write_block(bitstream_t *bs, const lz77_seqs_t *seqs, const uint8_t *raw, const size_t raw_size,
+                        const bool final)
+{
+    size_t i, dynamic, fixed;
+    deflate_freq_t freq = {0};
+    deflate_code_t code, fixed_code;
+    uint8_t fixed_lens[DEFLATE_NUM_LITLEN + 2];
+    uint16_t fixed_codes[DEFLATE_NUM_LITLEN + 2];
+
+    deflate_count(seqs, &freq);
+    if (deflate_build_dynamic(&freq, &code))
+        return -1;
+    // Symbols 286 and 287 never occur but still take part in the fixed code's construction
+    deflate_fixed_lengths(fixed_lens, fixed_code.dist_lens);
+    fixed_lens[DEFLATE_NUM_LITLEN] = fixed_lens[DEFLATE_NUM_LITLEN + 1] = 8;
+    canonical_reversed(fixed_lens, fixed_codes, DEFLATE_NUM_LITLEN + 2);
+    memcpy(fixed_code.litlen_lens, fixed_lens, DEFLATE_NUM_LITLEN);
+    memcpy(fixed_code.litlen_codes, fixed_codes, DEFLATE_NUM_LITLEN * sizeof(uint16_t));
+    canonical_reversed(fixed_code.dist_lens, fixed_code.dist_codes, DEFLATE_NUM_DIST);
+
+    dynamic = deflate_dynamic_bits(&freq, &code);
+    fixed = 3 + symbol_bits(&freq, &fixed_code);
+
+    // Data the parse does not shrink is sent as is
+    if (raw != nullptr && stored_bits(raw_size) < fixed && stored_bits(raw_size) < dynamic)
+        return deflate_write_stored(bs, raw, raw_size, final);
+
+    // Reserve the whole block up front so the writes below cannot fail
+    if (bitstream_reserve(bs, (dynamic < fixed ? dynamic : fixed) / UINT8_BIT_COUNT + 1))
+        return -1;
+
+    // Small blocks rarely earn back the cost of transmitting their own code
+    if (fixed <= dynamic)
+    {
+        bitstream_write_lsb(bs, final, 1);
+        bitstream_write_lsb(bs, 1, 2);
+        write_seqs(bs, &fixed_code, seqs);
+        return 0;
+    }
+
+    bitstream_write_lsb(bs, final, 1);
+    bitstream_write_lsb(bs, 2, 2);
+    bitstream_write_lsb(bs, code.hlit - 257, 5);
+    bitstream_write_lsb(bs, code.hdist - 1, 5);
+    bitstream_write_lsb(bs, code.hclen - 4, 4);
+    for (i = 0; i < code.hclen; i++)
+        bitstream_write_lsb(bs, code.codelen_lens[codelen_order[i]], 3);
+
+    for (i = 0; i < code.rle_size; i++)
+    {
+        bitstream_write_lsb(bs, code.codelen_codes[code.rle[i]], code.codelen_lens[code.rle[i]]);
+        bitstream_write_lsb(bs, code.rle_extra[i], codelen_extra[code.rle[i]]);
+    }
+
+    write_seqs(bs, &code, seqs);
+    return 0;
+}
+
+// Literals fall in classes by two high bits and the low bit, matches by
+// short or long, which is enough to tell text, binary and repetitive data apart
+static size_t split_literal_type(const uint8_t c)
+{
+    return ((c >> 5) & 6) | (c & 1);
+}
+
+static size_t split_match_type(const size_t length)
+{
+    return SPLIT_LITERAL_TYPES + (length >= 9);
+}
+
+// Whether the recent observations differ enough from the block so far to be
+// worth a code of their own. Either way they move into the block, replacing
+// it on a split
+static bool split_check(split_stats_t *s, const size_t block_bytes)
+{
+    size_t i;
+    uint64_t expected, actual, delta = 0;
+    bool split = false;
+
+    if (s->num_block > 0 && block_bytes >= SPLIT_MIN_BLOCK)
+    {
+        // Sum of differences between the two class distributions, scaled by both counts
+        for (i = 0; i < SPLIT_TYPES; i++)
+        {
+            expected = (uint64_t)s->block[i] * s->num_recent;
+            actual = (uint64_t)s->recent[i] * s->num_block;
+            delta += actual > expected ? actual - expected : expected - actual;
+        }
+
+        split = delta * SPLIT_SCALE >= SPLIT_THRESHOLD * (uint64_t)s->num_recent * s->num_block;
+    }
+
+    for (i = 0; i < SPLIT_TYPES; i++)
+    {
+        s->block[i] = split ? s->recent[i] : s->block[i] + s->recent[i];
+        s->recent[i] = 0;
+    }
+    s->num_block = split ? s->num_recent : s->num_block + s->num_recent;
+    s->num_recent = 0;
+    return split;
+}
+
+// The matches [first, first + count) and the literals [lit_first, lit_first + num_literals)
+// that go with them, as a buffer of their own
+static lz77_seqs_t seqs_slice(const lz77_seqs_t *seqs, const size_t first, const size_t count,
+                              const size_t lit_first, const size_t num_literals)
+{
+    return (lz77_seqs_t){
+        .literals = seqs->literals + lit_first,
+        .lit_runs = seqs->lit_runs + first,
+        .lengths = seqs->lengths + first,
+        .dists = seqs->dists + first,
+        .num_literals = num_literals,
+        .size = count,
+    };
+}
+
+// Write a parse as one or more blocks, ending a block where the symbol
+// statistics change so each part gets a Huffman code fitted to it.
+// Blocks end after a match, so only the last has trailing literals
+static int write_blocks(bitstream_t *bs, const lz77_seqs_t *seqs, const uint8_t *raw, const size_t raw_size,
+                        const bool final)
+{
+    split_stats_t s = {0};
+    size_t i, k, lit = 0, block_start = 0, recent_start = 0, block_lit = 0, recent_lit = 0;
+    size_t block_bytes = 0, recent_bytes = 0, raw_pos = 0;
+    lz77_seqs_t block;
+
+    for (i = 0; i < seqs->size; i++)
+    {
+        for (k = 0; k < seqs->lit_runs[i]; k++)
+            s.recent[split_literal_type(seqs->literals[lit + k])]++;
+        s.recent[split_match_type(seqs->lengths[i])]++;
+        lit += seqs->lit_runs[i];
+        recent_bytes += seqs->lit_runs[i] + seqs->lengths[i];
+        s.num_recent += seqs->lit_runs[i] + 1;
+        if (s.num_recent < SPLIT_CHECK_INTERVAL)
+            continue;
+
+        // The change happened somewhere in the recent window, end the block before it
+        if (split_check(&s, block_bytes))
+        {
+            block = seqs_slice(seqs, block_start, recent_start - block_start, block_lit, recent_lit - block_lit);
+            if (deflate_write_block(bs, &block, raw + raw_pos, block_bytes, false))
+                return -1;
+            block_start = recent_start;
+            block_lit = recent_lit;
+            raw_pos += block_bytes;
+            block_bytes = 0;
+        }
+
+        block_bytes += recent_bytes;
+        recent_bytes = 0;
+        recent_start = i + 1;
+        recent_lit = lit;
+    }
+
+    block = seqs_slice(seqs, block_start, seqs->size - block_start, block_lit, seqs->num_literals - block_lit);
+    return deflate_write_block(bs, &block, raw + raw_pos, raw_size - raw_pos, final);
+}
+
+// log2(x) in 1/2^16 bits, x > 0, by repeated squaring of the mantissa
+static uint32_t log2_fixed(uint32_t x)
+{
+    uint32_t n = 31 - (uint32_t)__builtin_clz(x);
+    uint32_t result = n << 16;
+    uint64_t y = n > 16 ? x >> (n - 16) : (uint64_t)x << (16 - n); // mantissa in [1, 2), 16 fraction bits
+    uint32_t bit;
+
+    for (bit = 1u << 15; bit > 0; bit >>= 1)
+    {
+        y = (y * y) >> 16;
+        if (y >= (2u << 16))
+        {
+            y >>= 1;
+            result |= bit;
+        }
+    }
+
+    return result;
+}
+
+bool deflate_incompressible(const uint8_t *data, const size_t size)
+{
+    uint32_t count[UINT8_MAX + 1] = {0};
+    uint32_t words[1 << INCOMPRESSIBLE_HASH_BITS] = {0};
+    size_t r, i, run, step, n = 0, hits = 0, probes = 0;
+    uint64_t sum = 0;
+    uint32_t w, *slot;
+
+    if (size < INCOMPRESSIBLE_MIN_SIZE)
+        return false;
+
+    // Evenly spread runs, every 4 byte string of which is looked up among the earlier ones
+    step = size / INCOMPRESSIBLE_RUNS;
+    for (r = 0; r < INCOMPRESSIBLE_RUNS; r++)
+    {
+        run = r * step;
+        for (i = 0; i < INCOMPRESSIBLE_RUN_SIZE; i++)
+            count[data[run + i]]++;
+        n += INCOMPRESSIBLE_RUN_SIZE;
+
+        for (i = 0; i + sizeof(uint32_t) <= INCOMPRESSIBLE_RUN_SIZE; i++)
+        {
+            memcpy(&w, data + run + i, sizeof(uint32_t));
+            w |= 1; // 0 marks an empty slot
+            slot = &words[(w * 0x9E3779B1u) >> (32 - INCOMPRESSIBLE_HASH_BITS)];
+            hits += *slot == w;
+            *slot = w;
+            probes++;
+        }
+    }
+
+    // Repeats make data compressible whatever its byte distribution
+    if (hits * INCOMPRESSIBLE_HIT_SCALE > probes)
+        return false;
+
+    // Entropy in bits per byte is log2(n) - sum(c * log2(c)) / n
+    for (i = 0; i <= UINT8_MAX; i++)
+        if (count[i] > 1)
+            sum += (uint64_t)count[i] * log2_fixed(count[i]);
+
+    return ((uint64_t)log2_fixed((uint32_t)n) * n - sum) >= (uint64_t)INCOMPRESSIBLE_ENTROPY * n;
+}
+
+// Compress data[start, size), matches may reach back into data[0, start)
+static int compress_range(bitstream_t *bs, lz77_matcher_t *m, const deflate_level_t *cfg,
+                          const uint8_t *data, const size_t from, const size_t size, const bool final)
+{
+    lz77_seqs_t seqs = {0};
+    size_t start = from, end, offset = 0, delta;
+    int ret = 0;
+
+    // Only a final block is needed when there is nothing to compress
+    if (start == size && !final)
+        return 0;
+
+    do
+    {
+        end = size - start < DEFLATE_BLOCK_SIZE ? size : start + DEFLATE_BLOCK_SIZE;
+
+        // Matcher positions are 32 bit, slide its base along on huge inputs
+        if (end - offset > (size_t)INT32_MAX)
+        {
+            delta = (start - offset - LZ77_WINDOW_SIZE) & ~(size_t)(LZ77_WINDOW_SIZE - 1);
+            lz77_slide(m, delta);
+            offset += delta;
+        }
+
+        // Already compressed data skips the parse and is copied out as is
+        if (deflate_incompressible(data + start, end - start))
+        {
+            lz77_skip(m, end - offset);
+            ret = deflate_write_stored(bs, data + start, end - start, final && end == size);
+            start = end;
+            continue;
+        }
+
+        lz77_seqs_clear(&seqs);
+        if (cfg->strategy == DEFLATE_OPTIMAL)
+            ret = optimal_parse(m, data + offset, start - offset, end - offset, cfg, &seqs);
+        else
+            ret = lz77_parse(m, data + offset, start - offset, end - offset, &cfg->lz77, &seqs);
+
+        if (ret == 0)
+            ret = write_blocks(bs, &seqs, data + start, end - start, final && end == size);
+
+        start = end;
+    } while (ret == 0 && start < size);
+
+    lz77_seqs_free(&seqs);
+    return ret;
+}
+
+int deflate_compress(bitstream_t *bs, const uint8_t *data, const size_t size, const int level)
+{
+    int ret;
+    lz77_matcher_t *m = lz77_matcher_new(LZ77_HASH_BITS);
+    if (m == nullptr)
+        return -1;
+
+    ret = compress_range(bs, m, deflate_level(level), data, 0, size, true);
+    lz77_matcher_free(m);
+    return ret;
+}
+
+int deflate_compress_window(bitstream_t *bs, lz77_matcher_t *m, const uint8_t *window, const size_t start,
+                            const size_t size, const int level, const bool final)
+{
+    lz77_matcher_reset(m);
+    return compress_range(bs, m, deflate_level(level), window, start, size, final);
+}
+
+int deflate_sync_flush(bitstream_t *bs)
+{
+    static const uint8_t empty_stored[] = {0x00, 0x00, 0xff, 0xff};
+
+    // Non-final stored block header, padding, then LEN 0 and NLEN
+    if (bitstream_write_lsb(bs, 0, 3))
+        return -1;
+    bitstream_align(bs);
+    return bitstream_write_bytes(bs, empty_stored, sizeof(empty_stored));
+}
+
+int deflate_compress_dict(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level)
+{
+    int ret = -1;
+    lz77_matcher_t *m;
+    uint8_t *window;
+
+    if (dict == nullptr)
+        return deflate_compress(bs, data, size, level);
+
+    // Matches address the dictionary and the message as one buffer
+    window = malloc(dict->size + size + 1);
+    m = lz77_matcher_clone(dict->matcher);
+    if (window != nullptr && m != nullptr)
+    {
+        memcpy(window, dict->data, dict->size);
+        memcpy(window + dict->size, data, size);
+        ret = compress_range(bs, m, deflate_level(level), window, dict->size, dict->size + size, true);
+    }
+
+    lz77_matcher_free(m);
+    free(window);
+    return ret;
+}
+
+deflate_stream_t *deflate_stream_new(const int level)
+{
+    deflate_stream_t *s = calloc(1, sizeof(deflate_stream_t));
+    if (s == nullptr)
+        return nullptr;
+
+    s->level = level < DEFLATE_LEVEL_MIN ? DEFLATE_LEVEL_MIN : level > DEFLATE_LEVEL_MAX ? DEFLATE_LEVEL_MAX : level;
+    s->cfg = deflate_level(s->level);
+    s->m = lz77_matcher_new(LZ77_HASH_BITS);
+    s->buf = malloc(STREAM_BUFFER_SIZE);
+    s->out = bitstream_new(DEFLATE_BLOCK_SIZE / 2);
+    if (s->m == nullptr || s->buf == nullptr || s->out == nullptr)
+    {
+        deflate_stream_free(s);
+        return nullptr;
+    }
+
+    return s;
+}
+
+// Hand out the complete bytes of the compressed output. Returns whether any remain
+static bool stream_drain(deflate_stream_t *s, uint8_t *out, const size_t out_cap, size_t *out_used)
+{
+    size_t n = bitstream_byte_offset(s->out);
+
+    if (n > out_cap - *out_used)
+        n = out_cap - *out_used;
+
+    memcpy(out + *out_used, s->out->stream, n);
+    *out_used += n;
+    bitstream_discard(s->out, n);
+    return bitstream_byte_offset(s->out) > 0;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Whether the unflushed input has run out of latency budget
+static bool stream_due(const deflate_stream_t *s)
+{
+    if (s->unflushed == 0)
+        return false;
+
+    return (s->latency_bytes && s->unflushed >= s->latency_bytes) ||
+           (s->latency_us && now_us() - s->unflushed_since >= s->latency_us);
+}
+
+// Take one level step once a block's worth of input has been timed. Every level
+// shares the matcher and block format, so the stream stays valid across changes
+static void stream_adapt(deflate_stream_t *s, const size_t size, const uint64_t us)
+{
+    int level = s->level;
+
+    s->adapt_bytes += size;
+    s->adapt_us += us;
+    if (s->adapt_bytes < DEFLATE_BLOCK_SIZE)
+        return;
+
+    if (s->adapt_rate == 0)
+        level += s->backlogged ? 1 : -1;
+    else if (s->adapt_bytes * 1000000 < s->adapt_rate * s->adapt_us)
+        level--;
+    else if (s->adapt_bytes * 1000000 > (s->adapt_rate + s->adapt_rate / ADAPT_HEADROOM) * s->adapt_us)
+        level++;
+
+    if (level < s->adapt_min)
+        level = s->adapt_min;
+    if (level > s->adapt_max)
+        level = s->adapt_max;
+
+    s->level = level;
+    s->cfg = deflate_level(level);
+    s->adapt_bytes = 0;
+    s->adapt_us = 0;
+    s->backlogged = false;
+}
+
+static int stream_compress(deflate_stream_t *s, const bool final)
+{
+    size_t delta, size = s->end - s->start;
+    uint64_t t = s->adapt ? now_us() : 0;
+
+    if (compress_range(s->out, s->m, s->cfg, s->buf, s->start, s->end, final))
+        return -1;
+    s->start = s->end;
+
+    if (s->adapt)
+        stream_adapt(s, size, now_us() - t);
+
+    // Keep a window of history, sliding by window multiples as the matcher needs
+    if (s->start > LZ77_WINDOW_SIZE)
+    {
+        delta = (s->start - LZ77_WINDOW_SIZE) & ~(size_t)(LZ77_WINDOW_SIZE - 1);
+        memmove(s->buf, s->buf + delta, s->end - delta);
+        lz77_slide(s->m, delta);
+        s->start -= delta;
+        s->end -= delta;
+    }
+
+    return 0;
+}
+
+int deflate_stream_update(deflate_stream_t *s, const uint8_t *in, const size_t in_size, size_t *in_used,
+                          uint8_t *out, const size_t out_cap, size_t *out_used)
+{
+    size_t n;
+
+    *in_used = 0;
+    *out_used = 0;
+    if (s->state == DEFLATE_STREAM_FINISHING || s->state == DEFLATE_STREAM_DONE)
+        return -1;
+
+    // A block is only compressed once the previous one has been handed out
+    while (!stream_drain(s, out, out_cap, out_used))
+    {
+        s->state = DEFLATE_STREAM_RUNNING;
+
+        if (stream_due(s))
+        {
+            if (stream_compress(s, false) || deflate_sync_flush(s->out))
+                return -1;
+            s->unflushed = 0;
+            continue;
+        }
+
+        if (*in_used == in_size)
+            break;
+
+        // The byte budget ends exactly at a flush
+        n = DEFLATE_BLOCK_SIZE - (s->end - s->start);
+        if (n > in_size - *in_used)
+            n = in_size - *in_used;
+        if (s->latency_bytes && n > s->latency_bytes - s->unflushed)
+            n = s->latency_bytes - s->unflushed;
+
+        if (s->unflushed == 0)
+            s->unflushed_since = now_us();
+        memcpy(s->buf + s->end, in + *in_used, n);
+        s->end += n;
+        s->unflushed += n;
+        *in_used += n;
+
+        if (s->end - s->start == DEFLATE_BLOCK_SIZE && stream_compress(s, false))
+            return -1;
+    }
+
+    if (bitstream_byte_offset(s->out) > 0)
+        s->backlogged = true;
+
+    return 0;
+}
+
+void deflate_stream_reset(deflate_stream_t *s)
+{
+    lz77_matcher_reset(s->m);
+    bitstream_clear(s->out);
+    s->start = s->end = 0;
+    s->state = DEFLATE_STREAM_RUNNING;
+    s->unflushed = 0;
+}
+
+void deflate_stream_set_level(deflate_stream_t *s, const int level)
+{
+    s->level = level < DEFLATE_LEVEL_MIN ? DEFLATE_LEVEL_MIN : level > DEFLATE_LEVEL_MAX ? DEFLATE_LEVEL_MAX : level;
+    s->cfg = deflate_level(s->level);
+}
+
+void deflate_stream_set_adapt(deflate_stream_t *s, const uint64_t rate, const int min_level, const int max_level)
+{
+    s->adapt = true;
+    s->adapt_rate = rate;
+    s->adapt_min = min_level < DEFLATE_LEVEL_MIN ? DEFLATE_LEVEL_MIN : min_level;
+    s->adapt_max = max_level > DEFLATE_LEVEL_MAX ? DEFLATE_LEVEL_MAX : max_level;
+    if (s->adapt_max < s->adapt_min)
+        s->adapt_max = s->adapt_min;
+    if (s->level < s->adapt_min)
+        s->level = s->adapt_min;
+    if (s->level > s->adapt_max)
+        s->level = s->adapt_max;
+    s->cfg = deflate_level(s->level);
+}
+
+void deflate_stream_set_latency(deflate_stream_t *s, const size_t max_bytes, const uint64_t max_us)
+{
+    s->latency_bytes = max_bytes;
+    s->latency_us = max_us;
+}
+
+int deflate_stream_flush(deflate_stream_t *s, const deflate_flush_t flush, uint8_t *out, const size_t out_cap,
+                         size_t *out_used)
+{
+    *out_used = 0;
+    if (s->state == DEFLATE_STREAM_FINISHING || s->state == DEFLATE_STREAM_DONE)
+        return -1;
+
+    if (s->state == DEFLATE_STREAM_RUNNING)
+    {
+        // Pending output goes first so the block below cannot outgrow the buffer
+        if (stream_drain(s, out, out_cap, out_used))
+            return 1;
+        if (stream_compress(s, false) || deflate_sync_flush(s->out))
+            return -1;
+        s->unflushed = 0;
+        s->state = DEFLATE_STREAM_FLUSHING;
+
+        // Later matches must not reach back past the flush
+        if (flush == DEFLATE_FULL_FLUSH)
+        {
+            lz77_matcher_reset(s->m);
+            s->start = s->end = 0;
+        }
+    }
+
+    if (stream_drain(s, out, out_cap, out_used))
+        return 1;
+
+    s->state = DEFLATE_STREAM_RUNNING;
+    return 0;
+}
+
+int deflate_stream_finish(deflate_stream_t *s, uint8_t *out, const size_t out_cap, size_t *out_used)
+{
+    *out_used = 0;
+    if (s->state == DEFLATE_STREAM_DONE)
+        return 0;
+
+    if (s->state != DEFLATE_STREAM_FINISHING)
+    {
+        if (stream_drain(s, out, out_cap, out_used))
+            return 1;
+        if (stream_compress(s, true))
+            return -1;
+        bitstream_align(s->out);
+        s->state = DEFLATE_STREAM_FINISHING;
+    }
+
+    if (stream_drain(s, out, out_cap, out_used))
+        return 1;
+
+    s->state = DEFLATE_STREAM_DONE;
+    return 0;
+}
+
+void deflate_stream_free(deflate_stream_t *s)
+{
+    if (s == nullptr)
+        return;
+
+    lz77_matcher_free(s->m);
+    free(s->buf);
+    if (s->out != nullptr)
+        bitstream_free(s->out);
+    free(s);
+}
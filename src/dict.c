@@ -0,0 +1,51 @@
+#include "dict.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+#include "checksum.h"
+
+// Smallest hash table covering the dictionary, so clones stay cheap for small ones
+static size_t dict_hash_bits(const size_t size)
+{
+    size_t bits = 10;
+
+    while (bits < LZ77_HASH_BITS && ((size_t)1 << bits) < 2 * size)
+        bits++;
+
+    return bits;
+}
+
+dict_t *dict_new(const uint8_t *data, const size_t size)
+{
+    size_t keep = size < LZ77_WINDOW_SIZE ? size : LZ77_WINDOW_SIZE;
+    dict_t *dict = calloc(1, sizeof(dict_t));
+    if (dict == nullptr)
+        return nullptr;
+
+    dict->size = keep;
+    dict->id = adler32(ADLER32_INIT, data, size);
+    dict->data = malloc(keep ? keep : 1);
+    dict->matcher = lz77_matcher_new(dict_hash_bits(keep));
+    if (dict->data == nullptr || dict->matcher == nullptr)
+    {
+        dict_free(dict);
+        return nullptr;
+    }
+
+    // Only the tail is reachable from a 32 KiB window. The last two positions
+    // hash bytes of the message and are inserted once it follows
+    memcpy(dict->data, data + size - keep, keep);
+    lz77_insert_until(dict->matcher, dict->data, keep > LZ77_MIN_MATCH - 1 ? keep - (LZ77_MIN_MATCH - 1) : 0, keep);
+    return dict;
+}
+
+void dict_free(dict_t *dict)
+{
+    if (dict == nullptr)
+        return;
+
+    lz77_matcher_free(dict->matcher);
+    free(dict->data);
+    free(dict);
+}
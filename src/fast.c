@@ -0,0 +1,263 @@
+#include "fast.h"
+
+#include <memory.h>
+
+// Every 2^FAST_SKIP_LOG bytes without a match widen the search stride by one
+#define FAST_SKIP_LOG 6
+#define FAST_HASH_MULT 2654435761u
+#define FAST_NIBBLE_MAX 15
+// Slack the decoder's shortcut needs: 16 literal bytes read, 16 literals and a 24 byte match written
+#define FAST_SHORTCUT_IN (16 + 2)
+#define FAST_SHORTCUT_OUT (16 + 24)
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return v;
+}
+
+static size_t hash4(const uint8_t *p)
+{
+    return (read32(p) * FAST_HASH_MULT) >> (32 - FAST_HASH_BITS);
+}
+
+static size_t match_length(const uint8_t *a, const uint8_t *b, const size_t max)
+{
+    size_t len = 0;
+    uint64_t x, y;
+
+    while (len + sizeof(uint64_t) <= max)
+    {
+        memcpy(&x, a + len, sizeof(uint64_t));
+        memcpy(&y, b + len, sizeof(uint64_t));
+        if (x != y)
+            return len + (__builtin_ctzll(x ^ y) >> 3);
+        len += sizeof(uint64_t);
+    }
+
+    while (len < max && a[len] == b[len])
+        len++;
+
+    return len;
+}
+
+// Lengths past the nibble continue in bytes, 255 meaning another byte follows
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    for (; len >= UINT8_MAX; len -= UINT8_MAX)
+        *op++ = UINT8_MAX;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static size_t get_length(const uint8_t **ip, const uint8_t *iend)
+{
+    size_t len = FAST_NIBBLE_MAX;
+    uint8_t b;
+
+    do
+    {
+        if (*ip == iend)
+            return SIZE_MAX;
+        b = *(*ip)++;
+        len += b;
+    } while (b == UINT8_MAX);
+
+    return len;
+}
+
+// Bytes a sequence takes at most besides its literals
+static size_t sequence_overhead(const size_t lit, const size_t len)
+{
+    return 1 + lit / UINT8_MAX + 1 + 2 + len / UINT8_MAX + 1;
+}
+
+int fast_compress(const uint8_t *src, const size_t start, const size_t size, uint8_t *dst, const size_t dst_cap,
+                  size_t *dst_size)
+{
+    uint32_t table[1 << FAST_HASH_BITS] = {0};
+    uint8_t *op = dst, *token;
+    size_t limit = size - start > FAST_MATCH_LIMIT ? size - FAST_MATCH_LIMIT : start;
+    size_t pos = start, anchor = start, cand, lit, len, h;
+
+    // History within reach of the first match seeds the table
+    for (h = start > FAST_MAX_OFFSET ? start - FAST_MAX_OFFSET : 0; h + FAST_MIN_MATCH <= start; h++)
+        table[hash4(src + h)] = (uint32_t)h;
+
+    while (pos < limit)
+    {
+        // A single probe: the table keeps only the latest position per hash
+        h = hash4(src + pos);
+        cand = table[h];
+        table[h] = (uint32_t)pos;
+        if (cand >= pos || pos - cand > FAST_MAX_OFFSET || read32(src + cand) != read32(src + pos))
+        {
+            pos += 1 + ((pos - anchor) >> FAST_SKIP_LOG);
+            continue;
+        }
+
+        // Grow the match back into the literals before it
+        while (pos > anchor && cand > 0 && src[pos - 1] == src[cand - 1])
+        {
+            pos--;
+            cand--;
+        }
+
+        len = match_length(src + cand + FAST_MIN_MATCH, src + pos + FAST_MIN_MATCH,
+                           size - FAST_LAST_LITERALS - pos - FAST_MIN_MATCH);
+        lit = pos - anchor;
+        if ((size_t)(dst + dst_cap - op) < lit + sequence_overhead(lit, len))
+            return -1;
+
+        token = op++;
+        *token = (uint8_t)((lit < FAST_NIBBLE_MAX ? lit : FAST_NIBBLE_MAX) << 4);
+        if (lit >= FAST_NIBBLE_MAX)
+            op = put_length(op, lit - FAST_NIBBLE_MAX);
+        memcpy(op, src + anchor, lit);
+        op += lit;
+
+        *op++ = (uint8_t)(pos - cand);
+        *op++ = (uint8_t)((pos - cand) >> 8);
+        *token |= (uint8_t)(len < FAST_NIBBLE_MAX ? len : FAST_NIBBLE_MAX);
+        if (len >= FAST_NIBBLE_MAX)
+            op = put_length(op, len - FAST_NIBBLE_MAX);
+
+        pos += FAST_MIN_MATCH + len;
+        anchor = pos;
+
+        // The match's tail is the likeliest start of the next repeat
+        table[hash4(src + pos - 2)] = (uint32_t)(pos - 2);
+    }
+
+    lit = size - anchor;
+    if ((size_t)(dst + dst_cap - op) < lit + sequence_overhead(lit, 0))
+        return -1;
+
+    *op++ = (uint8_t)((lit < FAST_NIBBLE_MAX ? lit : FAST_NIBBLE_MAX) << 4);
+    if (lit >= FAST_NIBBLE_MAX)
+        op = put_length(op, lit - FAST_NIBBLE_MAX);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+
+    *dst_size = (size_t)(op - dst);
+    return 0;
+}
+
+int fast_decompress(const uint8_t *dict, const size_t dict_size, const uint8_t *src, const size_t src_size,
+                    uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    const uint8_t *ip = src, *iend = src + src_size, *match;
+    uint8_t *op = dst, *oend = dst + dst_cap, *cpy;
+    size_t lit, len, offset, n;
+    uint8_t token;
+
+    for (;;)
+    {
+        if (ip == iend)
+            return -1;
+        token = *ip++;
+        lit = token >> 4;
+        len = token & FAST_NIBBLE_MAX;
+
+        // Common case of a short run and a short match at an offset of at least 8:
+        // fixed size copies with no length bytes to read and no bounds to track
+        if (lit < FAST_NIBBLE_MAX && len < FAST_NIBBLE_MAX && iend - ip >= FAST_SHORTCUT_IN &&
+            oend - op >= FAST_SHORTCUT_OUT)
+        {
+            memcpy(op, ip, 16);
+            op += lit;
+            ip += lit;
+            offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+            if (offset >= sizeof(uint64_t) && offset <= (size_t)(op - dst))
+            {
+                ip += 2;
+                match = op - offset;
+                memcpy(op, match, sizeof(uint64_t));
+                memcpy(op + 8, match + 8, sizeof(uint64_t));
+                memcpy(op + 16, match + 16, sizeof(uint64_t));
+                op += len + FAST_MIN_MATCH;
+                continue;
+            }
+            ip -= lit;
+            op -= lit;
+        }
+
+        // Short literal runs are copied 16 bytes at a time where both buffers have the slack
+        if (lit < FAST_NIBBLE_MAX && iend - ip >= 16 && oend - op >= 16)
+            memcpy(op, ip, 16);
+        else
+        {
+            if (lit == FAST_NIBBLE_MAX && (lit = get_length(&ip, iend)) == SIZE_MAX)
+                return -1;
+            if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+                return -1;
+            memcpy(op, ip, lit);
+        }
+        op += lit;
+        ip += lit;
+
+        // Only the last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if (len == FAST_NIBBLE_MAX && (len = get_length(&ip, iend)) == SIZE_MAX)
+            return -1;
+        len += FAST_MIN_MATCH;
+        if (offset == 0 || len > (size_t)(oend - op))
+            return -1;
+
+        // Matches starting in the dictionary may run on into dst
+        if (offset > (size_t)(op - dst))
+        {
+            n = offset - (size_t)(op - dst);
+            if (dict == nullptr || n > dict_size)
+                return -1;
+            match = dict + dict_size - n;
+            if (n > len)
+                n = len;
+            memcpy(op, match, n);
+            op += n;
+            for (match = dst, len -= n; len > 0; len--)
+                *op++ = *match++;
+            continue;
+        }
+
+        // 8 byte copies may overlap their own output once the offset is at least 8,
+        // and may write up to 7 bytes past the match
+        match = op - offset;
+        cpy = op + len;
+        if ((size_t)(oend - cpy) < sizeof(uint64_t))
+        {
+            while (op < cpy)
+                *op++ = *match++;
+            continue;
+        }
+
+        // Shorter offsets repeat a pattern: after its first 8 bytes the copy can read
+        // from a whole number of periods back that is at least 8
+        if (offset < sizeof(uint64_t))
+        {
+            for (n = 0; n < sizeof(uint64_t); n++)
+                op[n] = match[n];
+            op += sizeof(uint64_t);
+            match = op - offset * ((sizeof(uint64_t) + offset - 1) / offset);
+        }
+
+        while (op < cpy)
+        {
+            memcpy(op, match, sizeof(uint64_t));
+            op += sizeof(uint64_t);
+            match += sizeof(uint64_t);
+        }
+        op = cpy;
+    }
+
+    *dst_size = (size_t)(op - dst);
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include "frame.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+#include "adaptive.h"
+#include "deflate.h"
+#include "fast.h"
+#include "inflate.h"
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// LEB128, at most 10 bytes
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    for (; v >= 0x80; v >>= 7)
+        p[n++] = (uint8_t)(v | 0x80);
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static int get_varint(const uint8_t *src, const size_t src_size, size_t *pos, uint64_t *v)
+{
+    size_t shift;
+
+    *v = 0;
+    for (shift = 0; shift < 64 && *pos < src_size; shift += 7)
+    {
+        *v |= (uint64_t)(src[*pos] & 0x7f) << shift;
+        if ((src[(*pos)++] & 0x80) == 0)
+            return 0;
+    }
+
+    return -1;
+}
+
+static int write_header(bitstream_t *bs, const dict_t *dict, const uint8_t flags)
+{
+    uint8_t hdr[FRAME_MAGIC_SIZE + 1 + sizeof(uint32_t)];
+    size_t hdr_size = FRAME_MAGIC_SIZE + 1;
+
+    memcpy(hdr, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    hdr[FRAME_MAGIC_SIZE] = flags | (dict ? FRAME_FLAG_DICT : 0);
+    if (dict)
+    {
+        put_le32(hdr + hdr_size, dict->id);
+        hdr_size += sizeof(uint32_t);
+    }
+
+    bitstream_align(bs);
+    return bitstream_write_bytes(bs, hdr, hdr_size);
+}
+
+int frame_compress(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level)
+{
+    if (write_header(bs, dict, 0))
+        return -1;
+
+    return deflate_compress_dict(bs, dict, data, size, level);
+}
+
+int frame_compress_ldm(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level,
+                       const ldm_params_t *params)
+{
+    ldm_seqs_t seqs = {0};
+    uint8_t varint[3 * 10];
+    uint8_t *literals = nullptr;
+    size_t i, n, pos = 0, lit = 0;
+    int ret = -1;
+
+    if (ldm_find(data, size, params, &seqs) || write_header(bs, dict, FRAME_FLAG_LDM))
+        goto out;
+
+    n = put_varint(varint, seqs.size);
+    if (bitstream_write_bytes(bs, varint, n))
+        goto out;
+
+    // Gather the bytes between long matches for the regular parser
+    literals = malloc(size ? size : 1);
+    if (literals == nullptr)
+        goto out;
+
+    for (i = 0; i < seqs.size; i++)
+    {
+        memcpy(literals + lit, data + pos, seqs.seqs[i].literals);
+        lit += seqs.seqs[i].literals;
+        pos += seqs.seqs[i].literals + seqs.seqs[i].length;
+
+        n = put_varint(varint, seqs.seqs[i].literals);
+        n += put_varint(varint + n, seqs.seqs[i].length);
+        n += put_varint(varint + n, seqs.seqs[i].offset);
+        if (bitstream_write_bytes(bs, varint, n))
+            goto out;
+    }
+
+    memcpy(literals + lit, data + pos, size - pos);
+    lit += size - pos;
+
+    ret = deflate_compress_dict(bs, dict, literals, lit, level);
+
+out:
+    free(literals);
+    ldm_seqs_free(&seqs);
+    return ret;
+}
+
+int frame_compress_fast(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size)
+{
+    static const uint8_t end[sizeof(uint32_t)] = {0};
+    const uint8_t *src;
+    uint8_t *window = nullptr, *block;
+    size_t pos, n, hist, block_size;
+    int ret = -1;
+
+    if (write_header(bs, dict, FRAME_FLAG_FAST))
+        return -1;
+
+    for (pos = 0; pos < size; pos += n)
+    {
+        n = size - pos < FRAME_FAST_BLOCK_SIZE ? size - pos : FRAME_FAST_BLOCK_SIZE;
+
+        // The first block matches into the dictionary, later ones into the block before
+        if (pos == 0 && dict)
+        {
+            window = malloc(dict->size + n);
+            if (window == nullptr)
+                goto out;
+            memcpy(window, dict->data, dict->size);
+            memcpy(window + dict->size, data, n);
+            src = window;
+            hist = dict->size;
+        }
+        else
+        {
+            hist = pos < FAST_MAX_OFFSET ? pos : FAST_MAX_OFFSET;
+            src = data + pos - hist;
+        }
+
+        // Blocks are compressed straight into the stream behind their sizes
+        if (bitstream_reserve(bs, 2 * sizeof(uint32_t) + FAST_BOUND(n)))
+            goto out;
+        block = bs->stream + bs->byte_offset + 2 * sizeof(uint32_t);
+        if (fast_compress(src, hist, hist + n, block, FAST_BOUND(n), &block_size))
+            goto out;
+
+        put_le32(block - 2 * sizeof(uint32_t), (uint32_t)n);
+        if (block_size >= n)
+        {
+            memcpy(block, data + pos, n);
+            block_size = n;
+            put_le32(block - sizeof(uint32_t), (uint32_t)n | FRAME_FAST_STORED);
+        }
+        else
+            put_le32(block - sizeof(uint32_t), (uint32_t)block_size);
+
+        bs->byte_offset += 2 * sizeof(uint32_t) + block_size;
+        bs->size += (2 * sizeof(uint32_t) + block_size) * UINT8_BIT_COUNT;
+
+        free(window);
+        window = nullptr;
+    }
+
+    ret = bitstream_write_bytes(bs, end, sizeof(end));
+
+out:
+    free(window);
+    return ret;
+}
+
+int frame_compress_adaptive(bitstream_t *bs, const uint8_t *data, const size_t size)
+{
+    adaptive_huffman_t *ah;
+    uint8_t varint[10];
+    int ret = -1;
+
+    if (write_header(bs, nullptr, FRAME_FLAG_ADAPTIVE) || bitstream_write_bytes(bs, varint, put_varint(varint, size)))
+        return -1;
+
+    ah = adaptive_huffman_new();
+    if (ah != nullptr && adaptive_huffman_encode(ah, bs, data, size) == 0)
+    {
+        bitstream_align(bs);
+        ret = 0;
+    }
+
+    adaptive_huffman_free(ah);
+    return ret;
+}
+
+int frame_read_header(const uint8_t *src, const size_t src_size, frame_header_t *hdr)
+{
+    if (src_size < FRAME_MAGIC_SIZE + 1 || memcmp(src, FRAME_MAGIC, FRAME_MAGIC_SIZE) != 0)
+        return -1;
+
+    hdr->flags = src[FRAME_MAGIC_SIZE];
+    hdr->size = FRAME_MAGIC_SIZE + 1;
+    hdr->dict_id = 0;
+
+    // At most one of the alternative bodies, and adaptive coding takes no dictionary
+    if (hdr->flags & ~(FRAME_FLAG_DICT | FRAME_FLAG_LDM | FRAME_FLAG_FAST | FRAME_FLAG_ADAPTIVE) ||
+        __builtin_popcount(hdr->flags & (FRAME_FLAG_LDM | FRAME_FLAG_FAST | FRAME_FLAG_ADAPTIVE)) > 1 ||
+        (hdr->flags & FRAME_FLAG_ADAPTIVE && hdr->flags & FRAME_FLAG_DICT))
+        return -1;
+
+    if (hdr->flags & FRAME_FLAG_DICT)
+    {
+        if (src_size < hdr->size + sizeof(uint32_t))
+            return -1;
+        hdr->dict_id = get_le32(src + hdr->size);
+        hdr->size += sizeof(uint32_t);
+    }
+
+    return 0;
+}
+
+// Inflate the literals behind the space the long matches take, then interleave
+// both front to back. Writing never overtakes the literals still to be read
+static int decompress_ldm(const dict_t *dict, const uint8_t *src, const size_t src_size,
+                          uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    uint64_t count, i, literals, length, offset, matched = 0;
+    size_t pos = 0, table, n, k, out = 0, in;
+
+    if (get_varint(src, src_size, &pos, &count))
+        return -1;
+
+    table = pos;
+    for (i = 0; i < count; i++)
+    {
+        if (get_varint(src, src_size, &pos, &literals) || get_varint(src, src_size, &pos, &length) ||
+            get_varint(src, src_size, &pos, &offset) || length > dst_cap - matched)
+            return -1;
+        matched += length;
+    }
+
+    if (inflate_decompress_dict(dict, src + pos, src_size - pos, nullptr, dst + matched, dst_cap - matched, &n))
+        return -1;
+
+    pos = table;
+    in = matched;
+    for (i = 0; i < count; i++)
+    {
+        get_varint(src, src_size, &pos, &literals);
+        get_varint(src, src_size, &pos, &length);
+        get_varint(src, src_size, &pos, &offset);
+        if (literals > matched + n - in)
+            return -1;
+
+        memmove(dst + out, dst + in, literals);
+        out += literals;
+        in += literals;
+
+        if (offset == 0 || offset > out)
+            return -1;
+        if (offset >= length)
+            memcpy(dst + out, dst + out - offset, length);
+        else
+            for (k = 0; k < length; k++)
+                dst[out + k] = dst[out + k - offset];
+        out += length;
+    }
+
+    memmove(dst + out, dst + in, matched + n - in);
+    *dst_size = out + matched + n - in;
+    return 0;
+}
+
+static int decompress_fast(const dict_t *dict, const uint8_t *src, const size_t src_size,
+                           uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    size_t pos = 0, out = 0, size, block_size, hist, n;
+    uint32_t stored;
+    int ret;
+
+    for (;;)
+    {
+        if (src_size - pos < sizeof(uint32_t))
+            return -1;
+        size = get_le32(src + pos);
+        pos += sizeof(uint32_t);
+        if (size == 0)
+            break;
+
+        if (src_size - pos < sizeof(uint32_t))
+            return -1;
+        block_size = get_le32(src + pos);
+        pos += sizeof(uint32_t);
+        stored = block_size & FRAME_FAST_STORED;
+        block_size &= ~(size_t)FRAME_FAST_STORED;
+        if (block_size > src_size - pos || size > dst_cap - out)
+            return -1;
+
+        if (stored)
+        {
+            if (block_size != size)
+                return -1;
+            memcpy(dst + out, src + pos, size);
+        }
+        else
+        {
+            // Decoding into all of dst's room keeps the wild copies fast up to the block end
+            if (out == 0 && dict)
+                ret = fast_decompress(dict->data, dict->size, src + pos, block_size, dst, dst_cap, &n);
+            else
+            {
+                hist = out < FAST_MAX_OFFSET ? out : FAST_MAX_OFFSET;
+                ret = fast_decompress(dst + out - hist, hist, src + pos, block_size, dst + out, dst_cap - out, &n);
+            }
+            if (ret || n != size)
+                return -1;
+        }
+
+        pos += block_size;
+        out += size;
+    }
+
+    *dst_size = out;
+    return 0;
+}
+
+static int decompress_adaptive(const uint8_t *src, const size_t src_size, uint8_t *dst, const size_t dst_cap,
+                               size_t *dst_size)
+{
+    adaptive_huffman_t *ah;
+    size_t pos = 0, bit_pos;
+    uint64_t size;
+    int ret = -1;
+
+    if (get_varint(src, src_size, &pos, &size) || size > dst_cap)
+        return -1;
+
+    bit_pos = pos * UINT8_BIT_COUNT;
+    ah = adaptive_huffman_new();
+    if (ah != nullptr && adaptive_huffman_decode(ah, src, src_size, &bit_pos, dst, size) == 0)
+    {
+        *dst_size = size;
+        ret = 0;
+    }
+
+    adaptive_huffman_free(ah);
+    return ret;
+}
+
+int frame_decompress(const dict_t *dict, const uint8_t *src, const size_t src_size,
+                     uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    frame_header_t hdr;
+
+    if (frame_read_header(src, src_size, &hdr))
+        return -1;
+
+    // The dictionary must be the one the frame was compressed with
+    if (hdr.flags & FRAME_FLAG_DICT)
+    {
+        if (dict == nullptr || dict->id != hdr.dict_id)
+            return -1;
+    }
+    else
+        dict = nullptr;
+
+    if (hdr.flags & FRAME_FLAG_ADAPTIVE)
+        return decompress_adaptive(src + hdr.size, src_size - hdr.size, dst, dst_cap, dst_size);
+
+    if (hdr.flags & FRAME_FLAG_FAST)
+        return decompress_fast(dict, src + hdr.size, src_size - hdr.size, dst, dst_cap, dst_size);
+
+    if (hdr.flags & FRAME_FLAG_LDM)
+        return decompress_ldm(dict, src + hdr.size, src_size - hdr.size, dst, dst_cap, dst_size);
+
+    return inflate_decompress_dict(dict, src + hdr.size, src_size - hdr.size, nullptr, dst, dst_cap, dst_size);
+}
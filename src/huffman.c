@@ -1,8 +1,10 @@
 #include "huffman.h"
 
+#include <assert.h>
 #include <malloc.h>
 #include <memory.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <limits.h>
 
 #include "hashmap.h"
@@ -80,29 +82,47 @@ static huffman_node_t *huffman_node_new()
 
 huffman_node_t *huffman_generate(const uint8_t *buf, const size_t size)
 {
-    double weight;
-    huffman_node_t *l, *r, *hn, *root, *internal;
     size_t i;
     size_t freq[NUM_SYMBOLS] = {0};
 
-    prio_queue_t *pq_huffman = pq_new(NUM_SYMBOLS, compare_huffman, position_huffman);
-
     // Count each symbol
     for (i = 0; i < size; i++)
         freq[buf[i]]++;
 
+    return huffman_generate_freq(freq, NUM_SYMBOLS);
+}
+
+huffman_node_t *huffman_generate_freq(const size_t *freq, const size_t num_symbols)
+{
+    double weight;
+    huffman_node_t *l, *r, *hn, *root, *internal;
+    size_t i, total = 0;
+
+    prio_queue_t *pq_huffman = pq_new(num_symbols, compare_huffman, position_huffman);
+    if (pq_huffman == nullptr)
+        return nullptr;
+
+    for (i = 0; i < num_symbols; i++)
+        total += freq[i];
+
     // Calculate weights and create initial huffman nodes
-    for (i = 0; i < NUM_SYMBOLS; i++)
+    for (i = 0; i < num_symbols; i++)
         // Add node only if symbol occurs
         if (freq[i])
         {
-            weight = (double)freq[i] / (double)size;
+            weight = (double)freq[i] / (double)total;
             hn = huffman_node_new();
-            hn->symbol = (uint8_t)i;
+            hn->symbol = (uint16_t)i;
             hn->weight = weight;
             pq_insert(pq_huffman, hn);
         }
 
+    if (pq_size(pq_huffman) == 0)
+    {
+        free(pq_huffman);
+        return nullptr;
+    }
+
     // Create huffman tree
     while (pq_size(pq_huffman) > 1)
     {
@@ -122,6 +142,109 @@ huffman_node_t *huffman_generate(const uint8_t *buf, const size_t size)
     return root;
 }
 
+static void __huffman_depths(const huffman_node_t *root, size_t *depths, const size_t depth)
+{
+    if (root == nullptr)
+        return;
+
+    if (huffman_is_branch(root))
+    {
+        __huffman_depths(root->left, depths, depth + 1);
+        __huffman_depths(root->right, depths, depth + 1);
+    }
+    else
+        // A lone symbol still needs one bit
+        depths[root->symbol] = depth ? depth : 1;
+}
+
+// Order symbols by depth, ties by symbol
+static int compare_depth(const void *_lhs, const void *_rhs)
+{
+    const uint64_t lhs = *(const uint64_t *)_lhs;
+    const uint64_t rhs = *(const uint64_t *)_rhs;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+int huffman_code_lengths(const huffman_node_t *root, uint8_t *lens, const size_t num_symbols, const size_t max_bits)
+{
+    size_t i, j, n, depth;
+    size_t count[UINT64_BIT_COUNT] = {0};
+    uint64_t total;
+    size_t *depths = calloc(num_symbols, sizeof(size_t));
+    uint64_t *order = calloc(num_symbols, sizeof(uint64_t));
+    int ret = -1;
+
+    assert(max_bits > 0 && max_bits < UINT64_BIT_COUNT);
+    if (depths == nullptr || order == nullptr)
+        goto out;
+
+    memset(lens, 0, num_symbols);
+    __huffman_depths(root, depths, 0);
+
+    // Clamp overlong codes, collecting the leaves in depth order
+    for (i = 0, n = 0; i < num_symbols; i++)
+        if (depths[i])
+        {
+            depth = depths[i] > max_bits ? max_bits : depths[i];
+            count[depth]++;
+            order[n++] = ((uint64_t)depths[i] << 32) | i;
+        }
+
+    // Clamping oversubscribes the code; lengthen the deepest shorter codes
+    // until the Kraft sum fits again
+    for (i = 1, total = 0; i <= max_bits; i++)
+        total += (uint64_t)count[i] << (max_bits - i);
+    while (total > (1ull << max_bits))
+    {
+        count[max_bits]--;
+        for (i = max_bits - 1; i > 0; i--)
+            if (count[i])
+            {
+                count[i]--;
+                count[i + 1] += 2;
+                break;
+            }
+        total--;
+    }
+
+    // Shallowest symbols keep the shortest codes
+    qsort(order, n, sizeof(uint64_t), compare_depth);
+    for (i = 1, j = 0; i <= max_bits; i++)
+        for (; count[i] > 0; count[i]--)
+            lens[order[j++] & UINT32_MAX] = (uint8_t)i;
+    ret = 0;
+
+out:
+    free(depths);
+    free(order);
+    return ret;
+}
+
+void huffman_canonical_codes(const uint8_t *lens, uint16_t *codes, const size_t num_symbols)
+{
+    size_t i;
+    uint16_t code = 0;
+    uint16_t bl_count[UINT16_BIT_COUNT] = {0};
+    uint16_t next_code[UINT16_BIT_COUNT] = {0};
+
+    for (i = 0; i < num_symbols; i++)
+    {
+        assert(lens[i] < UINT16_BIT_COUNT);
+        bl_count[lens[i]]++;
+    }
+
+    bl_count[0] = 0;
+    for (i = 1; i < UINT16_BIT_COUNT; i++)
+    {
+        code = (code + bl_count[i - 1]) << 1;
+        next_code[i] = code;
+    }
+
+    for (i = 0; i < num_symbols; i++)
+        codes[i] = lens[i] ? next_code[lens[i]]++ : 0;
+}
+
 static void __huffman_generate_enc_map(huffman_enc_map_t *h, const huffman_node_t *root, sym_code_t key)
 {
     uint64_t prev_code;
@@ -157,11 +280,13 @@ void huffman_generate_enc_map(const huffman_node_t *root, huffman_enc_map_t *enc
 void huffman_encode(bitstream_t *bs, const huffman_enc_map_t *enc_map, const uint8_t *data, const size_t size)
 {
     size_t s;
+    uint16_t sym;
     sym_code_t *sc;
 
     for (s = 0; s < size; s++)
     {
-        sc = hashmap_get(enc_map, &data[s]);
+        sym = data[s];
+        sc = hashmap_get(enc_map, &sym);
         bitstream_write_64(bs, sc->code, sc->bit_len);
     }
 }
@@ -213,7 +338,7 @@ size_t huffman_height(huffman_node_t *root)
 void huffman_print_enc_map(huffman_enc_map_t *enc_map)
 {
     int i;
-    const uint8_t *k;
+    const uint16_t *k;
     sym_code_t *v;
     hashmap_foreach(k, v, enc_map)
     {
@@ -227,12 +352,12 @@ void huffman_print_enc_map(huffman_enc_map_t *enc_map)
     }
 }
 
-size_t sym_hash(const uint8_t *data)
+size_t sym_hash(const uint16_t *data)
 {
     return *data;
 }
 
-int sym_compare(const uint8_t *lhs, const uint8_t *rhs)
+int sym_compare(const uint16_t *lhs, const uint16_t *rhs)
 {
     return *lhs - *rhs;
 }
@@ -249,7 +374,7 @@ void huffman_free(huffman_node_t *root)
 
 void huffman_enc_map_free(huffman_enc_map_t *enc_map)
 {
-    const uint8_t *k;
+    const uint16_t *k;
     sym_code_t *v;
     hashmap_foreach(k, v, enc_map)
         free(v);
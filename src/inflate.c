@@ -0,0 +1,664 @@
+#include "inflate.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+#define WINDOW_MASK (LZ77_WINDOW_SIZE - 1)
+
+// Order in which code length code lengths are transmitted
+static const uint8_t codelen_order[DEFLATE_NUM_CODELEN] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+typedef struct
+{
+    const uint8_t *src;
+    size_t src_size;
+    size_t src_pos;
+    uint64_t bitbuf;
+    size_t bitcnt;
+    uint8_t *dst;
+    size_t dst_cap;
+    size_t dst_pos;
+    const uint8_t *dict; // history preceding dst
+    size_t dict_size;
+} inflate_state_t;
+
+static int need_bits(inflate_state_t *s, const size_t n)
+{
+    while (s->bitcnt < n)
+    {
+        if (s->src_pos == s->src_size)
+            return -1;
+        s->bitbuf |= (uint64_t)s->src[s->src_pos++] << s->bitcnt;
+        s->bitcnt += UINT8_BIT_COUNT;
+    }
+    return 0;
+}
+
+static int read_bits(inflate_state_t *s, const size_t n, uint32_t *out)
+{
+    if (need_bits(s, n))
+        return -1;
+
+    *out = (uint32_t)(s->bitbuf & ((1ull << n) - 1));
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return 0;
+}
+
+// Returns the number of codes left unused, negative if over-subscribed
+static int build_table(inflate_table_t *t, const uint8_t *lens, const size_t n)
+{
+    size_t i;
+    int left = 1;
+    uint16_t offs[DEFLATE_MAX_BITS + 1];
+
+    memset(t->count, 0, sizeof(t->count));
+    for (i = 0; i < n; i++)
+        t->count[lens[i]]++;
+
+    if (t->count[0] == n)
+        return 0;
+
+    for (i = 1; i <= DEFLATE_MAX_BITS; i++)
+    {
+        left <<= 1;
+        left -= t->count[i];
+        if (left < 0)
+            return left;
+    }
+
+    offs[1] = 0;
+    for (i = 1; i < DEFLATE_MAX_BITS; i++)
+        offs[i + 1] = offs[i] + t->count[i];
+
+    for (i = 0; i < n; i++)
+        if (lens[i])
+            t->symbol[offs[lens[i]]++] = (uint16_t)i;
+
+    return left;
+}
+
+static int decode_symbol(inflate_state_t *s, const inflate_table_t *t)
+{
+    size_t len;
+    int code = 0, first = 0, index = 0, count;
+
+    for (len = 1; len <= DEFLATE_MAX_BITS; len++)
+    {
+        if (need_bits(s, 1))
+            return -1;
+        code |= (int)(s->bitbuf & 1);
+        s->bitbuf >>= 1;
+        s->bitcnt--;
+
+        count = t->count[len];
+        if (code - count < first)
+            return t->symbol[index + (code - first)];
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+static int inflate_stored(inflate_state_t *s)
+{
+    uint32_t len, nlen;
+
+    // Skip to the byte boundary
+    s->bitbuf >>= s->bitcnt % UINT8_BIT_COUNT;
+    s->bitcnt -= s->bitcnt % UINT8_BIT_COUNT;
+
+    if (read_bits(s, 16, &len) || read_bits(s, 16, &nlen) || len != (~nlen & 0xffff))
+        return -1;
+
+    // Hand back whole bytes still buffered before copying straight from the source
+    s->src_pos -= s->bitcnt / UINT8_BIT_COUNT;
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+
+    if (s->src_size - s->src_pos < len || s->dst_cap - s->dst_pos < len)
+        return -1;
+
+    memcpy(s->dst + s->dst_pos, s->src + s->src_pos, len);
+    s->src_pos += len;
+    s->dst_pos += len;
+    return 0;
+}
+
+static int inflate_codes(inflate_state_t *s, const inflate_table_t *litlen, const inflate_table_t *dist)
+{
+    int sym;
+    uint32_t extra;
+    size_t len, d;
+
+    for (;;)
+    {
+        sym = decode_symbol(s, litlen);
+        if (sym < 0)
+            return -1;
+
+        if (sym < DEFLATE_END_OF_BLOCK)
+        {
+            if (s->dst_pos == s->dst_cap)
+                return -1;
+            s->dst[s->dst_pos++] = (uint8_t)sym;
+            continue;
+        }
+
+        if (sym == DEFLATE_END_OF_BLOCK)
+            return 0;
+
+        sym -= DEFLATE_END_OF_BLOCK + 1;
+        if (sym >= 29 || read_bits(s, deflate_length_extra[sym], &extra))
+            return -1;
+        len = deflate_length_base[sym] + extra;
+
+        sym = decode_symbol(s, dist);
+        if (sym < 0 || sym >= DEFLATE_NUM_DIST || read_bits(s, deflate_dist_extra[sym], &extra))
+            return -1;
+        d = deflate_dist_base[sym] + extra;
+
+        if (d > s->dst_pos + s->dict_size || s->dst_cap - s->dst_pos < len)
+            return -1;
+
+        // Matches reaching before the output start in the dictionary
+        for (; len > 0 && d > s->dst_pos; len--, s->dst_pos++)
+            s->dst[s->dst_pos] = s->dict[s->dict_size - (d - s->dst_pos)];
+
+        // Byte by byte, the source may overlap the destination
+        for (; len > 0; len--, s->dst_pos++)
+            s->dst[s->dst_pos] = s->dst[s->dst_pos - d];
+    }
+}
+
+static void fixed_tables(inflate_table_t *litlen, inflate_table_t *dist)
+{
+    size_t i;
+    uint8_t lens[INFLATE_NUM_FIXED_LITLEN];
+
+    for (i = 0; i < INFLATE_NUM_FIXED_LITLEN; i++)
+        lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    build_table(litlen, lens, INFLATE_NUM_FIXED_LITLEN);
+
+    memset(lens, 5, DEFLATE_NUM_DIST);
+    build_table(dist, lens, DEFLATE_NUM_DIST);
+}
+
+static int inflate_fixed(inflate_state_t *s)
+{
+    inflate_table_t litlen, dist;
+
+    fixed_tables(&litlen, &dist);
+    return inflate_codes(s, &litlen, &dist);
+}
+
+static int inflate_dynamic(inflate_state_t *s)
+{
+    uint32_t hlit, hdist, hclen, v, rep;
+    size_t i;
+    int sym, err;
+    uint8_t prev;
+    uint8_t lens[DEFLATE_NUM_LITLEN + DEFLATE_NUM_DIST];
+    inflate_table_t litlen, dist, codelen;
+
+    if (read_bits(s, 5, &hlit) || read_bits(s, 5, &hdist) || read_bits(s, 4, &hclen))
+        return -1;
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if (hlit > DEFLATE_NUM_LITLEN || hdist > DEFLATE_NUM_DIST)
+        return -1;
+
+    memset(lens, 0, DEFLATE_NUM_CODELEN);
+    for (i = 0; i < hclen; i++)
+    {
+        if (read_bits(s, 3, &v))
+            return -1;
+        lens[codelen_order[i]] = (uint8_t)v;
+    }
+    if (build_table(&codelen, lens, DEFLATE_NUM_CODELEN) != 0)
+        return -1;
+
+    for (i = 0; i < hlit + hdist;)
+    {
+        sym = decode_symbol(s, &codelen);
+        if (sym < 0)
+            return -1;
+
+        if (sym < 16)
+        {
+            lens[i++] = (uint8_t)sym;
+            continue;
+        }
+
+        prev = 0;
+        if (sym == 16)
+        {
+            if (i == 0 || read_bits(s, 2, &rep))
+                return -1;
+            prev = lens[i - 1];
+            rep += 3;
+        }
+        else if (sym == 17)
+        {
+            if (read_bits(s, 3, &rep))
+                return -1;
+            rep += 3;
+        }
+        else
+        {
+            if (read_bits(s, 7, &rep))
+                return -1;
+            rep += 11;
+        }
+
+        if (i + rep > hlit + hdist)
+            return -1;
+        for (; rep > 0; rep--)
+            lens[i++] = prev;
+    }
+
+    if (lens[DEFLATE_END_OF_BLOCK] == 0)
+        return -1;
+
+    // Incomplete codes are only permitted for a single one bit code
+    err = build_table(&litlen, lens, hlit);
+    if (err < 0 || (err > 0 && hlit != litlen.count[0] + litlen.count[1]))
+        return -1;
+    err = build_table(&dist, lens + hlit, hdist);
+    if (err < 0 || (err > 0 && hdist != dist.count[0] + dist.count[1]))
+        return -1;
+
+    return inflate_codes(s, &litlen, &dist);
+}
+
+int inflate_decompress(const uint8_t *src, const size_t src_size, size_t *src_used,
+                       uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    return inflate_decompress_dict(nullptr, src, src_size, src_used, dst, dst_cap, dst_size);
+}
+
+int inflate_decompress_dict(const dict_t *dict, const uint8_t *src, const size_t src_size, size_t *src_used,
+                            uint8_t *dst, const size_t dst_cap, size_t *dst_size)
+{
+    uint32_t final, type;
+    int err;
+    inflate_state_t s = {
+        .src = src,
+        .src_size = src_size,
+        .dst = dst,
+        .dst_cap = dst_cap,
+        .dict = dict ? dict->data : nullptr,
+        .dict_size = dict ? dict->size : 0,
+    };
+
+    do
+    {
+        if (read_bits(&s, 1, &final) || read_bits(&s, 2, &type))
+            return -1;
+
+        switch (type)
+        {
+        case 0:
+            err = inflate_stored(&s);
+            break;
+        case 1:
+            err = inflate_fixed(&s);
+            break;
+        case 2:
+            err = inflate_dynamic(&s);
+            break;
+        default:
+            err = -1;
+        }
+
+        if (err)
+            return -1;
+    } while (!final);
+
+    if (src_used != nullptr)
+        *src_used = s.src_pos - s.bitcnt / UINT8_BIT_COUNT;
+    *dst_size = s.dst_pos;
+    return 0;
+}
+
+inflate_stream_t *inflate_stream_new(const dict_t *dict)
+{
+    inflate_stream_t *s = calloc(1, sizeof(inflate_stream_t));
+    if (s == nullptr)
+        return nullptr;
+
+    // The dictionary is the history before the first output byte
+    if (dict != nullptr)
+    {
+        memcpy(s->window, dict->data, dict->size);
+        s->wpos = dict->size & WINDOW_MASK;
+        s->whave = dict->size;
+    }
+
+    return s;
+}
+
+// Buffer one more input byte, false if the input is used up
+static bool stream_pull(inflate_stream_t *s)
+{
+    if (s->in_pos == s->in_size)
+        return false;
+
+    s->bitbuf |= (uint64_t)s->in[s->in_pos++] << s->bitcnt;
+    s->bitcnt += UINT8_BIT_COUNT;
+    return true;
+}
+
+// Buffer at least n bits, pulling no more bytes than needed so that none
+// past the end of the stream are taken
+static bool stream_need(inflate_stream_t *s, const size_t n)
+{
+    while (s->bitcnt < n)
+        if (!stream_pull(s))
+            return false;
+    return true;
+}
+
+static uint32_t stream_bits(inflate_stream_t *s, const size_t n)
+{
+    uint32_t v = (uint32_t)(s->bitbuf & ((1ull << n) - 1));
+
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return v;
+}
+
+// Decode a symbol from the buffered bits from offset on, without consuming
+// them. Returns the symbol, -1 if the code is invalid, -2 if bits are missing
+static int peek_symbol(const inflate_stream_t *s, const inflate_table_t *t, const size_t offset, size_t *bits)
+{
+    size_t len;
+    int code = 0, first = 0, index = 0, count;
+
+    for (len = 1; len <= DEFLATE_MAX_BITS; len++)
+    {
+        if (offset + len > s->bitcnt)
+            return -2;
+        code |= (int)((s->bitbuf >> (offset + len - 1)) & 1);
+
+        count = t->count[len];
+        if (code - count < first)
+        {
+            *bits = len;
+            return t->symbol[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+static void stream_put(inflate_stream_t *s, const uint8_t c)
+{
+    s->out[s->out_pos++] = c;
+    s->window[s->wpos] = c;
+    s->wpos = (s->wpos + 1) & WINDOW_MASK;
+    if (s->whave < LZ77_WINDOW_SIZE)
+        s->whave++;
+}
+
+// One code length, with the extra bits of a repeat. Returns 0 once read, 1 if input is missing
+static int stream_codelen(inflate_stream_t *s)
+{
+    static const uint8_t extra[3] = {2, 3, 7};
+    static const uint8_t base[3] = {3, 3, 11};
+    size_t bits, rep;
+    int sym;
+    uint8_t prev = 0;
+
+    while ((sym = peek_symbol(s, &s->codelen, 0, &bits)) == -2 ||
+           (sym >= 16 && s->bitcnt < bits + extra[sym - 16]))
+        if (!stream_pull(s))
+            return 1;
+    if (sym < 0)
+        return -1;
+
+    stream_bits(s, bits);
+    if (sym < 16)
+    {
+        s->lens[s->have++] = (uint8_t)sym;
+        return 0;
+    }
+
+    if (sym == 16)
+    {
+        if (s->have == 0)
+            return -1;
+        prev = s->lens[s->have - 1];
+    }
+    rep = base[sym - 16] + stream_bits(s, extra[sym - 16]);
+    if (s->have + rep > s->hlit + s->hdist)
+        return -1;
+
+    for (; rep > 0; rep--)
+        s->lens[s->have++] = prev;
+    return 0;
+}
+
+// One literal, end of block or whole length and distance pair. Returns 0 once
+// decoded, 1 if input or output space is missing
+static int stream_symbol(inflate_stream_t *s)
+{
+    size_t bits, dbits = 0, need, lc = 0;
+    int sym, dsym = 0;
+
+    for (;;)
+    {
+        sym = peek_symbol(s, &s->litlen, 0, &bits);
+        if (sym == -1)
+            return -1;
+
+        if (sym >= 0 && sym <= DEFLATE_END_OF_BLOCK)
+            break;
+
+        if (sym > DEFLATE_END_OF_BLOCK)
+        {
+            lc = (size_t)sym - (DEFLATE_END_OF_BLOCK + 1);
+            if (lc >= 29)
+                return -1;
+
+            need = bits + deflate_length_extra[lc];
+            dsym = s->bitcnt >= need ? peek_symbol(s, &s->distcode, need, &dbits) : -2;
+            if (dsym == -1 || dsym >= DEFLATE_NUM_DIST)
+                return -1;
+            if (dsym >= 0 && s->bitcnt >= need + dbits + deflate_dist_extra[dsym])
+                break;
+        }
+
+        if (!stream_pull(s))
+            return 1;
+    }
+
+    if (sym < DEFLATE_END_OF_BLOCK)
+    {
+        if (s->out_pos == s->out_cap)
+            return 1;
+        stream_bits(s, bits);
+        stream_put(s, (uint8_t)sym);
+        return 0;
+    }
+
+    stream_bits(s, bits);
+    if (sym == DEFLATE_END_OF_BLOCK)
+    {
+        s->mode = s->final ? INFLATE_DONE : INFLATE_HEADER;
+        return 0;
+    }
+
+    s->length = deflate_length_base[lc] + stream_bits(s, deflate_length_extra[lc]);
+    stream_bits(s, dbits);
+    s->dist = deflate_dist_base[dsym] + stream_bits(s, deflate_dist_extra[dsym]);
+    if (s->dist > s->whave)
+        return -1;
+
+    s->mode = INFLATE_MATCH;
+    return 0;
+}
+
+// Run the state machine until input or output runs out. Returns 0 on suspension
+static int stream_run(inflate_stream_t *s)
+{
+    size_t i, n;
+    int err;
+
+    for (;;)
+    {
+        switch (s->mode)
+        {
+        case INFLATE_HEADER:
+            if (!stream_need(s, 3))
+                return 0;
+            s->final = stream_bits(s, 1);
+            switch (stream_bits(s, 2))
+            {
+            case 0:
+                // Stored data starts at the byte boundary
+                stream_bits(s, s->bitcnt % UINT8_BIT_COUNT);
+                s->mode = INFLATE_STORED;
+                break;
+            case 1:
+                fixed_tables(&s->litlen, &s->distcode);
+                s->mode = INFLATE_CODES;
+                break;
+            case 2:
+                s->mode = INFLATE_TABLE;
+                break;
+            default:
+                return -1;
+            }
+            break;
+
+        case INFLATE_STORED:
+            if (!stream_need(s, 32))
+                return 0;
+            s->length = stream_bits(s, 16);
+            if (s->length != (~stream_bits(s, 16) & 0xffff))
+                return -1;
+            s->mode = INFLATE_STORED_COPY;
+            break;
+
+        case INFLATE_STORED_COPY:
+            // Bytes already buffered first, then straight from the input
+            for (; s->length > 0 && s->bitcnt >= UINT8_BIT_COUNT && s->out_pos < s->out_cap; s->length--)
+                stream_put(s, (uint8_t)stream_bits(s, UINT8_BIT_COUNT));
+
+            n = s->length;
+            if (n > s->in_size - s->in_pos)
+                n = s->in_size - s->in_pos;
+            if (n > s->out_cap - s->out_pos)
+                n = s->out_cap - s->out_pos;
+            for (i = 0; i < n; i++)
+                stream_put(s, s->in[s->in_pos + i]);
+            s->in_pos += n;
+            s->length -= n;
+
+            if (s->length > 0)
+                return 0;
+            s->mode = s->final ? INFLATE_DONE : INFLATE_HEADER;
+            break;
+
+        case INFLATE_TABLE:
+            if (!stream_need(s, 14))
+                return 0;
+            s->hlit = stream_bits(s, 5) + 257;
+            s->hdist = stream_bits(s, 5) + 1;
+            s->hclen = stream_bits(s, 4) + 4;
+            if (s->hlit > DEFLATE_NUM_LITLEN || s->hdist > DEFLATE_NUM_DIST)
+                return -1;
+            memset(s->lens, 0, DEFLATE_NUM_CODELEN);
+            s->have = 0;
+            s->mode = INFLATE_LENLENS;
+            break;
+
+        case INFLATE_LENLENS:
+            for (; s->have < s->hclen; s->have++)
+            {
+                if (!stream_need(s, 3))
+                    return 0;
+                s->lens[codelen_order[s->have]] = (uint8_t)stream_bits(s, 3);
+            }
+            if (build_table(&s->codelen, s->lens, DEFLATE_NUM_CODELEN) != 0)
+                return -1;
+            s->have = 0;
+            s->mode = INFLATE_CODELENS;
+            break;
+
+        case INFLATE_CODELENS:
+            while (s->have < s->hlit + s->hdist)
+                if ((err = stream_codelen(s)) != 0)
+                    return err > 0 ? 0 : -1;
+
+            if (s->lens[DEFLATE_END_OF_BLOCK] == 0)
+                return -1;
+
+            // Incomplete codes are only permitted for a single one bit code
+            err = build_table(&s->litlen, s->lens, s->hlit);
+            if (err < 0 || (err > 0 && s->hlit != s->litlen.count[0] + s->litlen.count[1]))
+                return -1;
+            err = build_table(&s->distcode, s->lens + s->hlit, s->hdist);
+            if (err < 0 || (err > 0 && s->hdist != s->distcode.count[0] + s->distcode.count[1]))
+                return -1;
+            s->mode = INFLATE_CODES;
+            break;
+
+        case INFLATE_CODES:
+            if ((err = stream_symbol(s)) != 0)
+                return err > 0 ? 0 : -1;
+            break;
+
+        case INFLATE_MATCH:
+            for (; s->length > 0 && s->out_pos < s->out_cap; s->length--)
+                stream_put(s, s->window[(s->wpos - s->dist) & WINDOW_MASK]);
+            if (s->length > 0)
+                return 0;
+            s->mode = INFLATE_CODES;
+            break;
+
+        case INFLATE_DONE:
+        case INFLATE_ERROR:
+            return 0;
+        }
+    }
+}
+
+int inflate_stream_update(inflate_stream_t *s, const uint8_t *in, const size_t in_size, size_t *in_used,
+                          uint8_t *out, const size_t out_cap, size_t *out_used)
+{
+    s->in = in;
+    s->in_size = in_size;
+    s->in_pos = 0;
+    s->out = out;
+    s->out_cap = out_cap;
+    s->out_pos = 0;
+
+    if (s->mode != INFLATE_ERROR && stream_run(s))
+        s->mode = INFLATE_ERROR;
+
+    *in_used = s->in_pos;
+    *out_used = s->out_pos;
+    s->in = nullptr;
+    s->out = nullptr;
+
+    if (s->mode == INFLATE_ERROR)
+        return -1;
+    return s->mode == INFLATE_DONE ? 1 : 0;
+}
+
+void inflate_stream_free(inflate_stream_t *s)
+{
+    free(s);
+}
@@ -0,0 +1,161 @@
+#include "ldm.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+// Rolling hash multiplier, and the mixer spreading its bits over index and tag
+#define LDM_PRIME 0x9E3779B185EBCA87ull
+#define LDM_MIX 0x9E3779B97F4A7C15ull
+// A table entry per 2^7 window bytes by default
+#define LDM_HASH_RATE_LOG 7
+#define LDM_HASH_LOG_MIN 10
+
+static size_t match_length(const uint8_t *a, const uint8_t *b, const size_t max)
+{
+    size_t len = 0;
+    uint64_t x, y;
+
+    while (len + sizeof(uint64_t) <= max)
+    {
+        memcpy(&x, a + len, sizeof(uint64_t));
+        memcpy(&y, b + len, sizeof(uint64_t));
+        if (x != y)
+            return len + (__builtin_ctzll(x ^ y) >> 3);
+        len += sizeof(uint64_t);
+    }
+
+    while (len < max && a[len] == b[len])
+        len++;
+
+    return len;
+}
+
+static uint64_t hash_init(const uint8_t *p, const size_t n)
+{
+    uint64_t h = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        h = h * LDM_PRIME + p[i];
+
+    return h;
+}
+
+static int seqs_push(ldm_seqs_t *seqs, const size_t literals, const size_t length, const size_t offset)
+{
+    ldm_seq_t *s;
+    size_t capacity;
+
+    if (seqs->size == seqs->capacity)
+    {
+        capacity = seqs->capacity ? seqs->capacity * 2 : 256;
+        s = realloc(seqs->seqs, capacity * sizeof(ldm_seq_t));
+        if (s == nullptr)
+            return -1;
+        seqs->seqs = s;
+        seqs->capacity = capacity;
+    }
+
+    seqs->seqs[seqs->size++] = (ldm_seq_t){literals, length, offset};
+    return 0;
+}
+
+int ldm_find(const uint8_t *data, const size_t size, const ldm_params_t *params, ldm_seqs_t *seqs)
+{
+    size_t window_log = params && params->window_log ? params->window_log : LDM_WINDOW_LOG_DEFAULT;
+    size_t min_match = params && params->min_match ? params->min_match : LDM_MIN_MATCH;
+    size_t hash_log = params ? params->hash_log : 0;
+    size_t sample_log, pos = 0, anchor = 0, idx, len, cand;
+    uint64_t h, x, pm = 1, tag_mask, window;
+    uint64_t *table;
+    uint32_t *checks, check;
+    int ret = -1;
+
+    if (size < min_match)
+        return 0;
+
+    // Inputs smaller than the window need neither its reach nor its table
+    if (window_log > LDM_WINDOW_LOG_MAX)
+        window_log = LDM_WINDOW_LOG_MAX;
+    while (window_log > LDM_HASH_LOG_MIN && ((uint64_t)1 << (window_log - 1)) >= size)
+        window_log--;
+    if (hash_log == 0)
+        hash_log = window_log > LDM_HASH_LOG_MIN + LDM_HASH_RATE_LOG ? window_log - LDM_HASH_RATE_LOG : LDM_HASH_LOG_MIN;
+    if (hash_log > LDM_HASH_LOG_MAX)
+        hash_log = LDM_HASH_LOG_MAX;
+    if (hash_log > window_log)
+        hash_log = window_log;
+
+    // Only one position in 2^sample_log is remembered, picked by its hash so
+    // both copies of a repeat agree on which positions those are
+    sample_log = window_log - hash_log;
+    tag_mask = ((uint64_t)1 << sample_log) - 1;
+    window = (uint64_t)1 << window_log;
+
+    table = calloc((size_t)1 << hash_log, sizeof(uint64_t)); // position + 1, 0 if empty
+    checks = calloc((size_t)1 << hash_log, sizeof(uint32_t));
+    if (table == nullptr || checks == nullptr)
+        goto out;
+
+    for (len = 1; len < min_match; len++)
+        pm *= LDM_PRIME;
+
+    h = hash_init(data, min_match);
+    while (pos + min_match <= size)
+    {
+        x = h * LDM_MIX;
+        if (((x >> (64 - hash_log - sample_log)) & tag_mask) == tag_mask)
+        {
+            idx = (size_t)(x >> (64 - hash_log));
+            check = (uint32_t)x;
+            cand = checks[idx] == check ? (size_t)table[idx] : 0;
+            table[idx] = pos + 1;
+            checks[idx] = check;
+
+            if (cand != 0 && pos + 1 - cand <= window)
+            {
+                cand--;
+                len = match_length(data + cand, data + pos, size - pos);
+                if (len >= min_match)
+                {
+                    // Grow the match back into the literals before it
+                    while (pos > anchor && cand > 0 && data[pos - 1] == data[cand - 1])
+                    {
+                        pos--;
+                        cand--;
+                        len++;
+                    }
+
+                    if (seqs_push(seqs, pos - anchor, len, pos - cand))
+                        goto out;
+
+                    // Long matches skip their whole length
+                    anchor = pos + len;
+                    pos = anchor;
+                    if (pos + min_match <= size)
+                        h = hash_init(data + pos, min_match);
+                    continue;
+                }
+            }
+        }
+
+        if (pos + min_match == size)
+            break;
+        h = (h - data[pos] * pm) * LDM_PRIME + data[pos + min_match];
+        pos++;
+    }
+    ret = 0;
+
+out:
+    free(table);
+    free(checks);
+    return ret;
+}
+
+void ldm_seqs_free(ldm_seqs_t *seqs)
+{
+    free(seqs->seqs);
+    seqs->seqs = nullptr;
+    seqs->size = 0;
+    seqs->capacity = 0;
+}
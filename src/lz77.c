@@ -0,0 +1,335 @@
+#include "lz77.h"
+
+#include <malloc.h>
+#include <memory.h>
+#include <assert.h>
+
+#define WINDOW_MASK (LZ77_WINDOW_SIZE - 1)
+
+static size_t hash3(const uint8_t *p, const size_t hash_bits)
+{
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 0x9E3779B1u) >> (32 - hash_bits);
+}
+
+// Number of equal leading bytes of a and b, at most max
+static size_t match_length(const uint8_t *a, const uint8_t *b, const size_t max)
+{
+    size_t len = 0;
+    uint64_t x, y;
+
+    while (len + sizeof(uint64_t) <= max)
+    {
+        memcpy(&x, a + len, sizeof(uint64_t));
+        memcpy(&y, b + len, sizeof(uint64_t));
+        if (x != y)
+            return len + (__builtin_ctzll(x ^ y) >> 3);
+        len += sizeof(uint64_t);
+    }
+
+    while (len < max && a[len] == b[len])
+        len++;
+
+    return len;
+}
+
+lz77_matcher_t *lz77_matcher_new(const size_t hash_bits)
+{
+    lz77_matcher_t *m = calloc(1, sizeof(lz77_matcher_t));
+    if (m == nullptr)
+        return nullptr;
+
+    m->hash_bits = hash_bits;
+    m->head = malloc(((size_t)1 << hash_bits) * sizeof(uint32_t));
+    m->prev = malloc(LZ77_WINDOW_SIZE * sizeof(uint32_t));
+    if (m->head == nullptr || m->prev == nullptr)
+    {
+        lz77_matcher_free(m);
+        return nullptr;
+    }
+
+    lz77_matcher_reset(m);
+    return m;
+}
+
+lz77_matcher_t *lz77_matcher_clone(const lz77_matcher_t *src)
+{
+    lz77_matcher_t *m = calloc(1, sizeof(lz77_matcher_t));
+    size_t inserted = src->next < LZ77_WINDOW_SIZE ? src->next : LZ77_WINDOW_SIZE;
+
+    if (m == nullptr)
+        return nullptr;
+
+    m->hash_bits = src->hash_bits;
+    m->next = src->next;
+    m->head = malloc(((size_t)1 << m->hash_bits) * sizeof(uint32_t));
+    m->prev = malloc(LZ77_WINDOW_SIZE * sizeof(uint32_t));
+    if (m->head == nullptr || m->prev == nullptr)
+    {
+        lz77_matcher_free(m);
+        return nullptr;
+    }
+
+    // Links of positions never inserted are never followed, so a young
+    // matcher only needs its used prefix of prev copied
+    memcpy(m->head, src->head, ((size_t)1 << m->hash_bits) * sizeof(uint32_t));
+    memcpy(m->prev, src->prev, inserted * sizeof(uint32_t));
+    memset(m->prev + inserted, 0xff, (LZ77_WINDOW_SIZE - inserted) * sizeof(uint32_t));
+    return m;
+}
+
+void lz77_matcher_reset(lz77_matcher_t *m)
+{
+    memset(m->head, 0xff, ((size_t)1 << m->hash_bits) * sizeof(uint32_t));
+    memset(m->prev, 0xff, LZ77_WINDOW_SIZE * sizeof(uint32_t));
+    m->next = 0;
+}
+
+void lz77_insert_until(lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end)
+{
+    size_t h;
+
+    for (; m->next < pos; m->next++)
+    {
+        // The last two positions have no complete hash
+        if (m->next + LZ77_MIN_MATCH > end)
+            continue;
+
+        h = hash3(base + m->next, m->hash_bits);
+        m->prev[m->next & WINDOW_MASK] = m->head[h];
+        m->head[h] = (uint32_t)m->next;
+    }
+}
+
+void lz77_skip(lz77_matcher_t *m, const size_t pos)
+{
+    if (m->next < pos)
+        m->next = pos;
+}
+
+void lz77_slide(lz77_matcher_t *m, const size_t delta)
+{
+    size_t i;
+
+    for (i = 0; i < ((size_t)1 << m->hash_bits); i++)
+        m->head[i] = m->head[i] != LZ77_NIL && m->head[i] >= delta ? m->head[i] - delta : LZ77_NIL;
+
+    // prev is indexed by position, which only stays put if delta is a window multiple
+    assert((delta & WINDOW_MASK) == 0);
+    for (i = 0; i < LZ77_WINDOW_SIZE; i++)
+        m->prev[i] = m->prev[i] != LZ77_NIL && m->prev[i] >= delta ? m->prev[i] - delta : LZ77_NIL;
+
+    m->next -= delta;
+}
+
+size_t lz77_longest_match(const lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end,
+                          const lz77_params_t *params, size_t *dist)
+{
+    size_t len, best = LZ77_MIN_MATCH - 1;
+    size_t limit = end - pos < LZ77_MAX_MATCH ? end - pos : LZ77_MAX_MATCH;
+    size_t nice = params->nice_length < limit ? params->nice_length : limit;
+    uint32_t chain = params->max_chain;
+    uint32_t cur, next;
+
+    if (limit < LZ77_MIN_MATCH)
+        return 0;
+
+    cur = m->head[hash3(base + pos, m->hash_bits)];
+    while (cur != LZ77_NIL && cur < pos && pos - cur <= LZ77_WINDOW_SIZE && chain-- > 0)
+    {
+        // Cheap reject: a longer match must agree on the byte after the best one
+        if (base[cur + best] == base[pos + best])
+        {
+            len = match_length(base + cur, base + pos, limit);
+            if (len > best)
+            {
+                best = len;
+                *dist = pos - cur;
+                if (best >= nice)
+                    break;
+            }
+        }
+
+        // Stale links point forward; the chain ends there
+        next = m->prev[cur & WINDOW_MASK];
+        if (next >= cur)
+            break;
+        cur = next;
+    }
+
+    return best >= LZ77_MIN_MATCH ? best : 0;
+}
+
+size_t lz77_all_matches(const lz77_matcher_t *m, const uint8_t *base, const size_t pos, const size_t end,
+                        const size_t max_chain, uint16_t *sublen)
+{
+    size_t l, len, best = LZ77_MIN_MATCH - 1;
+    size_t limit = end - pos < LZ77_MAX_MATCH ? end - pos : LZ77_MAX_MATCH;
+    size_t chain = max_chain;
+    uint32_t cur, next;
+
+    if (limit < LZ77_MIN_MATCH)
+        return 0;
+
+    cur = m->head[hash3(base + pos, m->hash_bits)];
+    while (cur != LZ77_NIL && cur < pos && pos - cur <= LZ77_WINDOW_SIZE && chain-- > 0)
+    {
+        if (base[cur + best] == base[pos + best])
+        {
+            len = match_length(base + cur, base + pos, limit);
+            // Chains run from near to far, so the first distance reaching a length is the closest
+            for (l = best + 1; l <= len; l++)
+                sublen[l] = (uint16_t)(pos - cur);
+            if (len > best)
+                best = len;
+            if (best == limit)
+                break;
+        }
+
+        next = m->prev[cur & WINDOW_MASK];
+        if (next >= cur)
+            break;
+        cur = next;
+    }
+
+    return best >= LZ77_MIN_MATCH ? best : 0;
+}
+
+int lz77_parse(lz77_matcher_t *m, const uint8_t *base, const size_t start, const size_t end,
+               const lz77_params_t *params, lz77_seqs_t *seqs)
+{
+    size_t pos = start, misses = 0, step;
+    size_t len, dist = 0, next_len, next_dist = 0;
+
+    while (pos < end)
+    {
+        lz77_insert_until(m, base, pos, end);
+        len = lz77_longest_match(m, base, pos, end, params, &dist);
+        if (len == 0)
+        {
+            step = params->skip_log ? 1 + (misses++ >> params->skip_log) : 1;
+            if (step > LZ77_SKIP_MAX)
+                step = LZ77_SKIP_MAX;
+            if (step > end - pos)
+                step = end - pos;
+
+            // Positions stepped over are emitted as literals but left out of the hash chains
+            if (step > 1)
+            {
+                lz77_insert_until(m, base, pos + 1, end);
+                lz77_skip(m, pos + step);
+            }
+            if (lz77_seqs_push_literals(seqs, base + pos, step))
+                return -1;
+            pos += step;
+            continue;
+        }
+        misses = 0;
+
+        // Defer the match while the next position offers a longer one
+        while (len < params->lazy_length && pos + 1 < end)
+        {
+            lz77_insert_until(m, base, pos + 1, end);
+            next_len = lz77_longest_match(m, base, pos + 1, end, params, &next_dist);
+            if (next_len <= len)
+                break;
+
+            if (lz77_seqs_push_literals(seqs, base + pos, 1))
+                return -1;
+            pos++;
+            len = next_len;
+            dist = next_dist;
+        }
+
+        if (lz77_seqs_push_match(seqs, len, dist))
+            return -1;
+        pos += len;
+    }
+
+    return 0;
+}
+
+int lz77_seqs_push_literals(lz77_seqs_t *seqs, const uint8_t *data, const size_t size)
+{
+    uint8_t *literals;
+    size_t capacity;
+
+    if (seqs->num_literals + size > seqs->literals_capacity)
+    {
+        capacity = seqs->literals_capacity ? seqs->literals_capacity : 4096;
+        while (capacity < seqs->num_literals + size)
+            capacity *= 2;
+        literals = realloc(seqs->literals, capacity);
+        if (literals == nullptr)
+            return -1;
+        seqs->literals = literals;
+        seqs->literals_capacity = capacity;
+    }
+
+    if (size == 1)
+        seqs->literals[seqs->num_literals] = *data;
+    else if (size > 1)
+        memcpy(seqs->literals + seqs->num_literals, data, size);
+    seqs->num_literals += size;
+    seqs->tail += size;
+    return 0;
+}
+
+int lz77_seqs_push_match(lz77_seqs_t *seqs, const size_t length, const size_t distance)
+{
+    uint32_t *lit_runs;
+    uint16_t *lengths, *dists;
+    size_t capacity;
+
+    if (seqs->size == seqs->capacity)
+    {
+        // Arrays grown before a failure are merely larger than capacity says
+        capacity = seqs->capacity ? seqs->capacity * 2 : 1024;
+        lit_runs = realloc(seqs->lit_runs, capacity * sizeof(uint32_t));
+        if (lit_runs == nullptr)
+            return -1;
+        seqs->lit_runs = lit_runs;
+        lengths = realloc(seqs->lengths, capacity * sizeof(uint16_t));
+        if (lengths == nullptr)
+            return -1;
+        seqs->lengths = lengths;
+        dists = realloc(seqs->dists, capacity * sizeof(uint16_t));
+        if (dists == nullptr)
+            return -1;
+        seqs->dists = dists;
+        seqs->capacity = capacity;
+    }
+
+    seqs->lit_runs[seqs->size] = (uint32_t)seqs->tail;
+    seqs->lengths[seqs->size] = (uint16_t)length;
+    seqs->dists[seqs->size] = (uint16_t)distance;
+    seqs->size++;
+    seqs->tail = 0;
+    return 0;
+}
+
+void lz77_seqs_clear(lz77_seqs_t *seqs)
+{
+    seqs->num_literals = 0;
+    seqs->size = 0;
+    seqs->tail = 0;
+}
+
+void lz77_seqs_free(lz77_seqs_t *seqs)
+{
+    free(seqs->literals);
+    free(seqs->lit_runs);
+    free(seqs->lengths);
+    free(seqs->dists);
+    memset(seqs, 0, sizeof(lz77_seqs_t));
+}
+
+void lz77_matcher_free(lz77_matcher_t *m)
+{
+    if (m == nullptr)
+        return;
+
+    free(m->head);
+    free(m->prev);
+    free(m);
+}
@@ -1,71 +1,509 @@
 /**
  * TODO:
  * - DEFLATE algorithm
- *      [ ] Huffman encoding/decoding
+ *      [x] Huffman encoding/decoding
  *          [x] Construct huffman tree
  *          [x] Encode data
  *          [x] Decode data
- *          [ ] Serialize/deserialize tree
- *          [ ] Limit tree height to 18s
- *      [ ] Duplicate string elimination (LZxx)
+ *          [x] Serialize/deserialize tree
+ *          [x] Limit tree height to 15
+ *      [x] Duplicate string elimination (LZ77)
+ *          [x] Greedy and lazy matching
+ *          [x] Optimal parsing
  * - .ZIP compliancy
- *      [ ] Headers
- *          [ ] Local file header
- *          [ ] Data descriptor
- *          [ ] Central directory file header (CDHF)
- *          [ ] End of central directory record (EOCD)
+ *      [x] Headers
+ *          [x] Local file header
+ *          [x] Data descriptor
+ *          [x] Central directory file header (CDHF)
+ *          [x] End of central directory record (EOCD)
  * - Unit testing
  *      [ ] Priority queue
  *      [ ] Bitstream
  *      [ ] Huffman
  */
 
-#include <malloc.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include "prio_queue.h"
-#include "huffman.h"
-#include "hashmap.h"
-#include "file.h"
+#include "cache.h"
+#include "deflate.h"
+#include "parallel.h"
+#include "unzip.h"
+#include "zip.h"
 
-int main(int argc, char **argv)
+#define PATH_SIZE 4096
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-0..-%d] [-f] [-i] [-jN] [-cDIR [-CN]] archive.zip|- file|dir...\n", prog, DEFLATE_LEVEL_MAX);
+    fprintf(stderr, "       %s -u|-a [-0..-%d] [-f] [-i] [-jN] [-cDIR [-CN]] archive.zip file|dir...\n", prog,
+            DEFLATE_LEVEL_MAX);
+    fprintf(stderr, "       %s -x [-jN] archive.zip|- [dir]\n", prog);
+    fprintf(stderr, "       %s -t [-jN] archive.zip|-\n", prog);
+    fprintf(stderr, "  -f   compress every file at the level, even ones that look compressed already\n");
+    fprintf(stderr, "  -i   add a name index for fast lookups by plzip readers\n");
+    fprintf(stderr, "  -u   update: rewrite the archive, copying the entries of unchanged files as they are\n");
+    fprintf(stderr, "  -a   append in place after the last entry, rewriting only the central directory\n");
+    fprintf(stderr, "  -x   extract into dir, default the current directory; an archive from a pipe is read front to back\n");
+    fprintf(stderr, "  -t   test the integrity of every entry\n");
+    fprintf(stderr, "  -jN  work on N threads, default one per CPU\n");
+    fprintf(stderr, "  -cDIR  reuse compressed entries of unchanged files from the cache in DIR, and keep new ones\n");
+    fprintf(stderr, "  -CN  keep at most N MiB in the cache, default %llu\n", CACHE_SIZE_DEFAULT >> 20);
+}
+
+// Entry names are relative, without leading "/" or "./"
+static const char *entry_name(const char *path)
+{
+    for (;;)
+    {
+        if (path[0] == '/')
+            path++;
+        else if (path[0] == '.' && path[1] == '/')
+            path += 2;
+        else
+            return path;
+    }
+}
+
+// Files to add, with their entry names. When updating an archive, files that an old
+// entry holds unchanged are left out and the old entries the others replace are marked
+typedef struct
+{
+    char **paths;
+    char **names;
+    size_t num;
+    size_t capacity;
+    unzip_t *old;   // archive being updated, nullptr when creating one
+    bool *replaced; // per old entry
+} file_list_t;
+
+// An old entry is reused when its size, time and mode match the file's
+static bool unchanged(const zip_entry_t *e, const struct stat *st)
 {
-    const char *str = "A_DEAD_DAD_CEDED_A_BAD_BABE_A_BEADED_ABACA_BED";
-    //const char* str = "the letters are sorted by increasing frequency, and the least frequent two at each step are combined and reinserted into the list, and a partial tree is constructed";
+    return e->size == (S_ISREG(st->st_mode) ? (uint64_t)st->st_size : 0) &&
+           e->dos_time == zip_dos_time(st->st_mtime) && e->attr >> 16 == (uint32_t)st->st_mode;
+}
 
-    printf("Input:\n%s\n", str);
+static int list_file(file_list_t *fl, const char *path, const char *name, const struct stat *st)
+{
+    size_t i = fl->old ? unzip_find(fl->old, name, strlen(name)) : UNZIP_NOT_FOUND, capacity;
+    char **paths, **names;
+
+    if (i != UNZIP_NOT_FOUND)
+    {
+        if (unchanged(&fl->old->entries[i], st))
+            return 0;
+        fl->replaced[i] = true;
+    }
+
+    if (fl->num == fl->capacity)
+    {
+        capacity = fl->capacity ? fl->capacity * 2 : 256;
+        paths = realloc(fl->paths, capacity * sizeof(char *));
+        if (paths == nullptr)
+            return -1;
+        fl->paths = paths;
+        names = realloc(fl->names, capacity * sizeof(char *));
+        if (names == nullptr)
+            return -1;
+        fl->names = names;
+        fl->capacity = capacity;
+    }
+
+    fl->paths[fl->num] = strdup(path);
+    fl->names[fl->num] = strdup(name);
+    if (fl->paths[fl->num] == nullptr || fl->names[fl->num] == nullptr)
+    {
+        free(fl->paths[fl->num]);
+        free(fl->names[fl->num]);
+        return -1;
+    }
 
-    size_t size = strlen(str);
-    printf("Data length: %lu\n", size);
-    huffman_node_t *huff_tree = huffman_generate((uint8_t *)str, size);
-    printf("Hufftree depth: %lu\n", huffman_height(huff_tree));
+    fl->num++;
+    return 0;
+}
+
+static int list_path(file_list_t *fl, const char *path)
+{
+    char name[PATH_SIZE];
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+    int ret = 0;
 
-    huffman_enc_map_t *enc_map = calloc(1, sizeof(huffman_enc_map_t));
-    hashmap_init(enc_map, sym_hash, sym_compare);
-    huffman_generate_enc_map(huff_tree, enc_map);
-    huffman_print_enc_map(enc_map);
+    if (stat(path, &st))
+        return -1;
+    if (S_ISREG(st.st_mode))
+        return list_file(fl, path, entry_name(path), &st);
+    if (!S_ISDIR(st.st_mode))
+        return 0;
 
-    bitstream_t *stream = bitstream_new(size);
-    huffman_encode(stream, enc_map, (uint8_t*)str, size);
+    if (*entry_name(path) != '\0')
+    {
+        if ((size_t)snprintf(name, sizeof(name), "%s/", entry_name(path)) >= sizeof(name) ||
+            list_file(fl, path, name, &st))
+            return -1;
+    }
 
-    printf("Encoded stream:\n");
-    print_bitstream(stream);
-    print_bitstream_hex(stream);
+    dir = opendir(path);
+    if (dir == nullptr)
+        return -1;
 
-    printf("Original size: %lu bits\nEncoded size: %lu bits\n", size * UINT8_BIT_COUNT, bitstream_size(stream));
+    while (ret == 0 && (de = readdir(dir)) != nullptr)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if ((size_t)snprintf(name, sizeof(name), "%s/%s", path, de->d_name) >= sizeof(name))
+            ret = -1;
+        else
+            ret = list_path(fl, name);
+    }
 
-    uint8_t *buf = calloc(size + 1, sizeof(uint8_t));
-    huffman_decode(huff_tree, stream, buf, size);
-    printf("Decoded string:\n%s\n", buf);
+    closedir(dir);
+    return ret;
+}
 
-    if (open_and_write_to_file("_test", buf, size, FILE_WRITE) == EOF)
-        printf("file operation is weird");
+static void free_files(file_list_t *fl)
+{
+    size_t i;
+
+    for (i = 0; i < fl->num; i++)
+    {
+        free(fl->paths[i]);
+        free(fl->names[i]);
+    }
+    free(fl->paths);
+    free(fl->names);
+    free(fl->replaced);
+    unzip_close(fl->old);
+}
+
+// Carry the old entries no file replaces over to the new archive: copied compressed
+// as they are when rewriting it, left where they are when appending to it in place
+static int keep_old(const file_list_t *fl, zip_writer_t *zw, const int fd)
+{
+    const unzip_t *uz = fl->old;
+    const uint8_t *data;
+    size_t i;
+
+    for (i = 0; i < uz->num_entries; i++)
+    {
+        if (fl->replaced[i])
+            continue;
+
+        if (fd < 0)
+        {
+            if (zip_writer_keep(zw, &uz->entries[i], unzip_name(uz, i)))
+                return -1;
+            continue;
+        }
+
+        data = unzip_data(uz, i);
+        if (data == nullptr ||
+            zip_writer_add_copy(zw, &uz->entries[i], unzip_name(uz, i), fd, (uint64_t)(data - uz->map)))
+            return -1;
+    }
 
-    huffman_free(huff_tree);
-    bitstream_free(stream);
-    huffman_enc_map_free(enc_map);
-    free(buf);
     return 0;
-}
\ No newline at end of file
+}
+
+// Extract an archive into dest, or test it if dest is nullptr
+typedef struct
+{
+    const char *prog;
+    const char *what;
+} unzip_report_t;
+
+static void report_failed(const char *name, void *arg)
+{
+    const unzip_report_t *r = arg;
+    fprintf(stderr, "%s: %s: %s\n", r->prog, name, r->what);
+}
+
+// Archives that cannot be mapped, from stdin or a pipe, are read front to back
+static int unzip_stream_main(const char *prog, const char *archive, const char *dest)
+{
+    unzip_report_t report = {prog, dest ? "cannot extract" : "corrupt"};
+    int fd = strcmp(archive, "-") == 0 ? STDIN_FILENO : open(archive, O_RDONLY);
+    int ret;
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s: cannot read archive\n", prog, archive);
+        return 1;
+    }
+
+    ret = parallel_unzip_stream(fd, dest, report_failed, &report);
+    if (ret)
+        fprintf(stderr, "%s: %s: %s\n", prog, archive, dest ? "extraction failed" : "test failed");
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return ret ? 1 : 0;
+}
+
+static int unzip_main(const char *prog, const char *archive, const char *dest, const parallel_options_t *opts)
+{
+    struct stat st;
+    unzip_t *uz;
+    bool *failed;
+    size_t i;
+    int ret = 1;
+
+    if (strcmp(archive, "-") == 0 || (stat(archive, &st) == 0 && !S_ISREG(st.st_mode)))
+        return unzip_stream_main(prog, archive, dest);
+
+    uz = unzip_open(archive);
+    if (uz == nullptr)
+    {
+        fprintf(stderr, "%s: %s: cannot read archive\n", prog, archive);
+        return 1;
+    }
+
+    failed = calloc(uz->num_entries ? uz->num_entries : 1, sizeof(bool));
+    if (failed == nullptr)
+        goto out;
+
+    if (parallel_unzip(uz, dest, opts, failed) == 0)
+        ret = 0;
+    for (i = 0; i < uz->num_entries; i++)
+    {
+        if (failed[i])
+            fprintf(stderr, "%s: %.*s: %s\n", prog, (int)uz->entries[i].name_len, unzip_name(uz, i),
+                    dest ? "cannot extract" : "corrupt");
+    }
+
+out:
+    free(failed);
+    unzip_close(uz);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int level = DEFLATE_LEVEL_DEFAULT, arg, fd = -1, tmp_fd, ret = 1;
+    parallel_options_t opts = {0};
+    file_list_t files = {0};
+    parallel_zip_t *pz = nullptr;
+    zip_writer_t *zw = nullptr;
+    uint64_t cache_size = CACHE_SIZE_DEFAULT;
+    bool index = false, choose = true;
+    char mode = 'c', tmp[PATH_SIZE] = "";
+    const char *archive, *cache_dir = nullptr;
+    FILE *out = nullptr;
+    uint64_t append_at;
+    struct stat st;
+    size_t i;
+    char *end;
+
+    // Options until the archive, which may be "-"
+    for (arg = 1; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++)
+    {
+        if (strcmp(argv[arg], "-i") == 0)
+        {
+            index = true;
+            continue;
+        }
+
+        if (strcmp(argv[arg], "-f") == 0)
+        {
+            choose = false;
+            continue;
+        }
+
+        if (strcmp(argv[arg], "-x") == 0 || strcmp(argv[arg], "-t") == 0 || strcmp(argv[arg], "-u") == 0 ||
+            strcmp(argv[arg], "-a") == 0)
+        {
+            mode = argv[arg][1];
+            continue;
+        }
+
+        if (argv[arg][1] == 'c' && argv[arg][2] != '\0')
+        {
+            cache_dir = argv[arg] + 2;
+            continue;
+        }
+
+        if (argv[arg][1] == 'C')
+        {
+            cache_size = strtoull(argv[arg] + 2, &end, 10);
+            if (end == argv[arg] + 2 || *end != '\0' || cache_size > UINT64_MAX >> 20)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            cache_size <<= 20;
+            continue;
+        }
+
+        if (argv[arg][1] == 'j')
+        {
+            opts.threads = strtoul(argv[arg] + 2, &end, 10);
+            if (*end != '\0')
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+
+        level = (int)strtol(argv[arg] + 1, &end, 10);
+        if (*end != '\0' || level < 0 || level > DEFLATE_LEVEL_MAX)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mode == 'x' && (argc - arg == 1 || argc - arg == 2))
+        return unzip_main(argv[0], argv[arg], argc - arg == 2 ? argv[arg + 1] : ".", &opts);
+    if (mode == 't' && argc - arg == 1)
+        return unzip_main(argv[0], argv[arg], nullptr, &opts);
+
+    if ((mode != 'c' && mode != 'u' && mode != 'a') || argc - arg < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    archive = argv[arg];
+    if (mode != 'c')
+    {
+        files.old = unzip_open(archive);
+        if (files.old == nullptr)
+        {
+            fprintf(stderr, "%s: %s: cannot read archive\n", argv[0], archive);
+            return 1;
+        }
+        files.replaced = calloc(files.old->num_entries ? files.old->num_entries : 1, sizeof(bool));
+        if (files.replaced == nullptr)
+            goto out;
+    }
+
+    for (arg++; arg < argc; arg++)
+    {
+        if (list_path(&files, argv[arg]))
+        {
+            perror(argv[arg]);
+            goto out;
+        }
+    }
+
+    // An update is written beside the archive and renamed over it once complete
+    if (mode == 'u')
+    {
+        fd = open(archive, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) || (size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", archive) >= sizeof(tmp))
+        {
+            perror(archive);
+            goto out;
+        }
+        tmp_fd = mkstemp(tmp);
+        if (tmp_fd < 0)
+        {
+            perror(tmp);
+            tmp[0] = '\0';
+            goto out;
+        }
+        if (fchmod(tmp_fd, st.st_mode & 0777) || (out = fdopen(tmp_fd, "wb")) == nullptr)
+        {
+            perror(tmp);
+            close(tmp_fd);
+            goto out;
+        }
+    }
+    else if (mode == 'a')
+        out = fopen(archive, "r+b");
+    else
+        out = strcmp(archive, "-") == 0 ? stdout : fopen(archive, "wb");
+    if (out == nullptr)
+    {
+        perror(archive);
+        goto out;
+    }
+
+    zw = zip_writer_new(out, level);
+    if (zw == nullptr)
+        goto out;
+    zw->index = index || (files.old != nullptr && files.old->slots_mapped); // an index is kept up to date
+    zw->choose = choose;
+
+    // Appending overwrites the old name index and central directory, so they go out of use first
+    if (mode == 'a')
+    {
+        append_at = files.old->slots_mapped ? (uint64_t)((const uint8_t *)files.old->slots - files.old->map)
+                                            : files.old->cd_offset;
+        if (fseeko(out, (off_t)append_at, SEEK_SET))
+            goto out;
+        zw->offset = append_at;
+    }
+    if (files.old != nullptr && keep_old(&files, zw, fd))
+    {
+        fprintf(stderr, "%s: %s: cannot keep old entries\n", argv[0], archive);
+        goto out;
+    }
+    unzip_close(files.old);
+    files.old = nullptr;
+
+    if (cache_dir != nullptr && (opts.cache = cache_open(cache_dir, cache_size)) == nullptr)
+    {
+        perror(cache_dir);
+        goto out;
+    }
+
+    pz = parallel_zip_new(zw, &opts);
+    if (pz == nullptr)
+        goto out;
+
+    for (i = 0; i < files.num; i++)
+    {
+        if (parallel_zip_add(pz, files.paths[i], files.names[i]))
+        {
+            perror(files.paths[i]);
+            goto out;
+        }
+    }
+
+    if (parallel_zip_finish(pz))
+    {
+        fprintf(stderr, "%s: cannot add all files\n", argv[0]);
+        goto out;
+    }
+
+    if (zip_writer_finish(zw) || (mode == 'a' && ftruncate(fileno(out), (off_t)zw->offset)))
+    {
+        fprintf(stderr, "%s: cannot write archive\n", argv[0]);
+        goto out;
+    }
+
+    if (mode == 'u')
+    {
+        if (fclose(out) || rename(tmp, archive))
+        {
+            out = nullptr;
+            perror(archive);
+            goto out;
+        }
+        out = nullptr;
+        tmp[0] = '\0';
+    }
+    ret = 0;
+
+out:
+    parallel_zip_free(pz);
+    if (cache_close(opts.cache))
+        fprintf(stderr, "%s: %s: cannot write cache index\n", argv[0], cache_dir);
+    zip_writer_free(zw);
+    free_files(&files);
+    if (out != nullptr && out != stdout)
+        fclose(out);
+    if (fd >= 0)
+        close(fd);
+    if (tmp[0] != '\0')
+        unlink(tmp);
+    return ret;
+}
@@ -0,0 +1,253 @@
+#include "optimal.h"
+
+#include <malloc.h>
+#include <memory.h>
+
+#define COST_INF UINT32_MAX
+
+// Every match available at each position, as runs of lengths sharing the
+// closest distance: lengths up to lengths[k] use dists[k]
+typedef struct
+{
+    uint32_t *offsets; // first run of each position, one extra for the end
+    uint16_t *lengths;
+    uint16_t *dists;
+    size_t size;
+    size_t capacity;
+} candidates_t;
+
+// Bit cost of each literal, match length and distance code, extra bits included
+typedef struct
+{
+    uint32_t literal[UINT8_MAX + 1];
+    uint32_t length[LZ77_MAX_MATCH + 1];
+    uint32_t dist[DEFLATE_NUM_DIST];
+} cost_model_t;
+
+static int candidates_push(candidates_t *c, const size_t length, const size_t dist)
+{
+    uint16_t *l, *d;
+    size_t capacity;
+
+    if (c->size == c->capacity)
+    {
+        capacity = c->capacity ? c->capacity * 2 : 4096;
+        l = realloc(c->lengths, capacity * sizeof(uint16_t));
+        if (l == nullptr)
+            return -1;
+        c->lengths = l;
+        d = realloc(c->dists, capacity * sizeof(uint16_t));
+        if (d == nullptr)
+            return -1;
+        c->dists = d;
+        c->capacity = capacity;
+    }
+
+    c->lengths[c->size] = (uint16_t)length;
+    c->dists[c->size] = (uint16_t)dist;
+    c->size++;
+    return 0;
+}
+
+static int find_candidates(lz77_matcher_t *m, const uint8_t *base, const size_t start, const size_t end,
+                           const size_t max_chain, candidates_t *c)
+{
+    size_t pos, l, longest;
+    uint16_t sublen[LZ77_MAX_MATCH + 2];
+
+    for (pos = start; pos < end; pos++)
+    {
+        lz77_insert_until(m, base, pos, end);
+        c->offsets[pos - start] = (uint32_t)c->size;
+
+        longest = lz77_all_matches(m, base, pos, end, max_chain, sublen);
+        for (l = LZ77_MIN_MATCH; l <= longest; l++)
+            if (l == longest || sublen[l + 1] != sublen[l])
+                if (candidates_push(c, l, sublen[l]))
+                    return -1;
+    }
+
+    lz77_insert_until(m, base, end, end);
+    c->offsets[end - start] = (uint32_t)c->size;
+    return 0;
+}
+
+static void model_from_lengths(cost_model_t *model, const uint8_t *litlen_lens, const uint8_t *dist_lens)
+{
+    size_t i, lc;
+
+    for (i = 0; i <= UINT8_MAX; i++)
+        model->literal[i] = litlen_lens[i];
+
+    for (i = LZ77_MIN_MATCH; i <= LZ77_MAX_MATCH; i++)
+    {
+        lc = deflate_length_code(i);
+        model->length[i] = litlen_lens[DEFLATE_END_OF_BLOCK + 1 + lc] + deflate_length_extra[lc];
+    }
+
+    for (i = 0; i < DEFLATE_NUM_DIST; i++)
+        model->dist[i] = dist_lens[i] + deflate_dist_extra[i];
+}
+
+// First pass prices symbols by the fixed Huffman code
+static void model_fixed(cost_model_t *model)
+{
+    uint8_t litlen_lens[DEFLATE_NUM_LITLEN];
+    uint8_t dist_lens[DEFLATE_NUM_DIST];
+
+    deflate_fixed_lengths(litlen_lens, dist_lens);
+    model_from_lengths(model, litlen_lens, dist_lens);
+}
+
+// Later passes price symbols by the Huffman code of the previous result. Every
+// symbol is counted once more so unused ones keep a finite price
+static int model_from_freq(cost_model_t *model, const deflate_freq_t *freq)
+{
+    size_t i;
+    deflate_freq_t smoothed;
+    uint8_t litlen_lens[DEFLATE_NUM_LITLEN];
+    uint8_t dist_lens[DEFLATE_NUM_DIST];
+
+    for (i = 0; i < DEFLATE_NUM_LITLEN; i++)
+        smoothed.litlen[i] = freq->litlen[i] + 1;
+    for (i = 0; i < DEFLATE_NUM_DIST; i++)
+        smoothed.dist[i] = freq->dist[i] + 1;
+
+    if (deflate_code_lengths(smoothed.litlen, DEFLATE_NUM_LITLEN, litlen_lens, DEFLATE_MAX_BITS) ||
+        deflate_code_lengths(smoothed.dist, DEFLATE_NUM_DIST, dist_lens, DEFLATE_MAX_BITS))
+        return -1;
+    model_from_lengths(model, litlen_lens, dist_lens);
+    return 0;
+}
+
+// Cheapest path through the n + 1 positions, every edge a literal or a candidate match
+static int shortest_path(const uint8_t *base, const size_t start, const size_t n, const candidates_t *c,
+                         const cost_model_t *model, uint32_t *cost, uint16_t *step_len, uint16_t *step_dist,
+                         lz77_seqs_t *seqs)
+{
+    size_t i, k, l, prev;
+    uint32_t dc, cc;
+
+    cost[0] = 0;
+    for (i = 1; i <= n; i++)
+        cost[i] = COST_INF;
+
+    for (i = 0; i < n; i++)
+    {
+        cc = cost[i] + model->literal[base[start + i]];
+        if (cc < cost[i + 1])
+        {
+            cost[i + 1] = cc;
+            step_len[i + 1] = 1;
+            step_dist[i + 1] = 0;
+        }
+
+        prev = LZ77_MIN_MATCH - 1;
+        for (k = c->offsets[i]; k < c->offsets[i + 1]; k++)
+        {
+            dc = cost[i] + model->dist[deflate_dist_code(c->dists[k])];
+            for (l = prev + 1; l <= c->lengths[k]; l++)
+            {
+                cc = dc + model->length[l];
+                if (cc < cost[i + l])
+                {
+                    cost[i + l] = cc;
+                    step_len[i + l] = (uint16_t)l;
+                    step_dist[i + l] = c->dists[k];
+                }
+            }
+            prev = c->lengths[k];
+        }
+    }
+
+    // Walk back from the end, then emit the steps front to back. cost is
+    // free by now and holds the end positions of the path
+    for (i = n, k = 0; i > 0; i -= step_len[i])
+        cost[k++] = (uint32_t)i;
+
+    lz77_seqs_clear(seqs);
+    while (k-- > 0)
+    {
+        i = cost[k];
+        if (step_dist[i] == 0)
+        {
+            if (lz77_seqs_push_literals(seqs, base + start + i - 1, 1))
+                return -1;
+        }
+        else if (lz77_seqs_push_match(seqs, step_len[i], step_dist[i]))
+            return -1;
+    }
+
+    return 0;
+}
+
+int optimal_parse(lz77_matcher_t *m, const uint8_t *base, const size_t start, const size_t end,
+                  const deflate_level_t *level, lz77_seqs_t *seqs)
+{
+    size_t it, i, bits, best_bits = SIZE_MAX, last_bits = 0;
+    size_t n = end - start;
+    candidates_t c = {0};
+    cost_model_t model;
+    deflate_freq_t freq;
+    deflate_code_t code;
+    lz77_seqs_t trial = {0}, best = {0}, swap;
+    const uint8_t *literals;
+    uint32_t *cost = malloc((n + 1) * sizeof(uint32_t));
+    uint16_t *step_len = malloc((n + 1) * sizeof(uint16_t));
+    uint16_t *step_dist = malloc((n + 1) * sizeof(uint16_t));
+    int ret = -1;
+
+    c.offsets = malloc((n + 1) * sizeof(uint32_t));
+    if (cost == nullptr || step_len == nullptr || step_dist == nullptr || c.offsets == nullptr)
+        goto out;
+
+    if (find_candidates(m, base, start, end, level->lz77.max_chain, &c))
+        goto out;
+
+    model_fixed(&model);
+    for (it = 0; it < (level->iterations ? level->iterations : 1); it++)
+    {
+        if (shortest_path(base, start, n, &c, &model, cost, step_len, step_dist, &trial))
+            goto out;
+
+        memset(&freq, 0, sizeof(freq));
+        deflate_count(&trial, &freq);
+        if (deflate_build_dynamic(&freq, &code))
+            goto out;
+        bits = deflate_dynamic_bits(&freq, &code);
+        if (bits < best_bits)
+        {
+            best_bits = bits;
+            swap = best;
+            best = trial;
+            trial = swap;
+        }
+
+        // The model has settled once a pass no longer changes the size
+        if (bits == last_bits)
+            break;
+        last_bits = bits;
+
+        if (model_from_freq(&model, &freq))
+            goto out;
+    }
+
+    for (i = 0, literals = best.literals; i < best.size; literals += best.lit_runs[i], i++)
+        if (lz77_seqs_push_literals(seqs, literals, best.lit_runs[i]) ||
+            lz77_seqs_push_match(seqs, best.lengths[i], best.dists[i]))
+            goto out;
+    if (lz77_seqs_push_literals(seqs, literals, best.tail))
+        goto out;
+    ret = 0;
+
+out:
+    free(cost);
+    free(step_len);
+    free(step_dist);
+    free(c.offsets);
+    free(c.lengths);
+    free(c.dists);
+    lz77_seqs_free(&trial);
+    lz77_seqs_free(&best);
+    return ret;
+}
@@ -0,0 +1,1240 @@
+#include "parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitstream.h"
+#include "checksum.h"
+#include "deflate.h"
+#include "inflate.h"
+#include "lz77.h"
+#include "wrapper.h"
+
+// Chunks compressed ahead of the writer per worker, bounds memory use
+#define CHUNKS_IN_FLIGHT 2
+// Archive entries queued or compressed ahead of the writer per worker
+#define ENTRIES_IN_FLIGHT 4
+// Entries at least this large are compressed to a temporary file instead of memory
+#define ENTRY_SPILL_SIZE (32 * 1024 * 1024)
+#define ENTRY_BUFFER_SIZE (64 * 1024)
+#define PATH_SIZE 4096
+#define MODE_FILE 0644
+#define MODE_DIR 0755
+// Archive input read ahead of a streaming extraction, so reading goes on while entries are written
+#define STREAM_AHEAD_SIZE (8 * 1024 * 1024)
+#define STREAM_READ_SIZE (256 * 1024)
+#define STREAM_OUT_SIZE (256 * 1024)
+
+typedef struct
+{
+    bitstream_t *out;
+    uint32_t crc;
+    bool done;
+} chunk_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    int level;
+    size_t chunk_size;
+    size_t num_chunks;
+    chunk_t *chunks;
+    size_t next;    // next chunk to hand to a worker
+    size_t written; // chunks passed to the writer
+    size_t window;  // most chunks compressed but not yet written
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} job_t;
+
+static int compress_chunk(job_t *job, lz77_matcher_t *m, const size_t i, bitstream_t *bs)
+{
+    size_t start = i * job->chunk_size;
+    size_t len = job->size - start < job->chunk_size ? job->size - start : job->chunk_size;
+    size_t hist = start < LZ77_WINDOW_SIZE ? start : LZ77_WINDOW_SIZE;
+    bool last = i + 1 == job->num_chunks;
+
+    if (deflate_compress_window(bs, m, job->data + start - hist, hist, hist + len, job->level, last))
+        return -1;
+
+    return last ? 0 : deflate_sync_flush(bs);
+}
+
+static void *worker(void *arg)
+{
+    job_t *job = arg;
+    lz77_matcher_t *m = lz77_matcher_new(LZ77_HASH_BITS);
+    bitstream_t *bs;
+    size_t i, start, len;
+    uint32_t crc;
+    int err;
+
+    pthread_mutex_lock(&job->lock);
+    if (m == nullptr)
+        job->failed = true;
+
+    for (;;)
+    {
+        while (!job->failed && job->next < job->num_chunks && job->next >= job->written + job->window)
+            pthread_cond_wait(&job->cond, &job->lock);
+        if (job->failed || job->next >= job->num_chunks)
+            break;
+
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        start = i * job->chunk_size;
+        len = job->size - start < job->chunk_size ? job->size - start : job->chunk_size;
+        bs = bitstream_new(len / 2 + 64);
+        err = bs == nullptr || compress_chunk(job, m, i, bs);
+        crc = crc32(CRC32_INIT, job->data + start, len);
+
+        pthread_mutex_lock(&job->lock);
+        job->chunks[i].out = bs;
+        job->chunks[i].crc = crc;
+        job->chunks[i].done = true;
+        if (err)
+            job->failed = true;
+        pthread_cond_broadcast(&job->cond);
+    }
+
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    lz77_matcher_free(m);
+    return nullptr;
+}
+
+static int write_stream(FILE *out, const bitstream_t *bs)
+{
+    size_t size = bitstream_byte_offset(bs) + (bitstream_bit_offset(bs) ? 1 : 0);
+    return fwrite(bs->stream, sizeof(uint8_t), size, out) == size ? 0 : -1;
+}
+
+// Emit chunks in order as workers finish them, combining their checksums
+static int write_chunks(FILE *out, job_t *job, uint32_t *crc)
+{
+    size_t i, start, len;
+    chunk_t *c;
+    int err = 0;
+
+    for (i = 0; i < job->num_chunks && !err; i++)
+    {
+        c = &job->chunks[i];
+        pthread_mutex_lock(&job->lock);
+        while (!c->done && !job->failed)
+            pthread_cond_wait(&job->cond, &job->lock);
+        err = job->failed ? -1 : 0;
+        pthread_mutex_unlock(&job->lock);
+        if (err)
+            break;
+
+        start = i * job->chunk_size;
+        len = job->size - start < job->chunk_size ? job->size - start : job->chunk_size;
+        err = write_stream(out, c->out);
+        *crc = crc32_combine(*crc, c->crc, len);
+        bitstream_free(c->out);
+        c->out = nullptr;
+
+        pthread_mutex_lock(&job->lock);
+        job->written++;
+        if (err)
+            job->failed = true;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    return err;
+}
+
+int parallel_gzip_compress(FILE *out, const uint8_t *data, const size_t size, const parallel_options_t *opts)
+{
+    size_t i, threads = opts->threads;
+    size_t started = 0;
+    uint32_t crc = CRC32_INIT;
+    pthread_t *tids;
+    bitstream_t *bs;
+    int err = -1;
+    job_t job = {
+        .data = data,
+        .size = size,
+        .level = opts->level,
+        .chunk_size = opts->chunk_size,
+    };
+
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+
+    if (job.chunk_size < PARALLEL_CHUNK_MIN)
+        job.chunk_size = PARALLEL_CHUNK_MIN;
+    if (job.chunk_size > PARALLEL_CHUNK_MAX)
+        job.chunk_size = PARALLEL_CHUNK_MAX;
+
+    // Empty input still needs its final block
+    job.num_chunks = size ? (size + job.chunk_size - 1) / job.chunk_size : 1;
+    if (threads > job.num_chunks)
+        threads = job.num_chunks;
+    job.window = threads * CHUNKS_IN_FLIGHT;
+
+    job.chunks = calloc(job.num_chunks, sizeof(chunk_t));
+    tids = calloc(threads, sizeof(pthread_t));
+    bs = bitstream_new(GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE);
+    if (job.chunks == nullptr || tids == nullptr || bs == nullptr)
+        goto out;
+
+    pthread_mutex_init(&job.lock, nullptr);
+    pthread_cond_init(&job.cond, nullptr);
+    for (started = 0; started < threads; started++)
+        if (pthread_create(&tids[started], nullptr, worker, &job))
+            break;
+
+    if (started > 0 && gzip_write_header(bs, nullptr, opts->level) == 0 && write_stream(out, bs) == 0 &&
+        write_chunks(out, &job, &crc) == 0)
+    {
+        bitstream_clear(bs);
+        if (gzip_write_trailer(bs, crc, size) == 0 && write_stream(out, bs) == 0)
+            err = 0;
+    }
+
+    // Release any worker still waiting for the writer
+    pthread_mutex_lock(&job.lock);
+    if (err)
+        job.failed = true;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.lock);
+
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], nullptr);
+
+    for (i = 0; i < job.num_chunks; i++)
+        if (job.chunks[i].out != nullptr)
+            bitstream_free(job.chunks[i].out);
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+
+out:
+    if (bs != nullptr)
+        bitstream_free(bs);
+    free(tids);
+    free(job.chunks);
+    return err;
+}
+
+typedef struct
+{
+    char *path;
+    char *name;
+    zip_entry_t entry;    // method, crc, sizes, time and attributes once compressed
+    uint8_t *input;       // mapped input, kept while it is the stored data
+    size_t input_size;
+    bitstream_t *out;     // compressed data
+    FILE *spill;          // compressed data of a large entry, instead of out
+    uint8_t *spill_map;
+    bool done;
+} entry_job_t;
+
+struct parallel_zip_t
+{
+    zip_writer_t *zw;
+    cache_t *cache;
+    entry_job_t *queue; // ring of depth jobs
+    size_t depth;
+    size_t submitted;
+    size_t taken;   // jobs handed to workers
+    size_t written; // jobs passed to the writer
+    bool finishing;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t *tids;
+    size_t num_workers;
+    pthread_t writer;
+    bool writer_started;
+    bool finished;
+};
+
+static int sink_write(entry_job_t *job, const uint8_t *data, const size_t size)
+{
+    if (job->spill != nullptr)
+        return fwrite(data, sizeof(uint8_t), size, job->spill) == size ? 0 : -1;
+    return bitstream_write_bytes(job->out, data, size);
+}
+
+// Deflate the mapped input into the job's buffer or spill file
+static int deflate_entry(entry_job_t *job, deflate_stream_t *ds, uint8_t *buf)
+{
+    size_t pos = 0, used, n;
+    int ret;
+
+    if (job->input_size >= ENTRY_SPILL_SIZE)
+        job->spill = tmpfile();
+    else
+        job->out = bitstream_new(job->input_size / 2 + 64);
+    if (job->spill == nullptr && job->out == nullptr)
+        return -1;
+
+    deflate_stream_reset(ds);
+    while (pos < job->input_size)
+    {
+        if (deflate_stream_update(ds, job->input + pos, job->input_size - pos, &used, buf, ENTRY_BUFFER_SIZE, &n) ||
+            sink_write(job, buf, n))
+            return -1;
+        pos += used;
+        job->entry.csize += n;
+    }
+
+    do
+    {
+        ret = deflate_stream_finish(ds, buf, ENTRY_BUFFER_SIZE, &n);
+        if (ret < 0 || sink_write(job, buf, n))
+            return -1;
+        job->entry.csize += n;
+    } while (ret == 1);
+
+    if (job->spill != nullptr && job->entry.csize > 0)
+    {
+        if (fflush(job->spill))
+            return -1;
+        job->spill_map = mmap(nullptr, job->entry.csize, PROT_READ, MAP_PRIVATE, fileno(job->spill), 0);
+        if (job->spill_map == MAP_FAILED)
+        {
+            job->spill_map = nullptr;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void release_output(entry_job_t *job)
+{
+    if (job->out != nullptr)
+        bitstream_free(job->out);
+    if (job->spill_map != nullptr)
+        munmap(job->spill_map, job->entry.csize);
+    if (job->spill != nullptr)
+        fclose(job->spill);
+    job->out = nullptr;
+    job->spill_map = nullptr;
+    job->spill = nullptr;
+}
+
+// Stored entries are written from the input, others from wherever they were compressed to
+static const uint8_t *job_data(const entry_job_t *job)
+{
+    if (job->input != nullptr)
+        return job->input;
+    if (job->spill_map != nullptr)
+        return job->spill_map;
+    return job->out != nullptr ? job->out->stream : nullptr;
+}
+
+static int compress_entry(parallel_zip_t *pz, entry_job_t *job, deflate_stream_t *ds, uint8_t *buf)
+{
+    int fd, level, err = 0;
+    cache_key_t key = {0};
+    bool known = false;
+    struct stat st;
+
+    fd = open(job->path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st))
+    {
+        close(fd);
+        return -1;
+    }
+
+    zip_entry_stamp(&job->entry, st.st_mtime, st.st_mode, S_ISDIR(st.st_mode));
+    job->entry.name_len = (uint16_t)strlen(job->name);
+    job->entry.method = ZIP_METHOD_STORE;
+
+    // A file the cache knows by path, size and time is only read if it was stored. Cached
+    // compressed data is mapped, and handed to the writer like that of a spilled entry
+    if (pz->cache != nullptr && S_ISREG(st.st_mode) && st.st_size > 0)
+        known = cache_find(pz->cache, job->path, &st, pz->zw->level, pz->zw->choose, &job->entry,
+                           &job->spill_map) == 0;
+    if (known && job->entry.method != ZIP_METHOD_STORE)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        job->input_size = (size_t)st.st_size;
+        job->input = mmap(nullptr, job->input_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (job->input == MAP_FAILED)
+            job->input = nullptr;
+    }
+    close(fd);
+    if (job->input_size > 0 && job->input == nullptr)
+        return -1;
+    if (known)
+        return 0;
+
+    job->entry.crc = crc32(CRC32_INIT, job->input, job->input_size);
+    job->entry.size = job->input_size;
+
+    if (pz->cache != nullptr && job->input_size > 0)
+    {
+        key = (cache_key_t){job->input_size, cache_hash(job->input, job->input_size), job->entry.crc, pz->zw->level,
+                            pz->zw->choose};
+        if (cache_find_content(pz->cache, job->path, &st, &key, &job->entry, &job->spill_map) == 0)
+        {
+            if (job->entry.method != ZIP_METHOD_STORE)
+            {
+                munmap(job->input, job->input_size);
+                job->input = nullptr;
+            }
+            return 0;
+        }
+    }
+
+    level = pz->zw->level;
+    if (pz->zw->choose)
+        level = zip_choose_level(job->name, job->input, job->input_size, level);
+    if (level > 0 && job->input_size > 0)
+    {
+        job->entry.method = ZIP_METHOD_DEFLATE;
+        deflate_stream_set_level(ds, level);
+        err = deflate_entry(job, ds, buf);
+    }
+
+    // Data that did not shrink is stored from the mapping instead
+    if (err == 0 && job->entry.method == ZIP_METHOD_DEFLATE && job->entry.csize < job->input_size)
+    {
+        munmap(job->input, job->input_size);
+        job->input = nullptr;
+    }
+    else
+    {
+        release_output(job);
+        job->entry.method = ZIP_METHOD_STORE;
+        job->entry.csize = job->input_size;
+    }
+
+    // The cache is only an aid, failing to keep an entry in it fails nothing
+    if (err == 0 && pz->cache != nullptr && job->input_size > 0)
+        cache_add(pz->cache, job->path, &st, &key, &job->entry, job_data(job));
+    return err;
+}
+
+static void release_job(entry_job_t *job)
+{
+    release_output(job);
+    if (job->input != nullptr)
+        munmap(job->input, job->input_size);
+    free(job->path);
+    free(job->name);
+    *job = (entry_job_t){0};
+}
+
+static void *zip_worker(void *arg)
+{
+    parallel_zip_t *pz = arg;
+    deflate_stream_t *ds = pz->zw->level > 0 ? deflate_stream_new(pz->zw->level) : nullptr;
+    uint8_t *buf = malloc(ENTRY_BUFFER_SIZE);
+    entry_job_t *job;
+    int err;
+
+    pthread_mutex_lock(&pz->lock);
+    if (buf == nullptr || (pz->zw->level > 0 && ds == nullptr))
+        pz->failed = true;
+
+    for (;;)
+    {
+        while (!pz->failed && !pz->finishing && pz->taken == pz->submitted)
+            pthread_cond_wait(&pz->cond, &pz->lock);
+        if (pz->failed || pz->taken == pz->submitted)
+            break;
+
+        job = &pz->queue[pz->taken++ % pz->depth];
+        pthread_mutex_unlock(&pz->lock);
+
+        err = compress_entry(pz, job, ds, buf);
+
+        pthread_mutex_lock(&pz->lock);
+        job->done = true;
+        if (err)
+            pz->failed = true;
+        pthread_cond_broadcast(&pz->cond);
+    }
+
+    pthread_cond_broadcast(&pz->cond);
+    pthread_mutex_unlock(&pz->lock);
+    deflate_stream_free(ds);
+    free(buf);
+    return nullptr;
+}
+
+// Write entries in submission order as workers finish them
+static void *zip_writer(void *arg)
+{
+    parallel_zip_t *pz = arg;
+    entry_job_t *job;
+    int err;
+
+    pthread_mutex_lock(&pz->lock);
+    for (;;)
+    {
+        while (!pz->failed && !pz->finishing && pz->written == pz->submitted)
+            pthread_cond_wait(&pz->cond, &pz->lock);
+        if (pz->failed || pz->written == pz->submitted)
+            break;
+
+        job = &pz->queue[pz->written % pz->depth];
+        while (!pz->failed && !job->done)
+            pthread_cond_wait(&pz->cond, &pz->lock);
+        if (pz->failed)
+            break;
+        pthread_mutex_unlock(&pz->lock);
+
+        err = zip_writer_add_raw(pz->zw, &job->entry, job->name, job_data(job));
+        release_job(job);
+
+        pthread_mutex_lock(&pz->lock);
+        pz->written++;
+        if (err)
+            pz->failed = true;
+        pthread_cond_broadcast(&pz->cond);
+    }
+
+    pthread_cond_broadcast(&pz->cond);
+    pthread_mutex_unlock(&pz->lock);
+    return nullptr;
+}
+
+parallel_zip_t *parallel_zip_new(zip_writer_t *zw, const parallel_options_t *opts)
+{
+    size_t threads = opts ? opts->threads : 0;
+    parallel_zip_t *pz;
+
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+
+    pz = calloc(1, sizeof(parallel_zip_t));
+    if (pz == nullptr)
+        return nullptr;
+
+    pz->zw = zw;
+    pz->cache = opts ? opts->cache : nullptr;
+    pz->depth = threads * ENTRIES_IN_FLIGHT;
+    pz->queue = calloc(pz->depth, sizeof(entry_job_t));
+    pz->tids = calloc(threads, sizeof(pthread_t));
+    if (pz->queue == nullptr || pz->tids == nullptr)
+    {
+        free(pz->queue);
+        free(pz->tids);
+        free(pz);
+        return nullptr;
+    }
+
+    pthread_mutex_init(&pz->lock, nullptr);
+    pthread_cond_init(&pz->cond, nullptr);
+    pz->writer_started = pthread_create(&pz->writer, nullptr, zip_writer, pz) == 0;
+    for (pz->num_workers = 0; pz->writer_started && pz->num_workers < threads; pz->num_workers++)
+        if (pthread_create(&pz->tids[pz->num_workers], nullptr, zip_worker, pz))
+            break;
+
+    if (pz->num_workers == 0)
+    {
+        parallel_zip_free(pz);
+        return nullptr;
+    }
+
+    return pz;
+}
+
+int parallel_zip_add(parallel_zip_t *pz, const char *path, const char *name)
+{
+    char *p = strdup(path), *n = strdup(name);
+    entry_job_t *job;
+
+    pthread_mutex_lock(&pz->lock);
+    while (!pz->failed && pz->submitted - pz->written == pz->depth)
+        pthread_cond_wait(&pz->cond, &pz->lock);
+
+    if (pz->failed || pz->finishing || p == nullptr || n == nullptr || strlen(name) > ZIP_NAME_MAX)
+    {
+        pthread_mutex_unlock(&pz->lock);
+        free(p);
+        free(n);
+        return -1;
+    }
+
+    job = &pz->queue[pz->submitted++ % pz->depth];
+    job->path = p;
+    job->name = n;
+    pthread_cond_broadcast(&pz->cond);
+    pthread_mutex_unlock(&pz->lock);
+    return 0;
+}
+
+int parallel_zip_finish(parallel_zip_t *pz)
+{
+    size_t i;
+
+    if (!pz->finished)
+    {
+        pthread_mutex_lock(&pz->lock);
+        pz->finishing = true;
+        pthread_cond_broadcast(&pz->cond);
+        pthread_mutex_unlock(&pz->lock);
+
+        for (i = 0; i < pz->num_workers; i++)
+            pthread_join(pz->tids[i], nullptr);
+        if (pz->writer_started)
+            pthread_join(pz->writer, nullptr);
+        pz->finished = true;
+    }
+
+    return pz->failed || pz->written != pz->submitted ? -1 : 0;
+}
+
+void parallel_zip_free(parallel_zip_t *pz)
+{
+    size_t i;
+
+    if (pz == nullptr)
+        return;
+
+    parallel_zip_finish(pz);
+    for (i = 0; i < pz->depth; i++)
+        release_job(&pz->queue[i]);
+
+    pthread_cond_destroy(&pz->cond);
+    pthread_mutex_destroy(&pz->lock);
+    free(pz->queue);
+    free(pz->tids);
+    free(pz);
+}
+
+typedef struct
+{
+    uint64_t size;
+    size_t index;
+} unzip_order_t;
+
+typedef struct
+{
+    const unzip_t *uz;
+    const char *dest;
+    unzip_order_t *order; // entries largest first
+    atomic_size_t next;   // next entry in order to hand out
+    atomic_bool failed;
+    bool *failed_entries;
+} unzip_job_t;
+
+static int larger_first(const void *a, const void *b)
+{
+    const unzip_order_t *x = a, *y = b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : x->index > y->index ? 1 : -1;
+}
+
+// Names must stay inside the destination: relative, without ".." components
+static bool safe_name(const char *name, const size_t len)
+{
+    size_t i, start = 0;
+
+    if (len == 0 || name[0] == '/' || memchr(name, '\0', len) != nullptr)
+        return false;
+
+    for (i = 0; i <= len; i++)
+    {
+        if (i == len || name[i] == '/')
+        {
+            if (i - start == 2 && name[start] == '.' && name[start + 1] == '.')
+                return false;
+            start = i + 1;
+        }
+    }
+
+    return true;
+}
+
+// Create the directories leading to path. Each thread remembers the last ones it made,
+// which entries in archive order mostly share
+static int make_parents(char *path, char *last)
+{
+    char *slash = strrchr(path, '/'), *p;
+    size_t len;
+
+    if (slash == nullptr)
+        return 0;
+
+    len = (size_t)(slash - path);
+    if (strlen(last) == len && memcmp(last, path, len) == 0)
+        return 0;
+
+    for (p = path + 1; p <= slash; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(path, MODE_DIR) && errno != EEXIST)
+        {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+
+    memcpy(last, path, len);
+    last[len] = '\0';
+    return 0;
+}
+
+// Decode straight into a mapping of the output file
+static int extract_entry(const unzip_job_t *job, const size_t index, char *last)
+{
+    const zip_entry_t *e = &job->uz->entries[index];
+    uint32_t mode = e->attr >> 16 & 0777;
+    char path[PATH_SIZE];
+    uint8_t *map;
+    int fd, ret = -1;
+
+    if (!safe_name(unzip_name(job->uz, index), e->name_len) ||
+        (size_t)snprintf(path, sizeof(path), "%s/%.*s", job->dest, (int)e->name_len, unzip_name(job->uz, index)) >=
+            sizeof(path) ||
+        make_parents(path, last))
+        return -1;
+
+    // Directories end in '/', so make_parents has created them
+    if (path[strlen(path) - 1] == '/')
+        return 0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, mode ? mode : MODE_FILE);
+    if (fd < 0)
+        return -1;
+
+    if (e->size == 0)
+        ret = unzip_verify(job->uz, index);
+    else if (ftruncate(fd, (off_t)e->size) == 0)
+    {
+        map = mmap(nullptr, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            ret = unzip_extract(job->uz, index, map, e->size);
+            munmap(map, e->size);
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+static void *unzip_worker(void *arg)
+{
+    unzip_job_t *job = arg;
+    char last[PATH_SIZE] = "";
+    size_t i, index;
+    int err;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->uz->num_entries)
+    {
+        index = job->order[i].index;
+        err = job->dest ? extract_entry(job, index, last) : unzip_verify(job->uz, index);
+        if (err)
+        {
+            atomic_store(&job->failed, true);
+            if (job->failed_entries != nullptr)
+                job->failed_entries[index] = true;
+        }
+    }
+
+    return nullptr;
+}
+
+int parallel_unzip(const unzip_t *uz, const char *dest, const parallel_options_t *opts, bool *failed)
+{
+    size_t i, started, threads = opts ? opts->threads : 0;
+    pthread_t *tids;
+    unzip_job_t job = {
+        .uz = uz,
+        .dest = dest,
+        .failed_entries = failed,
+    };
+
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+    if (threads > uz->num_entries)
+        threads = uz->num_entries ? uz->num_entries : 1;
+
+    job.order = malloc((uz->num_entries ? uz->num_entries : 1) * sizeof(unzip_order_t));
+    tids = calloc(threads, sizeof(pthread_t));
+    if (job.order == nullptr || tids == nullptr || (dest != nullptr && mkdir(dest, MODE_DIR) && errno != EEXIST))
+    {
+        free(job.order);
+        free(tids);
+        return -1;
+    }
+
+    for (i = 0; i < uz->num_entries; i++)
+        job.order[i] = (unzip_order_t){uz->entries[i].size, i};
+    qsort(job.order, uz->num_entries, sizeof(unzip_order_t), larger_first);
+
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+    for (started = 0; started < threads; started++)
+        if (pthread_create(&tids[started], nullptr, unzip_worker, &job))
+            break;
+
+    // Without any thread the caller does the work
+    if (started == 0)
+        unzip_worker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], nullptr);
+
+    free(job.order);
+    free(tids);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+typedef struct
+{
+    int fd;
+    uint8_t *ring;
+    uint64_t head; // bytes read
+    uint64_t tail; // bytes taken by the extractor
+    bool eof;
+    bool error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} read_ahead_t;
+
+static void *ahead_reader(void *arg)
+{
+    read_ahead_t *ra = arg;
+    size_t pos, n;
+    ssize_t r;
+
+    pthread_mutex_lock(&ra->lock);
+    for (;;)
+    {
+        while (ra->head - ra->tail == STREAM_AHEAD_SIZE)
+            pthread_cond_wait(&ra->cond, &ra->lock);
+
+        pos = ra->head % STREAM_AHEAD_SIZE;
+        n = STREAM_AHEAD_SIZE - (size_t)(ra->head - ra->tail);
+        if (n > STREAM_AHEAD_SIZE - pos)
+            n = STREAM_AHEAD_SIZE - pos;
+        if (n > STREAM_READ_SIZE)
+            n = STREAM_READ_SIZE;
+        pthread_mutex_unlock(&ra->lock);
+
+        do
+            r = read(ra->fd, ra->ring + pos, n);
+        while (r < 0 && errno == EINTR);
+
+        pthread_mutex_lock(&ra->lock);
+        if (r <= 0)
+        {
+            ra->eof = true;
+            ra->error = r < 0;
+            pthread_cond_broadcast(&ra->cond);
+            break;
+        }
+        ra->head += (uint64_t)r;
+        pthread_cond_broadcast(&ra->cond);
+    }
+
+    pthread_mutex_unlock(&ra->lock);
+    return nullptr;
+}
+
+// Wait for input ahead. Returns the bytes available in one piece, 0 at the end of the input
+static size_t ahead_wait(read_ahead_t *ra, const uint8_t **p)
+{
+    size_t n, pos = ra->tail % STREAM_AHEAD_SIZE;
+
+    pthread_mutex_lock(&ra->lock);
+    while (ra->head == ra->tail && !ra->eof)
+        pthread_cond_wait(&ra->cond, &ra->lock);
+    n = (size_t)(ra->head - ra->tail);
+    pthread_mutex_unlock(&ra->lock);
+
+    *p = ra->ring + pos;
+    return n < STREAM_AHEAD_SIZE - pos ? n : STREAM_AHEAD_SIZE - pos;
+}
+
+static void ahead_take(read_ahead_t *ra, const size_t n)
+{
+    pthread_mutex_lock(&ra->lock);
+    ra->tail += n;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+// Copy the next size bytes without taking them
+static int ahead_peek(read_ahead_t *ra, uint8_t *dst, const size_t size)
+{
+    size_t n, pos = ra->tail % STREAM_AHEAD_SIZE;
+    bool ready;
+
+    pthread_mutex_lock(&ra->lock);
+    while (ra->head - ra->tail < size && !ra->eof)
+        pthread_cond_wait(&ra->cond, &ra->lock);
+    ready = ra->head - ra->tail >= size;
+    pthread_mutex_unlock(&ra->lock);
+    if (!ready)
+        return -1;
+
+    n = STREAM_AHEAD_SIZE - pos < size ? STREAM_AHEAD_SIZE - pos : size;
+    memcpy(dst, ra->ring + pos, n);
+    memcpy(dst + n, ra->ring, size - n);
+    return 0;
+}
+
+static int ahead_read(read_ahead_t *ra, uint8_t *dst, size_t size)
+{
+    const uint8_t *p;
+    size_t n;
+
+    while (size > 0)
+    {
+        n = ahead_wait(ra, &p);
+        if (n == 0)
+            return -1;
+        if (n > size)
+            n = size;
+        memcpy(dst, p, n);
+        ahead_take(ra, n);
+        dst += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+typedef struct
+{
+    read_ahead_t ra;
+    const char *dest;
+    zip_entry_t entry;
+    char *name; // ZIP_NAME_MAX bytes and a terminator
+    bool zip64; // the local header has a ZIP64 extra field
+    int out;    // file being extracted to, -1 if none
+    uint8_t *buf;
+    inflate_stream_t *inflate;
+    char last[PATH_SIZE]; // directory made last
+} unzip_stream_t;
+
+// Read a local header, name and extra field. Sizes all ones are in the ZIP64 extra field
+static int stream_header(unzip_stream_t *us, const uint8_t *hdr)
+{
+    uint8_t extra[UINT16_MAX];
+    size_t extra_len = get_le16(hdr + 28), i;
+
+    us->entry = (zip_entry_t){
+        .flags = get_le16(hdr + 6),
+        .method = get_le16(hdr + 8),
+        .crc = get_le32(hdr + 14),
+        .csize = get_le32(hdr + 18),
+        .size = get_le32(hdr + 22),
+        .name_len = get_le16(hdr + 26),
+    };
+    us->zip64 = false;
+    if (ahead_read(&us->ra, (uint8_t *)us->name, us->entry.name_len) || ahead_read(&us->ra, extra, extra_len))
+        return -1;
+    us->name[us->entry.name_len] = '\0';
+
+    for (i = 0; i + 4 <= extra_len; i += 4 + get_le16(extra + i + 2))
+    {
+        if (get_le16(extra + i) == ZIP64_EXTRA_ID && get_le16(extra + i + 2) >= 16 && i + 20 <= extra_len)
+        {
+            us->zip64 = true;
+            if (us->entry.size == ZIP_OFFSET_MAX)
+                us->entry.size = get_le64(extra + i + 4);
+            if (us->entry.csize == ZIP_OFFSET_MAX)
+                us->entry.csize = get_le64(extra + i + 12);
+        }
+    }
+
+    return 0;
+}
+
+static int stream_output(unzip_stream_t *us, const uint8_t *data, size_t size, uint32_t *crc)
+{
+    ssize_t n;
+
+    *crc = crc32(*crc, data, size);
+    while (us->out >= 0 && size > 0)
+    {
+        n = write(us->out, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        size -= (size_t)n;
+    }
+
+    return 0;
+}
+
+// Whether a descriptor of the data so far is next: its signature, crc and sizes, 64 bit ones
+// under the same condition as stream_descriptor
+static bool stream_at_descriptor(unzip_stream_t *us, const uint32_t crc, const uint64_t csize)
+{
+    uint8_t desc[ZIP64_DESCRIPTOR_SIZE];
+
+    if (ahead_peek(&us->ra, desc, ZIP_DESCRIPTOR_SIZE) || get_le32(desc) != ZIP_DESCRIPTOR_SIG ||
+        get_le32(desc + 4) != crc)
+        return false;
+    if (!us->zip64 && csize < ZIP_OFFSET_MAX)
+        return get_le32(desc + 8) == csize && get_le32(desc + 12) == csize;
+    return ahead_peek(&us->ra, desc, ZIP64_DESCRIPTOR_SIZE) == 0 && get_le64(desc + 8) == csize &&
+           get_le64(desc + 16) == csize;
+}
+
+// Pass stored data of unknown size to the output up to the first descriptor that matches it,
+// left to stream_descriptor. Returns -1 if the input ends first, 1 if the output failed
+static int stream_scan(unzip_stream_t *us, uint32_t *crc, uint64_t *csize)
+{
+    const uint8_t *p, *sig;
+    size_t n;
+    int err = 0;
+
+    for (;;)
+    {
+        n = ahead_wait(&us->ra, &p);
+        if (n == 0)
+            return -1;
+
+        // Data goes out up to the next byte that may start a signature
+        sig = memchr(p, ZIP_DESCRIPTOR_SIG & 0xff, n);
+        if (sig == p)
+        {
+            if (stream_at_descriptor(us, *crc, *csize))
+                return err;
+            n = 1;
+        }
+        else if (sig != nullptr)
+            n = (size_t)(sig - p);
+
+        err |= stream_output(us, p, n, crc);
+        ahead_take(&us->ra, n);
+        *csize += n;
+    }
+}
+
+// Pass an entry's data to its output. Deflated data is decoded up to its end of stream
+// whatever the header says, as sizes of entries with a data descriptor come after it.
+// Returns -1 if the end of the data cannot be found, so neither can the next entry,
+// 1 if the entry cannot be extracted but the stream goes on after it
+static int stream_data(unzip_stream_t *us, uint32_t *crc, uint64_t *csize, uint64_t *size)
+{
+    size_t n, used, produced;
+    const uint8_t *p;
+    int ret = 0, err = 0;
+
+    *crc = CRC32_INIT;
+    *csize = *size = 0;
+
+    // Stored data whose sizes follow it has no end marker, it is scanned for its descriptor
+    if (us->entry.method == ZIP_METHOD_STORE && (us->entry.flags & ZIP_FLAG_DESCRIPTOR) && us->entry.csize == 0)
+    {
+        err = stream_scan(us, crc, csize);
+        *size = *csize;
+        return err;
+    }
+
+    // Data of an unsupported method is skipped when its size is known
+    if (us->entry.method != ZIP_METHOD_DEFLATE)
+    {
+        if (us->entry.method != ZIP_METHOD_STORE && (us->entry.flags & ZIP_FLAG_DESCRIPTOR))
+            return -1;
+
+        while (*csize < us->entry.csize)
+        {
+            n = ahead_wait(&us->ra, &p);
+            if (n == 0)
+                return -1;
+            if (n > us->entry.csize - *csize)
+                n = (size_t)(us->entry.csize - *csize);
+            if (us->entry.method == ZIP_METHOD_STORE)
+                err |= stream_output(us, p, n, crc);
+            ahead_take(&us->ra, n);
+            *csize += n;
+        }
+
+        *size = *csize;
+        return err || us->entry.method != ZIP_METHOD_STORE ? 1 : 0;
+    }
+
+    if (us->inflate == nullptr)
+        us->inflate = inflate_stream_new(nullptr);
+    else
+        memset(us->inflate, 0, sizeof(inflate_stream_t));
+    if (us->inflate == nullptr)
+        return -1;
+
+    while (ret == 0)
+    {
+        n = ahead_wait(&us->ra, &p);
+        ret = inflate_stream_update(us->inflate, p, n, &used, us->buf, STREAM_OUT_SIZE, &produced);
+        ahead_take(&us->ra, used);
+        *csize += used;
+        *size += produced;
+        err |= stream_output(us, us->buf, produced, crc);
+
+        // Input at its end with the stream unfinished
+        if (ret == 0 && n == 0 && produced == 0)
+            ret = -1;
+    }
+
+    return ret < 0 ? -1 : err ? 1 : 0;
+}
+
+// Read the data descriptor into the entry. Its signature is optional, and its sizes are 64 bits
+// for entries with a ZIP64 extra field or too large for 32 bits
+static int stream_descriptor(unzip_stream_t *us, const uint64_t csize, const uint64_t size)
+{
+    uint8_t desc[ZIP64_DESCRIPTOR_SIZE];
+    bool zip64 = us->zip64 || csize >= ZIP_OFFSET_MAX || size >= ZIP_OFFSET_MAX;
+
+    if (ahead_read(&us->ra, desc, 4))
+        return -1;
+    if (get_le32(desc) == ZIP_DESCRIPTOR_SIG && ahead_read(&us->ra, desc, 4))
+        return -1;
+    if (ahead_read(&us->ra, desc + 4, zip64 ? 16 : 8))
+        return -1;
+
+    us->entry.crc = get_le32(desc);
+    us->entry.csize = zip64 ? get_le64(desc + 4) : get_le32(desc + 4);
+    us->entry.size = zip64 ? get_le64(desc + 12) : get_le32(desc + 8);
+    return 0;
+}
+
+// Open the file an entry is extracted to, making its directories. Directories need nothing more
+static int stream_open(unzip_stream_t *us)
+{
+    char path[PATH_SIZE];
+    size_t len = us->entry.name_len;
+
+    us->out = -1;
+    if (us->dest == nullptr)
+        return 0;
+    if (!safe_name(us->name, len) ||
+        (size_t)snprintf(path, sizeof(path), "%s/%s", us->dest, us->name) >= sizeof(path) ||
+        make_parents(path, us->last))
+        return -1;
+    if (us->name[len - 1] == '/')
+        return 0;
+
+    us->out = open(path, O_WRONLY | O_CREAT | O_TRUNC, MODE_FILE);
+    return us->out < 0 ? -1 : 0;
+}
+
+int parallel_unzip_stream(const int fd, const char *dest, void (*failed)(const char *name, void *arg), void *arg)
+{
+    uint8_t hdr[ZIP_LOCAL_SIZE];
+    uint64_t csize, size;
+    const uint8_t *p;
+    pthread_t reader;
+    uint32_t crc;
+    size_t n;
+    int err, ret = -1;
+    bool ok, any_failed = false;
+    unzip_stream_t us = {
+        .ra = {.fd = fd},
+        .dest = dest,
+        .out = -1,
+    };
+
+    us.ra.ring = malloc(STREAM_AHEAD_SIZE);
+    us.name = malloc(ZIP_NAME_MAX + 1);
+    us.buf = malloc(STREAM_OUT_SIZE);
+    if (us.ra.ring == nullptr || us.name == nullptr || us.buf == nullptr ||
+        (dest != nullptr && mkdir(dest, MODE_DIR) && errno != EEXIST))
+        goto out;
+
+    pthread_mutex_init(&us.ra.lock, nullptr);
+    pthread_cond_init(&us.ra.cond, nullptr);
+    if (pthread_create(&reader, nullptr, ahead_reader, &us.ra))
+        goto out_sync;
+
+    // Entries follow each other up to the first record that is not a local header: the
+    // central directory, or a name index before it. Only the local headers are read
+    for (;;)
+    {
+        if (ahead_read(&us.ra, hdr, 4))
+            break;
+        if (get_le32(hdr) != ZIP_LOCAL_SIG)
+        {
+            ret = 0;
+            break;
+        }
+        if (ahead_read(&us.ra, hdr + 4, ZIP_LOCAL_SIZE - 4) || stream_header(&us, hdr))
+            break;
+
+        ok = stream_open(&us) == 0;
+        err = stream_data(&us, &crc, &csize, &size);
+        if (err >= 0 && (us.entry.flags & ZIP_FLAG_DESCRIPTOR) && stream_descriptor(&us, csize, size))
+            err = -1;
+        if (us.out >= 0 && close(us.out))
+            ok = false;
+        ok = ok && err == 0 && crc == us.entry.crc && csize == us.entry.csize && size == us.entry.size;
+
+        if (!ok)
+        {
+            any_failed = true;
+            if (failed != nullptr)
+                failed(us.name, arg);
+        }
+        // The end of the entry cannot be found, so neither can the next one
+        if (err < 0)
+            break;
+    }
+
+    // Read to the end, so whatever writes the archive is not cut off
+    while ((n = ahead_wait(&us.ra, &p)) > 0)
+        ahead_take(&us.ra, n);
+    pthread_join(reader, nullptr);
+    if (us.ra.error || any_failed)
+        ret = -1;
+
+out_sync:
+    pthread_cond_destroy(&us.ra.cond);
+    pthread_mutex_destroy(&us.ra.lock);
+out:
+    inflate_stream_free(us.inflate);
+    free(us.buf);
+    free(us.name);
+    free(us.ra.ring);
+    return ret;
+}
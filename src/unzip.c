@@ -0,0 +1,405 @@
+#include "unzip.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "inflate.h"
+
+#define UNZIP_COMMENT_MAX UINT16_MAX
+#define UNZIP_VERIFY_BUFFER (16 * 1024)
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+// The EOCD record is last but for a comment of up to 64 KiB, so search back for its signature
+static const uint8_t *find_eocd(const uint8_t *map, const size_t size)
+{
+    size_t pos, stop;
+
+    if (size < ZIP_EOCD_SIZE)
+        return nullptr;
+
+    stop = size - ZIP_EOCD_SIZE > UNZIP_COMMENT_MAX ? size - ZIP_EOCD_SIZE - UNZIP_COMMENT_MAX : 0;
+    for (pos = size - ZIP_EOCD_SIZE + 1; pos-- > stop;)
+    {
+        if (get_le32(map + pos) == ZIP_EOCD_SIG && pos + ZIP_EOCD_SIZE + get_le16(map + pos + 20) <= size)
+            return map + pos;
+    }
+
+    return nullptr;
+}
+
+// A ZIP64 EOCD record, found through the locator right before the EOCD record,
+// holds the entry count and central directory position in full
+static int read_zip64_eocd(unzip_t *uz, const uint8_t *eocd, uint64_t *num_entries)
+{
+    const uint8_t *loc = eocd - ZIP64_LOCATOR_SIZE, *rec;
+    uint64_t offset;
+
+    if ((size_t)(eocd - uz->map) < ZIP64_LOCATOR_SIZE || get_le32(loc) != ZIP64_LOCATOR_SIG)
+        return 0;
+
+    offset = get_le64(loc + 8);
+    if (offset > (uint64_t)(loc - uz->map) || (uint64_t)(loc - uz->map) - offset < ZIP64_EOCD_SIZE)
+        return -1;
+
+    rec = uz->map + offset;
+    if (get_le32(rec) != ZIP64_EOCD_SIG)
+        return -1;
+
+    *num_entries = get_le64(rec + 32);
+    uz->cd_size = get_le64(rec + 40);
+    uz->cd_offset = get_le64(rec + 48);
+    return 0;
+}
+
+// Sizes and offset that are all ones in the record follow in the ZIP64 extra field, in this order
+static int read_zip64_extra(zip_entry_t *e, const uint8_t *p, size_t len)
+{
+    uint64_t *fields[] = {&e->size, &e->csize, &e->offset};
+    const uint8_t *q;
+    size_t id, n, i;
+
+    if (e->size < ZIP_OFFSET_MAX && e->csize < ZIP_OFFSET_MAX && e->offset < ZIP_OFFSET_MAX)
+        return 0;
+
+    for (; len >= 4; p += 4 + n, len -= 4 + n)
+    {
+        id = get_le16(p);
+        n = get_le16(p + 2);
+        if (n > len - 4)
+            return -1;
+        if (id != ZIP64_EXTRA_ID)
+            continue;
+
+        for (i = 0, q = p + 4; i < sizeof(fields) / sizeof(*fields); i++)
+        {
+            if (*fields[i] < ZIP_OFFSET_MAX)
+                continue;
+            if (q + 8 > p + 4 + n)
+                return -1;
+            *fields[i] = get_le64(q);
+            q += 8;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+static int read_central(unzip_t *uz)
+{
+    const uint8_t *eocd = find_eocd(uz->map, uz->map_size), *p, *end;
+    uint64_t num_entries;
+    zip_entry_t *e;
+    size_t i, skip;
+
+    if (eocd == nullptr)
+        return -1;
+
+    num_entries = get_le16(eocd + 10);
+    uz->cd_size = get_le32(eocd + 12);
+    uz->cd_offset = get_le32(eocd + 16);
+    if (read_zip64_eocd(uz, eocd, &num_entries) || uz->cd_offset > uz->map_size ||
+        uz->cd_size > uz->map_size - uz->cd_offset || num_entries > uz->cd_size / ZIP_CENTRAL_SIZE)
+        return -1;
+
+    uz->entries = malloc((num_entries ? num_entries : 1) * sizeof(zip_entry_t));
+    if (uz->entries == nullptr)
+        return -1;
+
+    p = uz->map + uz->cd_offset;
+    end = p + uz->cd_size;
+    for (i = 0; i < num_entries; i++)
+    {
+        if ((size_t)(end - p) < ZIP_CENTRAL_SIZE || get_le32(p) != ZIP_CENTRAL_SIG)
+            return -1;
+
+        e = &uz->entries[i];
+        *e = (zip_entry_t){
+            .flags = get_le16(p + 8),
+            .method = get_le16(p + 10),
+            .dos_time = get_le32(p + 12),
+            .crc = get_le32(p + 16),
+            .csize = get_le32(p + 20),
+            .size = get_le32(p + 24),
+            .name_len = get_le16(p + 28),
+            .attr = get_le32(p + 38),
+            .offset = get_le32(p + 42),
+            .name_pos = (uint64_t)(p + ZIP_CENTRAL_SIZE - uz->map),
+        };
+
+        // Name, extra field and comment
+        skip = (size_t)e->name_len + get_le16(p + 30) + get_le16(p + 32);
+        if ((size_t)(end - p) - ZIP_CENTRAL_SIZE < skip ||
+            read_zip64_extra(e, p + ZIP_CENTRAL_SIZE + e->name_len, get_le16(p + 30)))
+            return -1;
+        p += ZIP_CENTRAL_SIZE + skip;
+    }
+
+    uz->num_entries = num_entries;
+    return 0;
+}
+
+// Check the slots of a stored index once, so that lookups can trust a miss: every entry
+// is in exactly one slot, under the hash of its name, and its probe reaches it without
+// crossing a free slot
+static bool index_valid(const unzip_t *uz, const zip_index_slot_t *slots, const size_t num_slots)
+{
+    size_t i, s, run, found = 0, mask = num_slots - 1;
+    const zip_index_slot_t *slot;
+    bool *seen, ok = true;
+
+    // Walk the slots from just after a free one, so that every run of occupied slots is seen whole
+    for (s = 0; s < num_slots && slots[s].index != ZIP_INDEX_EMPTY; s++)
+        ;
+    if (s == num_slots)
+        return false;
+
+    seen = calloc(uz->num_entries + 1, sizeof(bool));
+    if (seen == nullptr)
+        return false;
+
+    for (i = 1, run = 0; ok && i <= num_slots; i++)
+    {
+        slot = &slots[(s + i) & mask];
+        if (slot->index == ZIP_INDEX_EMPTY)
+        {
+            run = 0;
+            continue;
+        }
+
+        // The probe starts at the home slot, at most run - 1 slots back
+        ok = slot->index < uz->num_entries && !seen[slot->index] && ((s + i - slot->hash) & mask) < ++run &&
+             slot->hash == zip_index_hash(unzip_name(uz, slot->index), uz->entries[slot->index].name_len);
+        if (ok)
+        {
+            seen[slot->index] = true;
+            found++;
+        }
+    }
+
+    free(seen);
+    return ok && found == uz->num_entries;
+}
+
+// Use the name index written before the central directory if it matches the entries.
+// Its slots are used in place where they are aligned and the host is little endian;
+// otherwise, or if they fail index_valid, the index is built on the first lookup
+static void map_index(unzip_t *uz)
+{
+    const zip_index_slot_t *slots;
+    const uint8_t *trailer;
+    size_t num_slots;
+
+    if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ || uz->cd_offset < ZIP_INDEX_TRAILER_SIZE)
+        return;
+
+    trailer = uz->map + uz->cd_offset - ZIP_INDEX_TRAILER_SIZE;
+    num_slots = get_le32(trailer + 4);
+    if (get_le32(trailer) != ZIP_INDEX_SIG || num_slots != zip_index_slots(uz->num_entries) ||
+        (get_le32(trailer + 8) | (uint64_t)get_le32(trailer + 12) << 32) != uz->num_entries ||
+        (uz->cd_offset - ZIP_INDEX_TRAILER_SIZE) / sizeof(zip_index_slot_t) < num_slots ||
+        (uz->cd_offset - ZIP_INDEX_TRAILER_SIZE) % ZIP_INDEX_ALIGN != 0)
+        return;
+
+    slots = (const zip_index_slot_t *)(trailer - num_slots * sizeof(zip_index_slot_t));
+    if (!index_valid(uz, slots, num_slots))
+        return;
+
+    uz->slots = slots;
+    uz->num_slots = num_slots;
+    uz->slots_mapped = true;
+}
+
+unzip_t *unzip_open(const char *path)
+{
+    unzip_t *uz;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    // The mapping outlives the descriptor
+    if (fstat(fd, &st) || st.st_size == 0 ||
+        (map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+    close(fd);
+
+    uz = calloc(1, sizeof(unzip_t));
+    if (uz == nullptr)
+    {
+        munmap(map, (size_t)st.st_size);
+        return nullptr;
+    }
+
+    uz->map = map;
+    uz->map_size = (size_t)st.st_size;
+    if (read_central(uz))
+    {
+        unzip_close(uz);
+        return nullptr;
+    }
+
+    map_index(uz);
+    return uz;
+}
+
+int unzip_index(unzip_t *uz)
+{
+    zip_index_slot_t *slots;
+
+    if (uz->slots != nullptr)
+        return 0;
+    if (uz->num_entries >= ZIP_INDEX_EMPTY)
+        return -1;
+
+    uz->num_slots = zip_index_slots(uz->num_entries);
+    slots = malloc(uz->num_slots * sizeof(zip_index_slot_t));
+    if (slots == nullptr)
+        return -1;
+
+    zip_index_fill(slots, uz->num_slots, uz->entries, uz->num_entries, (const char *)uz->map);
+    uz->slots = slots;
+    return 0;
+}
+
+size_t unzip_find(unzip_t *uz, const char *name, const size_t name_len)
+{
+    size_t i, n, mask;
+    uint32_t h;
+
+    if (unzip_index(uz) == 0)
+    {
+        h = zip_index_hash(name, name_len);
+        mask = uz->num_slots - 1;
+
+        for (i = h & mask, n = 0; n < uz->num_slots && uz->slots[i].index != ZIP_INDEX_EMPTY; i = (i + 1) & mask, n++)
+        {
+            if (uz->slots[i].hash == h && uz->entries[uz->slots[i].index].name_len == name_len &&
+                memcmp(unzip_name(uz, uz->slots[i].index), name, name_len) == 0)
+                return uz->slots[i].index;
+        }
+
+        return UNZIP_NOT_FOUND;
+    }
+
+    for (i = 0; i < uz->num_entries; i++)
+    {
+        if (uz->entries[i].name_len == name_len && memcmp(unzip_name(uz, i), name, name_len) == 0)
+            return i;
+    }
+
+    return UNZIP_NOT_FOUND;
+}
+
+const uint8_t *unzip_data(const unzip_t *uz, const size_t index)
+{
+    const zip_entry_t *e = &uz->entries[index];
+    const uint8_t *p = uz->map + e->offset;
+    size_t skip;
+
+    // The local header's name and extra field may differ in size from the central ones
+    if (e->offset > uz->map_size || uz->map_size - e->offset < ZIP_LOCAL_SIZE || get_le32(p) != ZIP_LOCAL_SIG)
+        return nullptr;
+
+    skip = ZIP_LOCAL_SIZE + get_le16(p + 26) + get_le16(p + 28);
+    if (uz->map_size - e->offset < skip || uz->map_size - e->offset - skip < e->csize)
+        return nullptr;
+
+    return p + skip;
+}
+
+int unzip_extract(const unzip_t *uz, const size_t index, uint8_t *dst, const size_t dst_cap)
+{
+    const zip_entry_t *e = &uz->entries[index];
+    const uint8_t *src = unzip_data(uz, index);
+    size_t size;
+
+    if (src == nullptr || e->size > dst_cap)
+        return -1;
+
+    switch (e->method)
+    {
+    case ZIP_METHOD_STORE:
+        if (e->csize != e->size)
+            return -1;
+        memcpy(dst, src, e->size);
+        break;
+    case ZIP_METHOD_DEFLATE:
+        if (inflate_decompress(src, e->csize, nullptr, dst, e->size, &size) || size != e->size)
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    return crc32(CRC32_INIT, dst, e->size) == e->crc ? 0 : -1;
+}
+
+int unzip_verify(const unzip_t *uz, const size_t index)
+{
+    const zip_entry_t *e = &uz->entries[index];
+    const uint8_t *src = unzip_data(uz, index);
+    uint8_t buf[UNZIP_VERIFY_BUFFER];
+    uint32_t crc = CRC32_INIT;
+    size_t pos = 0, size = 0, used, n;
+    inflate_stream_t *s;
+    int ret;
+
+    if (src == nullptr)
+        return -1;
+
+    if (e->method == ZIP_METHOD_STORE)
+        return e->csize == e->size && crc32(CRC32_INIT, src, e->size) == e->crc ? 0 : -1;
+    if (e->method != ZIP_METHOD_DEFLATE || (s = inflate_stream_new(nullptr)) == nullptr)
+        return -1;
+
+    // Stops at the end of the stream, on an error or when truncated data makes no progress
+    do
+    {
+        ret = inflate_stream_update(s, src + pos, e->csize - pos, &used, buf, sizeof(buf), &n);
+        pos += used;
+        size += n;
+        crc = crc32(crc, buf, n);
+    } while (ret == 0 && (used > 0 || n > 0) && size <= e->size);
+
+    inflate_stream_free(s);
+    return ret == 1 && size == e->size && crc == e->crc ? 0 : -1;
+}
+
+void unzip_close(unzip_t *uz)
+{
+    if (uz == nullptr)
+        return;
+
+    if (uz->map != nullptr)
+        munmap((void *)uz->map, uz->map_size);
+    free(uz->entries);
+    if (!uz->slots_mapped)
+        free((void *)uz->slots);
+    free(uz);
+}
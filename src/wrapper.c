@@ -0,0 +1,262 @@
+#include "wrapper.h"
+
+#include <string.h>
+
+#include "checksum.h"
+#include "deflate.h"
+#include "inflate.h"
+
+#define GZIP_XFL_MAX 2
+#define GZIP_XFL_FAST 4
+
+#define ZLIB_FLEVEL_FASTEST 0
+#define ZLIB_FLEVEL_FAST 1
+#define ZLIB_FLEVEL_DEFAULT 2
+#define ZLIB_FLEVEL_MAX 3
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_be32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+int gzip_write_header(bitstream_t *bs, const gzip_header_t *hdr, const int level)
+{
+    uint8_t fixed[GZIP_HEADER_SIZE] = {GZIP_ID1, GZIP_ID2, GZIP_CM_DEFLATE};
+    uint8_t field[2];
+    size_t start;
+
+    fixed[8] = level >= 9 ? GZIP_XFL_MAX : level <= DEFLATE_LEVEL_MIN ? GZIP_XFL_FAST : 0;
+    fixed[9] = GZIP_OS_UNIX;
+
+    bitstream_align(bs);
+    start = bitstream_byte_offset(bs);
+
+    // Without optional fields FLG and MTIME stay zero
+    if (hdr == nullptr)
+        return bitstream_write_bytes(bs, fixed, sizeof(fixed));
+
+    fixed[3] = (hdr->text ? GZIP_FLAG_TEXT : 0) | (hdr->hcrc ? GZIP_FLAG_HCRC : 0) |
+               (hdr->extra ? GZIP_FLAG_EXTRA : 0) | (hdr->name ? GZIP_FLAG_NAME : 0) |
+               (hdr->comment ? GZIP_FLAG_COMMENT : 0);
+    put_le32(fixed + 4, hdr->mtime);
+    fixed[9] = hdr->os;
+
+    if (bitstream_write_bytes(bs, fixed, sizeof(fixed)))
+        return -1;
+
+    if (hdr->extra)
+    {
+        if (hdr->extra_size > UINT16_MAX)
+            return -1;
+        field[0] = (uint8_t)hdr->extra_size;
+        field[1] = (uint8_t)(hdr->extra_size >> 8);
+        if (bitstream_write_bytes(bs, field, sizeof(field)) || bitstream_write_bytes(bs, hdr->extra, hdr->extra_size))
+            return -1;
+    }
+
+    // Strings are written with their terminating zero
+    if (hdr->name && bitstream_write_bytes(bs, (const uint8_t *)hdr->name, strlen(hdr->name) + 1))
+        return -1;
+    if (hdr->comment && bitstream_write_bytes(bs, (const uint8_t *)hdr->comment, strlen(hdr->comment) + 1))
+        return -1;
+
+    // CRC-16 is the low half of the CRC-32 of the header so far
+    if (hdr->hcrc)
+    {
+        uint32_t crc = crc32(CRC32_INIT, bs->stream + start, bitstream_byte_offset(bs) - start);
+        field[0] = (uint8_t)crc;
+        field[1] = (uint8_t)(crc >> 8);
+        if (bitstream_write_bytes(bs, field, sizeof(field)))
+            return -1;
+    }
+
+    return 0;
+}
+
+int gzip_write_trailer(bitstream_t *bs, const uint32_t crc, const uint64_t size)
+{
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+
+    put_le32(trailer, crc);
+    put_le32(trailer + 4, (uint32_t)size); // ISIZE is the size modulo 2^32
+
+    bitstream_align(bs);
+    return bitstream_write_bytes(bs, trailer, sizeof(trailer));
+}
+
+// Skip a zero terminated string starting at *pos, returning it or nullptr if unterminated
+static const char *read_string(const uint8_t *src, const size_t src_size, size_t *pos)
+{
+    const uint8_t *end = memchr(src + *pos, 0, src_size - *pos);
+    const char *s = (const char *)(src + *pos);
+
+    if (end == nullptr)
+        return nullptr;
+
+    *pos = (size_t)(end - src) + 1;
+    return s;
+}
+
+int gzip_read_header(const uint8_t *src, const size_t src_size, gzip_header_t *hdr)
+{
+    size_t pos = GZIP_HEADER_SIZE;
+    uint8_t flags;
+
+    if (src_size < GZIP_HEADER_SIZE || src[0] != GZIP_ID1 || src[1] != GZIP_ID2 || src[2] != GZIP_CM_DEFLATE)
+        return -1;
+
+    flags = src[3];
+    if (flags & 0xe0)
+        return -1;
+
+    memset(hdr, 0, sizeof(gzip_header_t));
+    hdr->text = flags & GZIP_FLAG_TEXT;
+    hdr->hcrc = flags & GZIP_FLAG_HCRC;
+    hdr->mtime = get_le32(src + 4);
+    hdr->os = src[9];
+
+    if (flags & GZIP_FLAG_EXTRA)
+    {
+        if (src_size - pos < 2)
+            return -1;
+        hdr->extra_size = (size_t)src[pos] | ((size_t)src[pos + 1] << 8);
+        pos += 2;
+        if (src_size - pos < hdr->extra_size)
+            return -1;
+        hdr->extra = src + pos;
+        pos += hdr->extra_size;
+    }
+
+    if ((flags & GZIP_FLAG_NAME) && (hdr->name = read_string(src, src_size, &pos)) == nullptr)
+        return -1;
+    if ((flags & GZIP_FLAG_COMMENT) && (hdr->comment = read_string(src, src_size, &pos)) == nullptr)
+        return -1;
+
+    if (flags & GZIP_FLAG_HCRC)
+    {
+        if (src_size - pos < 2)
+            return -1;
+        if ((crc32(CRC32_INIT, src, pos) & 0xffff) != ((uint32_t)src[pos] | ((uint32_t)src[pos + 1] << 8)))
+            return -1;
+        pos += 2;
+    }
+
+    hdr->size = pos;
+    return 0;
+}
+
+int gzip_compress(bitstream_t *bs, const gzip_header_t *hdr, const uint8_t *data, const size_t size,
+                  const int level)
+{
+    if (gzip_write_header(bs, hdr, level) || deflate_compress(bs, data, size, level))
+        return -1;
+
+    return gzip_write_trailer(bs, crc32(CRC32_INIT, data, size), size);
+}
+
+int gzip_decompress(const uint8_t *src, const size_t src_size, uint8_t *dst, const size_t dst_cap,
+                    size_t *dst_size)
+{
+    size_t pos = 0, out = 0, used, n;
+    gzip_header_t hdr;
+
+    // Members follow each other, the data is the concatenation of theirs
+    do
+    {
+        if (gzip_read_header(src + pos, src_size - pos, &hdr))
+            return -1;
+        pos += hdr.size;
+
+        if (inflate_decompress(src + pos, src_size - pos, &used, dst + out, dst_cap - out, &n))
+            return -1;
+        pos += used;
+
+        if (src_size - pos < GZIP_TRAILER_SIZE || get_le32(src + pos) != crc32(CRC32_INIT, dst + out, n) ||
+            get_le32(src + pos + 4) != (uint32_t)n)
+            return -1;
+        pos += GZIP_TRAILER_SIZE;
+        out += n;
+    } while (pos < src_size);
+
+    *dst_size = out;
+    return 0;
+}
+
+int zlib_compress(bitstream_t *bs, const dict_t *dict, const uint8_t *data, const size_t size, const int level)
+{
+    uint8_t hdr[ZLIB_HEADER_SIZE + sizeof(uint32_t)];
+    uint8_t trailer[ZLIB_TRAILER_SIZE];
+    size_t hdr_size = ZLIB_HEADER_SIZE;
+    uint8_t flevel = level <= DEFLATE_LEVEL_MIN       ? ZLIB_FLEVEL_FASTEST
+                     : level < DEFLATE_LEVEL_DEFAULT  ? ZLIB_FLEVEL_FAST
+                     : level == DEFLATE_LEVEL_DEFAULT ? ZLIB_FLEVEL_DEFAULT
+                                                      : ZLIB_FLEVEL_MAX;
+
+    hdr[0] = (ZLIB_CINFO_32K << 4) | ZLIB_CM_DEFLATE;
+    hdr[1] = (uint8_t)(flevel << 6) | (dict ? ZLIB_FLAG_DICT : 0);
+    // FCHECK makes CMF * 256 + FLG a multiple of 31
+    hdr[1] += (31 - ((hdr[0] << 8) | hdr[1]) % 31) % 31;
+    if (dict)
+    {
+        put_be32(hdr + hdr_size, dict->id);
+        hdr_size += sizeof(uint32_t);
+    }
+
+    bitstream_align(bs);
+    if (bitstream_write_bytes(bs, hdr, hdr_size) || deflate_compress_dict(bs, dict, data, size, level))
+        return -1;
+
+    put_be32(trailer, adler32(ADLER32_INIT, data, size));
+    bitstream_align(bs);
+    return bitstream_write_bytes(bs, trailer, sizeof(trailer));
+}
+
+int zlib_decompress(const dict_t *dict, const uint8_t *src, const size_t src_size, uint8_t *dst,
+                    const size_t dst_cap, size_t *dst_size)
+{
+    size_t pos = ZLIB_HEADER_SIZE, used;
+
+    if (src_size < ZLIB_HEADER_SIZE || (src[0] & 0x0f) != ZLIB_CM_DEFLATE || (src[0] >> 4) > ZLIB_CINFO_32K ||
+        ((src[0] << 8) | src[1]) % 31 != 0)
+        return -1;
+
+    // The dictionary must be the one the stream was compressed with
+    if (src[1] & ZLIB_FLAG_DICT)
+    {
+        if (src_size - pos < sizeof(uint32_t) || dict == nullptr || dict->id != get_be32(src + pos))
+            return -1;
+        pos += sizeof(uint32_t);
+    }
+    else
+        dict = nullptr;
+
+    if (inflate_decompress_dict(dict, src + pos, src_size - pos, &used, dst, dst_cap, dst_size))
+        return -1;
+    pos += used;
+
+    if (src_size - pos < ZLIB_TRAILER_SIZE || get_be32(src + pos) != adler32(ADLER32_INIT, dst, *dst_size))
+        return -1;
+
+    return 0;
+}
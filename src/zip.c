@@ -0,0 +1,647 @@
+#define _GNU_SOURCE // copy_file_range
+
+#include "zip.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "checksum.h"
+
+#define ZIP_BUFFER_SIZE (64 * 1024)
+#define ZIP_MODE_FILE 0100644
+#define ZIP_MODE_DIR 040755
+#define ZIP_ATTR_DIR 0x10 // MS-DOS directory attribute
+#define ZIP_DOS_YEAR 1980
+#define ZIP_COPY_CHUNK (1u << 30) // bytes per copy_file_range or sendfile call
+
+typedef struct
+{
+    size_t offset;
+    size_t size;
+    const char *bytes;
+} zip_magic_t;
+
+// Signatures of formats whose data is compressed already
+static const zip_magic_t compressed_magic[] = {
+    {0, 8, "\x89PNG\r\n\x1a\n"},
+    {0, 3, "\xff\xd8\xff"}, // JPEG
+    {0, 4, "GIF8"},
+    {8, 4, "WEBP"},
+    {4, 4, "ftyp"},         // MP4, MOV, HEIF, AVIF
+    {0, 4, "\x1a\x45\xdf\xa3"}, // Matroska, WebM
+    {0, 3, "ID3"},          // MP3
+    {0, 4, "OggS"},
+    {0, 4, "fLaC"},
+    {0, 4, "wOFF"},
+    {0, 4, "wOF2"},
+    {0, 4, "PK\x03\x04"}, // ZIP, JAR, APK, office documents
+    {0, 2, "\x1f\x8b"},   // gzip
+    {0, 3, "BZh"},
+    {0, 6, "\xfd" "7zXZ\0"},
+    {0, 4, "\x28\xb5\x2f\xfd"}, // Zstandard
+    {0, 4, "\x04\x22\x4d\x18"}, // LZ4
+    {0, 6, "7z\xbc\xaf\x27\x1c"},
+    {0, 6, "Rar!\x1a\x07"},
+};
+
+// Extensions of compressed formats, some of which embed data that is not
+static const char *compressed_ext[] = {
+    "7z",  "apk", "avif", "bz2", "docx", "epub", "flac", "gif",  "gz",   "heic", "jar", "jpeg", "jpg",  "lz4",
+    "m4a", "m4v", "mkv",  "mov", "mp3",  "mp4",  "odt",  "ogg",  "opus", "png",  "rar", "tgz",  "webm", "webp",
+    "whl", "woff", "woff2", "xlsx", "xz", "zip", "zst",
+};
+
+static void put_le16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_le64(uint8_t *p, const uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static bool zip64_entry(const zip_entry_t *e)
+{
+    return e->size >= ZIP_OFFSET_MAX || e->csize >= ZIP_OFFSET_MAX;
+}
+
+// A value that does not fit its 32 bit field is all ones there and follows in the ZIP64 extra field
+static uint32_t field32(const uint64_t v)
+{
+    return v >= ZIP_OFFSET_MAX ? ZIP_OFFSET_MAX : (uint32_t)v;
+}
+
+// Local headers carry both sizes in the extra field, central records only those that overflowed
+static size_t put_zip64_extra(uint8_t *extra, const zip_entry_t *e, const bool central)
+{
+    size_t n = 4;
+
+    if (!central && zip64_entry(e))
+    {
+        put_le64(extra + n, e->size);
+        put_le64(extra + n + 8, e->csize);
+        n += 16;
+    }
+    else if (central)
+    {
+        if (e->size >= ZIP_OFFSET_MAX)
+        {
+            put_le64(extra + n, e->size);
+            n += 8;
+        }
+        if (e->csize >= ZIP_OFFSET_MAX)
+        {
+            put_le64(extra + n, e->csize);
+            n += 8;
+        }
+        if (e->offset >= ZIP_OFFSET_MAX)
+        {
+            put_le64(extra + n, e->offset);
+            n += 8;
+        }
+    }
+
+    if (n == 4)
+        return 0;
+
+    put_le16(extra, ZIP64_EXTRA_ID);
+    put_le16(extra + 2, (uint16_t)(n - 4));
+    return n;
+}
+
+uint32_t zip_dos_time(const time_t t)
+{
+    struct tm tm;
+
+    if (localtime_r(&t, &tm) == nullptr || tm.tm_year + 1900 < ZIP_DOS_YEAR)
+        return (1 << 5 | 1) << 16; // 1980-01-01 00:00:00
+
+    return (uint32_t)(tm.tm_year + 1900 - ZIP_DOS_YEAR) << 25 | (uint32_t)(tm.tm_mon + 1) << 21 |
+           (uint32_t)tm.tm_mday << 16 | (uint32_t)tm.tm_hour << 11 | (uint32_t)tm.tm_min << 5 |
+           (uint32_t)tm.tm_sec >> 1;
+}
+
+uint32_t zip_index_hash(const char *name, const size_t name_len)
+{
+    const uint8_t *p = (const uint8_t *)name;
+    size_t i, n = name_len < ZIP_INDEX_HASH_PREFIX ? name_len : ZIP_INDEX_HASH_PREFIX;
+    uint32_t h = 0;
+
+    // The index is read on other hosts, so neither the sign of char nor the width of size_t may matter
+    for (i = 0; i < n; i++)
+    {
+        h += p[i];
+        h += h << 10;
+        h ^= h >> 6;
+    }
+    h += h << 3;
+    h ^= h >> 11;
+    h += h << 15;
+    return h;
+}
+
+size_t zip_index_slots(const size_t num_entries)
+{
+    size_t n = 1;
+
+    while (n < 2 * num_entries)
+        n *= 2;
+
+    return n;
+}
+
+void zip_index_fill(zip_index_slot_t *slots, const size_t num_slots, const zip_entry_t *entries,
+                    const size_t num_entries, const char *names)
+{
+    uint32_t h;
+    size_t i, s;
+
+    for (s = 0; s < num_slots; s++)
+        slots[s] = (zip_index_slot_t){0, ZIP_INDEX_EMPTY};
+
+    for (i = 0; i < num_entries; i++)
+    {
+        h = zip_index_hash(names + entries[i].name_pos, entries[i].name_len);
+        for (s = h & (num_slots - 1); slots[s].index != ZIP_INDEX_EMPTY; s = (s + 1) & (num_slots - 1))
+            ;
+        slots[s] = (zip_index_slot_t){h, (uint32_t)i};
+    }
+}
+
+static bool compressed_magic_at(const uint8_t *data, const size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(compressed_magic) / sizeof(*compressed_magic); i++)
+    {
+        if (size >= compressed_magic[i].offset + compressed_magic[i].size &&
+            memcmp(data + compressed_magic[i].offset, compressed_magic[i].bytes, compressed_magic[i].size) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static bool compressed_ext_of(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    size_t i;
+
+    if (ext == nullptr || strchr(ext, '/') != nullptr)
+        return false;
+
+    for (i = 0; i < sizeof(compressed_ext) / sizeof(*compressed_ext); i++)
+    {
+        if (strcasecmp(ext + 1, compressed_ext[i]) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int zip_choose_level(const char *name, const uint8_t *data, const size_t size, const int level)
+{
+    if (level <= 0 || size == 0 || compressed_magic_at(data, size) || deflate_incompressible(data, size))
+        return 0;
+
+    // The name alone is weaker evidence: the sample was too small to tell or parts still compress
+    return compressed_ext_of(name) ? DEFLATE_LEVEL_MIN : level;
+}
+
+zip_writer_t *zip_writer_new(FILE *out, const int level)
+{
+    zip_writer_t *zw = calloc(1, sizeof(zip_writer_t));
+    if (zw == nullptr)
+        return nullptr;
+
+    zw->out = out;
+    zw->level = level;
+    zw->choose = true;
+    if (level > 0)
+    {
+        zw->ds = deflate_stream_new(level);
+        zw->buf = malloc(ZIP_BUFFER_SIZE);
+        if (zw->ds == nullptr || zw->buf == nullptr)
+        {
+            zip_writer_free(zw);
+            return nullptr;
+        }
+    }
+
+    return zw;
+}
+
+static int emit(zip_writer_t *zw, const void *data, const size_t size)
+{
+    // Empty entries and directories come with no data at all
+    if (size == 0)
+        return 0;
+    if (fwrite(data, sizeof(uint8_t), size, zw->out) != size)
+        return -1;
+
+    zw->offset += size;
+    return 0;
+}
+
+void zip_entry_stamp(zip_entry_t *e, const time_t mtime, uint32_t mode, const bool dir)
+{
+    if (mode == 0)
+        mode = dir ? ZIP_MODE_DIR : ZIP_MODE_FILE;
+
+    e->dos_time = zip_dos_time(mtime);
+    e->attr = mode << 16 | (dir ? ZIP_ATTR_DIR : 0);
+}
+
+// Record a new entry starting at the current offset
+static zip_entry_t *push_entry(zip_writer_t *zw, const char *name, const size_t name_len)
+{
+    size_t capacity;
+    zip_entry_t *e;
+    char *names;
+
+    if (name_len > ZIP_NAME_MAX)
+        return nullptr;
+
+    if (zw->num_entries == zw->capacity)
+    {
+        capacity = zw->capacity ? zw->capacity * 2 : 64;
+        e = realloc(zw->entries, capacity * sizeof(zip_entry_t));
+        if (e == nullptr)
+            return nullptr;
+        zw->entries = e;
+        zw->capacity = capacity;
+    }
+
+    if (zw->names_size + name_len > zw->names_capacity)
+    {
+        capacity = zw->names_capacity ? zw->names_capacity * 2 : 4096;
+        while (capacity < zw->names_size + name_len)
+            capacity *= 2;
+        names = realloc(zw->names, capacity);
+        if (names == nullptr)
+            return nullptr;
+        zw->names = names;
+        zw->names_capacity = capacity;
+    }
+
+    e = &zw->entries[zw->num_entries++];
+    *e = (zip_entry_t){
+        .offset = zw->offset,
+        .name_pos = zw->names_size,
+        .name_len = (uint16_t)name_len,
+        .flags = ZIP_FLAG_UTF8,
+    };
+    memcpy(zw->names + zw->names_size, name, name_len);
+    zw->names_size += name_len;
+    return e;
+}
+
+static int write_local_header(zip_writer_t *zw, const zip_entry_t *e)
+{
+    uint8_t hdr[ZIP_LOCAL_SIZE], extra[ZIP64_EXTRA_SIZE];
+    size_t extra_len = put_zip64_extra(extra, e, false);
+
+    put_le32(hdr, ZIP_LOCAL_SIG);
+    put_le16(hdr + 4, extra_len ? ZIP64_VERSION : ZIP_VERSION);
+    put_le16(hdr + 6, e->flags);
+    put_le16(hdr + 8, e->method);
+    put_le32(hdr + 10, e->dos_time);
+    put_le32(hdr + 14, e->crc);
+    put_le32(hdr + 18, field32(e->csize));
+    put_le32(hdr + 22, field32(e->size));
+    put_le16(hdr + 26, e->name_len);
+    put_le16(hdr + 28, (uint16_t)extra_len);
+
+    if (emit(zw, hdr, sizeof(hdr)) || emit(zw, zw->names + e->name_pos, e->name_len))
+        return -1;
+    return emit(zw, extra, extra_len);
+}
+
+// Record a named entry with its time and mode
+static zip_entry_t *push_named(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode)
+{
+    size_t name_len = strlen(name);
+    zip_entry_t *e = push_entry(zw, name, name_len);
+
+    if (e != nullptr)
+        zip_entry_stamp(e, mtime, mode, name_len > 0 && name[name_len - 1] == '/');
+    return e;
+}
+
+static int begin_entry(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode, const int level)
+{
+    zip_entry_t *e;
+
+    if (zw->open || zw->ds == nullptr || (e = push_named(zw, name, mtime, mode)) == nullptr)
+        return -1;
+
+    e->method = ZIP_METHOD_DEFLATE;
+    e->flags |= ZIP_FLAG_DESCRIPTOR;
+    deflate_stream_reset(zw->ds);
+    deflate_stream_set_level(zw->ds, level);
+    zw->open = true;
+    return write_local_header(zw, e);
+}
+
+int zip_writer_add(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode,
+                   const uint8_t *data, const size_t size)
+{
+    int level = zw->choose ? zip_choose_level(name, data, size, zw->level) : zw->level;
+    zip_entry_t *e;
+
+    // Directories and empty files have nothing to compress
+    if (level > 0 && size > 0)
+    {
+        if (begin_entry(zw, name, mtime, mode, level) || zip_writer_write(zw, data, size))
+            return -1;
+        return zip_writer_end(zw);
+    }
+
+    if (zw->open || (e = push_named(zw, name, mtime, mode)) == nullptr)
+        return -1;
+
+    e->method = ZIP_METHOD_STORE;
+    e->crc = crc32(CRC32_INIT, data, size);
+    e->size = e->csize = size;
+
+    if (write_local_header(zw, e))
+        return -1;
+    return emit(zw, data, size);
+}
+
+// Record an entry whose crc and sizes are known, at offset, keeping its flags but the data descriptor
+static zip_entry_t *push_known(zip_writer_t *zw, const zip_entry_t *entry, const char *name)
+{
+    zip_entry_t *e;
+
+    if (zw->open || (e = push_entry(zw, name, entry->name_len)) == nullptr)
+        return nullptr;
+
+    e->flags |= entry->flags & ~ZIP_FLAG_DESCRIPTOR;
+    e->method = entry->method;
+    e->crc = entry->crc;
+    e->size = entry->size;
+    e->csize = entry->csize;
+    e->dos_time = entry->dos_time;
+    e->attr = entry->attr;
+    return e;
+}
+
+int zip_writer_add_raw(zip_writer_t *zw, const zip_entry_t *entry, const char *name, const uint8_t *data)
+{
+    zip_entry_t *e = push_known(zw, entry, name);
+
+    if (e == nullptr || write_local_header(zw, e))
+        return -1;
+    return emit(zw, data, e->csize);
+}
+
+int zip_writer_add_copy(zip_writer_t *zw, const zip_entry_t *entry, const char *name, const int fd,
+                        const uint64_t offset)
+{
+    zip_entry_t *e = push_known(zw, entry, name);
+    uint64_t left;
+    off_t pos = (off_t)offset;
+    ssize_t n;
+    int out;
+
+    // The kernel moves the data behind the stream's back, so the stream goes out first
+    if (e == nullptr || write_local_header(zw, e) || fflush(zw->out))
+        return -1;
+
+    out = fileno(zw->out);
+    for (left = e->csize; left > 0; left -= (uint64_t)n)
+    {
+        n = copy_file_range(fd, &pos, out, nullptr, left < ZIP_COPY_CHUNK ? left : ZIP_COPY_CHUNK, 0);
+
+        // Pipes, and file systems that copy_file_range cannot cross, take sendfile
+        if (n < 0)
+            n = sendfile(out, fd, &pos, left < ZIP_COPY_CHUNK ? left : ZIP_COPY_CHUNK);
+        if (n <= 0)
+            return -1;
+        zw->offset += (uint64_t)n;
+    }
+
+    return 0;
+}
+
+int zip_writer_keep(zip_writer_t *zw, const zip_entry_t *entry, const char *name)
+{
+    zip_entry_t *e = push_known(zw, entry, name);
+
+    if (e == nullptr)
+        return -1;
+
+    e->flags = entry->flags;
+    e->offset = entry->offset;
+    return 0;
+}
+
+int zip_writer_begin(zip_writer_t *zw, const char *name, const time_t mtime, const uint32_t mode)
+{
+    return begin_entry(zw, name, mtime, mode, zw->level);
+}
+
+int zip_writer_write(zip_writer_t *zw, const uint8_t *data, const size_t size)
+{
+    zip_entry_t *e = &zw->entries[zw->num_entries - 1];
+    size_t pos = 0, used, n;
+
+    if (!zw->open)
+        return -1;
+
+    e->crc = crc32(e->crc, data, size);
+    e->size += size;
+
+    while (pos < size)
+    {
+        if (deflate_stream_update(zw->ds, data + pos, size - pos, &used, zw->buf, ZIP_BUFFER_SIZE, &n) ||
+            emit(zw, zw->buf, n))
+            return -1;
+        pos += used;
+        e->csize += n;
+    }
+
+    return 0;
+}
+
+int zip_writer_end(zip_writer_t *zw)
+{
+    zip_entry_t *e = &zw->entries[zw->num_entries - 1];
+    uint8_t desc[ZIP64_DESCRIPTOR_SIZE];
+    size_t n;
+    int ret;
+
+    if (!zw->open)
+        return -1;
+    zw->open = false;
+
+    do
+    {
+        ret = deflate_stream_finish(zw->ds, zw->buf, ZIP_BUFFER_SIZE, &n);
+        if (ret < 0 || emit(zw, zw->buf, n))
+            return -1;
+        e->csize += n;
+    } while (ret == 1);
+
+    put_le32(desc, ZIP_DESCRIPTOR_SIG);
+    put_le32(desc + 4, e->crc);
+    if (!zip64_entry(e))
+    {
+        put_le32(desc + 8, (uint32_t)e->csize);
+        put_le32(desc + 12, (uint32_t)e->size);
+        return emit(zw, desc, ZIP_DESCRIPTOR_SIZE);
+    }
+
+    // Only now is it known that the entry needs ZIP64, which its central record will show
+    put_le64(desc + 8, e->csize);
+    put_le64(desc + 16, e->size);
+    return emit(zw, desc, ZIP64_DESCRIPTOR_SIZE);
+}
+
+// Slots go out little endian and aligned, so readers on such hosts can map them as they are
+static int write_index(zip_writer_t *zw)
+{
+    static const uint8_t pad[ZIP_INDEX_ALIGN];
+    size_t num_slots = zip_index_slots(zw->num_entries), i;
+    uint8_t trailer[ZIP_INDEX_TRAILER_SIZE], *p;
+    zip_index_slot_t *slots;
+    int ret = -1;
+
+    slots = malloc(num_slots * sizeof(zip_index_slot_t));
+    if (slots == nullptr)
+        return -1;
+    zip_index_fill(slots, num_slots, zw->entries, zw->num_entries, zw->names);
+
+    for (i = 0; i < num_slots; i++)
+    {
+        p = (uint8_t *)&slots[i];
+        put_le32(p, slots[i].hash);
+        put_le32(p + 4, slots[i].index);
+    }
+
+    put_le32(trailer, ZIP_INDEX_SIG);
+    put_le32(trailer + 4, (uint32_t)num_slots);
+    put_le32(trailer + 8, (uint32_t)zw->num_entries);
+    put_le32(trailer + 12, (uint32_t)((uint64_t)zw->num_entries >> 32));
+
+    if (emit(zw, pad, (ZIP_INDEX_ALIGN - zw->offset % ZIP_INDEX_ALIGN) % ZIP_INDEX_ALIGN) == 0 &&
+        emit(zw, slots, num_slots * sizeof(zip_index_slot_t)) == 0 && emit(zw, trailer, sizeof(trailer)) == 0)
+        ret = 0;
+
+    free(slots);
+    return ret;
+}
+
+// ZIP64 end of central directory record and its locator, which sits right before the EOCD record
+static int write_zip64_eocd(zip_writer_t *zw, const uint64_t start, const uint64_t size)
+{
+    uint8_t rec[ZIP64_EOCD_SIZE];
+    uint64_t offset = zw->offset;
+
+    put_le32(rec, ZIP64_EOCD_SIG);
+    put_le64(rec + 4, ZIP64_EOCD_SIZE - 12); // size of the rest of the record
+    put_le16(rec + 12, ZIP_OS_UNIX << 8 | ZIP64_VERSION);
+    put_le16(rec + 14, ZIP64_VERSION);
+    put_le32(rec + 16, 0); // this disk
+    put_le32(rec + 20, 0); // disk of the central directory
+    put_le64(rec + 24, zw->num_entries);
+    put_le64(rec + 32, zw->num_entries);
+    put_le64(rec + 40, size);
+    put_le64(rec + 48, start);
+    if (emit(zw, rec, ZIP64_EOCD_SIZE))
+        return -1;
+
+    put_le32(rec, ZIP64_LOCATOR_SIG);
+    put_le32(rec + 4, 0); // disk of the ZIP64 EOCD record
+    put_le64(rec + 8, offset);
+    put_le32(rec + 16, 1); // number of disks
+    return emit(zw, rec, ZIP64_LOCATOR_SIZE);
+}
+
+int zip_writer_finish(zip_writer_t *zw)
+{
+    uint8_t rec[ZIP_CENTRAL_SIZE], extra[ZIP64_EXTRA_SIZE];
+    uint64_t start, size;
+    size_t i, extra_len;
+    zip_entry_t *e;
+
+    if (zw->open)
+        return -1;
+
+    // Index slots hold 32 bit entry indices
+    if (zw->index && zw->num_entries < ZIP_INDEX_EMPTY && write_index(zw))
+        return -1;
+    start = zw->offset;
+
+    for (i = 0; i < zw->num_entries; i++)
+    {
+        e = &zw->entries[i];
+        extra_len = put_zip64_extra(extra, e, true);
+
+        put_le32(rec, ZIP_CENTRAL_SIG);
+        put_le16(rec + 4, ZIP_OS_UNIX << 8 | (extra_len ? ZIP64_VERSION : ZIP_VERSION));
+        put_le16(rec + 6, extra_len ? ZIP64_VERSION : ZIP_VERSION);
+        put_le16(rec + 8, e->flags);
+        put_le16(rec + 10, e->method);
+        put_le32(rec + 12, e->dos_time);
+        put_le32(rec + 16, e->crc);
+        put_le32(rec + 20, field32(e->csize));
+        put_le32(rec + 24, field32(e->size));
+        put_le16(rec + 28, e->name_len);
+        put_le16(rec + 30, (uint16_t)extra_len);
+        put_le16(rec + 32, 0); // comment
+        put_le16(rec + 34, 0); // disk
+        put_le16(rec + 36, 0); // internal attributes
+        put_le32(rec + 38, e->attr);
+        put_le32(rec + 42, field32(e->offset));
+
+        if (emit(zw, rec, sizeof(rec)) || emit(zw, zw->names + e->name_pos, e->name_len) ||
+            emit(zw, extra, extra_len))
+            return -1;
+    }
+
+    size = zw->offset - start;
+    if ((zw->num_entries >= ZIP_ENTRIES_MAX || start >= ZIP_OFFSET_MAX || size >= ZIP_OFFSET_MAX) &&
+        write_zip64_eocd(zw, start, size))
+        return -1;
+
+    put_le32(rec, ZIP_EOCD_SIG);
+    put_le16(rec + 4, 0); // this disk
+    put_le16(rec + 6, 0); // disk of the central directory
+    put_le16(rec + 8, zw->num_entries >= ZIP_ENTRIES_MAX ? ZIP_ENTRIES_MAX : (uint16_t)zw->num_entries);
+    put_le16(rec + 10, zw->num_entries >= ZIP_ENTRIES_MAX ? ZIP_ENTRIES_MAX : (uint16_t)zw->num_entries);
+    put_le32(rec + 12, field32(size));
+    put_le32(rec + 16, field32(start));
+    put_le16(rec + 20, 0); // comment
+
+    if (emit(zw, rec, ZIP_EOCD_SIZE))
+        return -1;
+    return fflush(zw->out) == 0 ? 0 : -1;
+}
+
+void zip_writer_free(zip_writer_t *zw)
+{
+    if (zw == nullptr)
+        return;
+
+    deflate_stream_free(zw->ds);
+    free(zw->buf);
+    free(zw->entries);
+    free(zw->names);
+    free(zw);
+}
@@ -1,9 +1,37 @@
 #include <stdio.h>
 
+#include "test.h"
+#include "test_adaptive.h"
 #include "test_bitstream.h"
+#include "test_cache.h"
+#include "test_fast.h"
 #include "test_huffman.h"
+#include "test_inflate.h"
+#include "test_parallel.h"
+#include "test_zip.h"
+
+static size_t num_checks;
+static size_t num_failed;
+
+void test_check(const bool ok, const char *what, const char *file, const int line)
+{
+    num_checks++;
+    if (ok)
+        return;
+
+    num_failed++;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+}
 
 int main(int argc, char **argv)
 {
-    return 0;
-}
\ No newline at end of file
+    test_inflate();
+    test_fast();
+    test_adaptive();
+    test_zip();
+    test_parallel();
+    test_cache();
+
+    printf("%zu of %zu checks failed\n", num_failed, num_checks);
+    return num_failed ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stddef.h>
+
+/// @brief Record the outcome of a check, reporting it if it failed
+/// @param ok whether the check passed
+/// @param what text of the check
+/// @param file source file of the check
+/// @param line line of the check
+void test_check(const bool ok, const char *what, const char *file, const int line);
+
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+#endif
\ No newline at end of file
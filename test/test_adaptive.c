@@ -0,0 +1,166 @@
+#include "test_adaptive.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adaptive.h"
+#include "bitstream.h"
+#include "test.h"
+
+#define TEST_SIZE 50000
+#define TEST_RANDOM_ROUNDS 200
+
+static uint32_t next(uint32_t *x)
+{
+    *x = *x * 1103515245 + 12345;
+    return *x >> 16;
+}
+
+// The sibling property and the bookkeeping kept for it: weights never decrease with the
+// node number, each branch weighs its two children, and nodes share a block, led by its
+// highest node, exactly when they share a weight
+static bool valid_tree(const adaptive_huffman_t *ah)
+{
+    size_t node, right;
+
+    for (node = ah->nyt; node <= ADAPTIVE_ROOT; node++)
+    {
+        if (node < ADAPTIVE_ROOT &&
+            (ah->weight[node] > ah->weight[node + 1] ||
+             (ah->weight[node] == ah->weight[node + 1]) != (ah->block[node] == ah->block[node + 1])))
+            return false;
+        if (ah->leader[ah->block[node]] < node || ah->weight[ah->leader[ah->block[node]]] != ah->weight[node])
+            return false;
+        if (ah->child[node] & 0x8000)
+        {
+            if (ah->leaf[ah->child[node] & 0x7fff] != node)
+                return false;
+            continue;
+        }
+
+        right = ah->child[node];
+        if (right <= ah->nyt || right >= node || ah->parent[right] != node || ah->parent[right - 1] != node ||
+            ah->weight[node] != ah->weight[right] + ah->weight[right - 1])
+            return false;
+    }
+
+    return ah->leaf[ADAPTIVE_NYT] == ah->nyt && ah->weight[ah->nyt] == 0;
+}
+
+// Encode data in pieces of the given sizes, 0 for all at once, and decode it in others.
+// Returns the encoded size in bytes, 0 if encoding failed
+static size_t round_trip(const uint8_t *data, const size_t size, const size_t enc_piece, const size_t dec_piece)
+{
+    adaptive_huffman_t *enc = adaptive_huffman_new(), *dec = adaptive_huffman_new();
+    bitstream_t *bs = bitstream_new(size + 16);
+    uint8_t *out = malloc(size + 1);
+    size_t pos, n, bit_pos = 0, bytes = 0;
+    bool ok = enc != nullptr && dec != nullptr && bs != nullptr && out != nullptr;
+
+    TEST_CHECK(ok);
+    for (pos = 0; ok && pos < size; pos += n)
+    {
+        n = enc_piece && enc_piece < size - pos ? enc_piece : size - pos;
+        ok = adaptive_huffman_encode(enc, bs, data + pos, n) == 0;
+    }
+    TEST_CHECK(ok);
+    if (!ok)
+        goto out;
+
+    bytes = bitstream_byte_offset(bs) + (bitstream_bit_offset(bs) ? 1 : 0);
+    for (pos = 0; ok && pos < size; pos += n)
+    {
+        n = dec_piece && dec_piece < size - pos ? dec_piece : size - pos;
+        ok = adaptive_huffman_decode(dec, bs->stream, bytes, &bit_pos, out + pos, n) == 0;
+    }
+    TEST_CHECK(ok && memcmp(out, data, size) == 0 && (bit_pos + 7) / 8 == bytes);
+    TEST_CHECK(valid_tree(enc) && valid_tree(dec));
+
+    // Every symbol takes at least a bit, so a stream cut short runs out before the last one
+    if (size > 0)
+    {
+        adaptive_huffman_reset(dec);
+        bit_pos = 0;
+        TEST_CHECK(adaptive_huffman_decode(dec, bs->stream, bytes - 1, &bit_pos, out, size) == -1 ||
+                   (bit_pos + 7) / 8 < bytes);
+    }
+
+out:
+    adaptive_huffman_free(enc);
+    adaptive_huffman_free(dec);
+    bitstream_free(bs);
+    free(out);
+    return ok ? bytes : 0;
+}
+
+// Each of the 256 symbols first comes as the NYT escape and its raw bits, then by its code
+static void all_symbols(uint8_t *data)
+{
+    size_t i, first, second;
+
+    for (i = 0; i < 512; i++)
+        data[i] = (uint8_t)(i < 256 ? i : 511 - i);
+    first = round_trip(data, 256, 0, 0);
+    second = round_trip(data, 512, 0, 0);
+    TEST_CHECK(first > 256 && second > first);
+
+    for (i = 0; i < 256; i++)
+        data[i] = (uint8_t)(255 - i);
+    round_trip(data, 256, 1, 1);
+    round_trip(data, 1, 0, 0);
+    round_trip(data, 0, 0, 0);
+}
+
+// A coder reset is as good as a new one
+static void reset(const uint8_t *data)
+{
+    adaptive_huffman_t *ah = adaptive_huffman_new();
+    bitstream_t *a = bitstream_new(64), *b = bitstream_new(64);
+
+    TEST_CHECK(ah != nullptr && a != nullptr && b != nullptr);
+    if (ah != nullptr && a != nullptr && b != nullptr)
+    {
+        TEST_CHECK(adaptive_huffman_encode(ah, a, data, 1000) == 0);
+        adaptive_huffman_reset(ah);
+        TEST_CHECK(adaptive_huffman_encode(ah, b, data, 1000) == 0);
+        TEST_CHECK(bitstream_size(a) == bitstream_size(b) &&
+                   memcmp(a->stream, b->stream, bitstream_byte_offset(a)) == 0);
+    }
+
+    adaptive_huffman_free(ah);
+    bitstream_free(a);
+    bitstream_free(b);
+}
+
+void test_adaptive(void)
+{
+    uint8_t *data = malloc(TEST_SIZE);
+    uint32_t seed = 5;
+    size_t i, j, size, alphabet;
+
+    TEST_CHECK(data != nullptr);
+    if (data == nullptr)
+        return;
+
+    all_symbols(data);
+
+    // Skewed sources over alphabets of every width, whose weights keep reordering the tree
+    for (i = 0; i < TEST_RANDOM_ROUNDS; i++)
+    {
+        size = next(&seed) % 4000;
+        alphabet = next(&seed) % 256 + 1;
+        for (j = 0; j < size; j++)
+            data[j] = (uint8_t)(next(&seed) % alphabet * (next(&seed) % alphabet) / alphabet);
+        round_trip(data, size, next(&seed) % 64, next(&seed) % 64);
+    }
+
+    // One symbol for long, then another taking over, then uniform bytes
+    memset(data, 'a', TEST_SIZE / 2);
+    memset(data + TEST_SIZE / 2, 'b', TEST_SIZE / 4);
+    for (i = TEST_SIZE * 3 / 4; i < TEST_SIZE; i++)
+        data[i] = (uint8_t)next(&seed);
+    TEST_CHECK(round_trip(data, TEST_SIZE, 0, 1000) < TEST_SIZE / 2);
+
+    reset(data + TEST_SIZE * 3 / 4);
+    free(data);
+}
@@ -0,0 +1,7 @@
+#ifndef __TEST_ADAPTIVE_H__
+#define __TEST_ADAPTIVE_H__
+
+/// @brief Round trip symbol streams through the adaptive Huffman coder
+void test_adaptive(void);
+
+#endif
\ No newline at end of file
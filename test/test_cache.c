@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include "test_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "checksum.h"
+#include "test.h"
+
+#define TEST_DIR_SIZE 64
+#define TEST_PATH_SIZE 512
+#define TEST_DATA_SIZE 1000
+#define TEST_NUM_FDS 16
+
+typedef struct
+{
+    char dir[TEST_DIR_SIZE]; // holding the cache and the input files
+    char cache[2 * TEST_DIR_SIZE];
+    uint8_t data[TEST_DATA_SIZE];
+    uint8_t comp[TEST_DATA_SIZE]; // stands in for compressed data, the cache does not look into it
+} test_cache_t;
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+// Make the content of a file and what it compresses to from a seed
+static void fill(test_cache_t *t, const char seed, const size_t size)
+{
+    uint32_t x = (uint32_t)seed;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        t->data[i] = (uint8_t)(x >> 16);
+        t->comp[i] = (uint8_t)~t->data[i];
+    }
+}
+
+// Write an input file of size bytes seeded by its name and stat it
+static bool make_file(test_cache_t *t, const char *name, const size_t size, char *path, struct stat *st)
+{
+    bool ok;
+    FILE *f;
+
+    fill(t, name[0], size);
+    snprintf(path, TEST_PATH_SIZE, "%s/%s", t->dir, name);
+    f = fopen(path, "wb");
+    ok = f != nullptr && fwrite(t->data, 1, size, f) == size;
+    if (f != nullptr && fclose(f))
+        ok = false;
+    return ok && stat(path, st) == 0;
+}
+
+static cache_key_t make_key(const test_cache_t *t, const size_t size, const int level)
+{
+    return (cache_key_t){size, cache_hash(t->data, size), crc32(CRC32_INIT, t->data, size), level, true};
+}
+
+// Add what the input file name of size bytes compressed to, half its size unless stored
+static bool add(cache_t *c, test_cache_t *t, const char *name, const size_t size, const uint16_t method,
+                cache_key_t *key)
+{
+    char path[TEST_PATH_SIZE];
+    struct stat st;
+    zip_entry_t e;
+
+    if (!make_file(t, name, size, path, &st))
+        return false;
+
+    *key = make_key(t, size, 6);
+    e = (zip_entry_t){.method = method, .crc = key->crc, .size = size};
+    e.csize = method == ZIP_METHOD_STORE ? size : size / 2;
+    return cache_add(c, path, &st, key, &e, t->comp) == 0;
+}
+
+// Look an input file up by path and check the entry it finds, made from the content of seed
+static bool found(cache_t *c, test_cache_t *t, const char *name, const char seed, const size_t size,
+                  const uint16_t method)
+{
+    char path[TEST_PATH_SIZE];
+    uint8_t *data = nullptr;
+    struct stat st;
+    zip_entry_t e;
+    bool ok;
+
+    fill(t, seed, size);
+    snprintf(path, sizeof(path), "%s/%s", t->dir, name);
+    if (stat(path, &st) || cache_find(c, path, &st, 6, true, &e, &data))
+        return false;
+
+    ok = e.method == method && e.size == size && e.crc == crc32(CRC32_INIT, t->data, size);
+    if (method == ZIP_METHOD_STORE)
+        return ok && data == nullptr && e.csize == size;
+
+    ok = ok && data != nullptr && e.csize == size / 2 && memcmp(data, t->comp, e.csize) == 0;
+    if (data != nullptr)
+        munmap(data, e.csize);
+    return ok;
+}
+
+// The path of the only blob file of the cache
+static bool blob_file(const test_cache_t *t, char *path)
+{
+    struct dirent *d;
+    size_t n = 0;
+    DIR *dir;
+
+    dir = opendir(t->cache);
+    if (dir == nullptr)
+        return false;
+    while ((d = readdir(dir)) != nullptr)
+    {
+        if (d->d_name[0] != '.' && strcmp(d->d_name, "index") != 0)
+        {
+            snprintf(path, TEST_PATH_SIZE, "%s/%s", t->cache, d->d_name);
+            n++;
+        }
+    }
+
+    closedir(dir);
+    return n == 1;
+}
+
+// XXH64 with seed 0, as computed by the reference implementation
+static void hash(test_cache_t *t)
+{
+    size_t i;
+
+    for (i = 0; i < TEST_DATA_SIZE; i++)
+        t->data[i] = (uint8_t)i;
+
+    TEST_CHECK(cache_hash(t->data, 0) == 0xef46db3751d8e999ull);
+    TEST_CHECK(cache_hash((const uint8_t *)"a", 1) == 0xd24ec4f1a98c6e5bull);
+    TEST_CHECK(cache_hash((const uint8_t *)"abc", 3) == 0x44bc2cf5ad770999ull);
+    TEST_CHECK(cache_hash(t->data, 256) != cache_hash(t->data + 1, 256));
+}
+
+// Entries are found by path while their file is unchanged, then by content
+static void find(test_cache_t *t)
+{
+    char path[TEST_PATH_SIZE], moved[TEST_PATH_SIZE];
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    uint8_t *data = nullptr;
+    cache_key_t key;
+    cache_t *c;
+    struct stat st;
+    zip_entry_t e;
+
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+
+    TEST_CHECK(add(c, t, "stored", 100, ZIP_METHOD_STORE, &key));
+    TEST_CHECK(add(c, t, "a", TEST_DATA_SIZE, ZIP_METHOD_DEFLATE, &key));
+    TEST_CHECK(found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(!found(c, t, "missing", 'm', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+
+    // Not at another level or without zip_choose_level, nor once the file was touched
+    snprintf(path, sizeof(path), "%s/a", t->dir);
+    TEST_CHECK(stat(path, &st) == 0 && cache_find(c, path, &st, 7, true, &e, &data) == -1);
+    TEST_CHECK(cache_find(c, path, &st, 6, false, &e, &data) == -1);
+    TEST_CHECK(utimensat(AT_FDCWD, path, times, 0) == 0 && stat(path, &st) == 0);
+    TEST_CHECK(cache_find(c, path, &st, 6, true, &e, &data) == -1);
+
+    // The same content under a new time or name is found by its key, which records it
+    TEST_CHECK(cache_find_content(c, path, &st, &key, &e, &data) == 0 && data != nullptr);
+    if (data != nullptr)
+        munmap(data, e.csize);
+    TEST_CHECK(found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    snprintf(moved, sizeof(moved), "%s/b", t->dir);
+    TEST_CHECK(rename(path, moved) == 0 && !found(c, t, "b", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(stat(moved, &st) == 0 && cache_find_content(c, moved, &st, &key, &e, &data) == 0 && data != nullptr);
+    if (data != nullptr)
+        munmap(data, e.csize);
+
+    key.choose = false;
+    TEST_CHECK(cache_find_content(c, moved, &st, &key, &e, &data) == -1);
+    key.choose = true;
+    key.level = 7;
+    TEST_CHECK(cache_find_content(c, moved, &st, &key, &e, &data) == -1);
+    TEST_CHECK(cache_close(c) == 0);
+
+    // Everything survives a reopen
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+    TEST_CHECK(found(c, t, "b", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(found(c, t, "stored", 's', 100, ZIP_METHOD_STORE));
+
+    // An entry made without zip_choose_level is kept apart from one made with it, across a reopen too
+    fill(t, 'a', TEST_DATA_SIZE);
+    key = make_key(t, TEST_DATA_SIZE, 6);
+    key.choose = false;
+    e = (zip_entry_t){.method = ZIP_METHOD_DEFLATE, .crc = key.crc, .size = TEST_DATA_SIZE, .csize = TEST_DATA_SIZE / 2};
+    TEST_CHECK(cache_add(c, moved, &st, &key, &e, t->comp) == 0);
+    TEST_CHECK(cache_close(c) == 0);
+
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+    TEST_CHECK(cache_find(c, moved, &st, 6, true, &e, &data) == -1);
+    TEST_CHECK(cache_find(c, moved, &st, 6, false, &e, &data) == 0 && data != nullptr);
+    if (data != nullptr)
+        munmap(data, e.csize);
+    key.choose = true;
+    TEST_CHECK(cache_find_content(c, moved, &st, &key, &e, &data) == 0 && data != nullptr);
+    if (data != nullptr)
+        munmap(data, e.csize);
+    TEST_CHECK(cache_close(c) == 0);
+}
+
+// Records are kept under resolved paths: the same relative path run from another directory is another file
+static void relative(test_cache_t *t)
+{
+    char path[TEST_PATH_SIZE], name[TEST_DIR_SIZE];
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    uint8_t *data = nullptr;
+    cache_key_t key;
+    cache_t *c;
+    struct stat st;
+    zip_entry_t e;
+    const char *sub;
+    int cwd;
+
+    cwd = open(".", O_RDONLY | O_DIRECTORY);
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(cwd >= 0 && c != nullptr);
+    if (cwd < 0 || c == nullptr)
+        goto out;
+
+    // Files of equal size and time but different content, the last one written is p/same
+    for (sub = "qp"; *sub != '\0'; sub++)
+    {
+        snprintf(path, sizeof(path), "%s/%c", t->dir, *sub);
+        snprintf(name, sizeof(name), "%c/same", *sub);
+        TEST_CHECK(mkdir(path, 0755) == 0 && make_file(t, name, TEST_DATA_SIZE, path, &st) &&
+                   utimensat(AT_FDCWD, path, times, 0) == 0);
+    }
+
+    snprintf(path, sizeof(path), "%s/p", t->dir);
+    TEST_CHECK(chdir(path) == 0 && stat("same", &st) == 0);
+    key = make_key(t, TEST_DATA_SIZE, 6);
+    e = (zip_entry_t){.method = ZIP_METHOD_DEFLATE, .crc = key.crc, .size = TEST_DATA_SIZE, .csize = TEST_DATA_SIZE / 2};
+    TEST_CHECK(cache_add(c, "same", &st, &key, &e, t->comp) == 0);
+    TEST_CHECK(cache_find(c, "same", &st, 6, true, &e, &data) == 0 && data != nullptr);
+    if (data != nullptr)
+        munmap(data, e.csize);
+    TEST_CHECK(found(c, t, "p/same", 'p', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+
+    data = nullptr;
+    snprintf(path, sizeof(path), "%s/q", t->dir);
+    TEST_CHECK(chdir(path) == 0 && stat("same", &st) == 0);
+    TEST_CHECK(cache_find(c, "same", &st, 6, true, &e, &data) == -1 && data == nullptr);
+    TEST_CHECK(!found(c, t, "q/same", 'q', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+
+out:
+    if (cwd >= 0)
+    {
+        TEST_CHECK(fchdir(cwd) == 0);
+        close(cwd);
+    }
+    if (c != nullptr)
+        TEST_CHECK(cache_close(c) == 0);
+}
+
+// A blob whose file lost bytes is a miss and is dropped
+static void truncated(test_cache_t *t)
+{
+    char path[TEST_PATH_SIZE];
+    cache_key_t key;
+    cache_t *c;
+
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+
+    TEST_CHECK(add(c, t, "a", TEST_DATA_SIZE, ZIP_METHOD_DEFLATE, &key));
+    TEST_CHECK(blob_file(t, path) && truncate(path, TEST_DATA_SIZE / 4) == 0);
+    TEST_CHECK(!found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(access(path, F_OK) == -1 && !blob_file(t, path));
+
+    TEST_CHECK(add(c, t, "a", TEST_DATA_SIZE, ZIP_METHOD_DEFLATE, &key));
+    TEST_CHECK(found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(cache_close(c) == 0);
+}
+
+// Beyond its size the cache keeps the most recently used blobs, and a damaged index empties it
+static void evict(test_cache_t *t)
+{
+    char path[TEST_PATH_SIZE];
+    cache_key_t key;
+    cache_t *c;
+    FILE *f;
+
+    c = cache_open(t->cache, TEST_DATA_SIZE / 2 + sizeof(cache_blob_t));
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+    TEST_CHECK(add(c, t, "a", TEST_DATA_SIZE, ZIP_METHOD_DEFLATE, &key));
+    TEST_CHECK(add(c, t, "b", TEST_DATA_SIZE, ZIP_METHOD_DEFLATE, &key));
+    TEST_CHECK(found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(cache_close(c) == 0);
+
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr);
+    if (c == nullptr)
+        return;
+    TEST_CHECK(found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(!found(c, t, "b", 'b', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(blob_file(t, path));
+    TEST_CHECK(cache_close(c) == 0);
+
+    snprintf(path, sizeof(path), "%s/index", t->cache);
+    f = fopen(path, "r+b");
+    TEST_CHECK(f != nullptr && fwrite("junk", 1, 4, f) == 4 && fclose(f) == 0);
+    c = cache_open(t->cache, CACHE_SIZE_DEFAULT);
+    TEST_CHECK(c != nullptr && hashmap_size(&c->blobs) == 0 && hashmap_size(&c->records) == 0);
+    TEST_CHECK(c != nullptr && !found(c, t, "a", 'a', TEST_DATA_SIZE, ZIP_METHOD_DEFLATE));
+    TEST_CHECK(c != nullptr && cache_close(c) == 0);
+}
+
+void test_cache(void)
+{
+    test_cache_t *t = calloc(1, sizeof(test_cache_t));
+
+    TEST_CHECK(t != nullptr);
+    if (t == nullptr)
+        return;
+
+    strcpy(t->dir, "/tmp/plzip_test.XXXXXX");
+    TEST_CHECK(mkdtemp(t->dir) != nullptr);
+    snprintf(t->cache, sizeof(t->cache), "%s/cache", t->dir);
+
+    hash(t);
+    find(t);
+    nftw(t->cache, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    relative(t);
+    nftw(t->cache, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    truncated(t);
+    nftw(t->cache, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    evict(t);
+
+    nftw(t->dir, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    free(t);
+}
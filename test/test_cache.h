@@ -0,0 +1,7 @@
+#ifndef __TEST_CACHE_H__
+#define __TEST_CACHE_H__
+
+/// @brief Add entries to a cache directory and find them again by path and by content
+void test_cache(void);
+
+#endif
\ No newline at end of file
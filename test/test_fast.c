@@ -0,0 +1,164 @@
+#include "test_fast.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fast.h"
+#include "test.h"
+
+#define TEST_SIZE 20000
+#define TEST_RANDOM_ROUNDS 500
+
+static uint32_t next(uint32_t *x)
+{
+    *x = *x * 1103515245 + 12345;
+    return *x >> 16;
+}
+
+// Literals and copies from random distances, short ones most often, as a decoder meets them
+static void fill_mixed(uint8_t *data, const size_t size, uint32_t seed)
+{
+    size_t i = 0, len, dist;
+
+    while (i < size)
+    {
+        len = next(&seed) % 40 + 1;
+        if (len > size - i)
+            len = size - i;
+
+        if (i == 0 || next(&seed) % 3 == 0)
+        {
+            for (; len > 0; len--)
+                data[i++] = (uint8_t)next(&seed);
+            continue;
+        }
+
+        dist = next(&seed) % 2 ? next(&seed) % 8 + 1 : next(&seed) % 4096 + 1;
+        if (dist > i)
+            dist = i;
+        for (; len > 0; len--, i++)
+            data[i] = data[i - dist];
+    }
+}
+
+// Compress src[start, size) after start bytes of history, and decode it with that history
+// as the dictionary into a buffer of exactly the right size and one a byte short
+static void round_trip(const uint8_t *src, const size_t start, const size_t size)
+{
+    size_t n = size - start, csize, out_size;
+    uint8_t *comp = malloc(FAST_BOUND(n)), *out = malloc(n + 1);
+
+    TEST_CHECK(comp != nullptr && out != nullptr);
+    if (comp == nullptr || out == nullptr)
+        goto out;
+
+    TEST_CHECK(fast_compress(src, start, size, comp, FAST_BOUND(n), &csize) == 0 && csize <= FAST_BOUND(n));
+    TEST_CHECK(fast_decompress(start ? src : nullptr, start, comp, csize, out, n, &out_size) == 0);
+    TEST_CHECK(out_size == n && memcmp(out, src + start, n) == 0);
+    if (n > 0)
+        TEST_CHECK(fast_decompress(start ? src : nullptr, start, comp, csize, out, n - 1, &out_size) == -1);
+
+    // Without the history, matches into it cannot be resolved
+    if (start > 0 && fast_decompress(nullptr, 0, comp, csize, out, n, &out_size) == 0)
+        TEST_CHECK(memcmp(out, src + start, n) == 0);
+
+out:
+    free(comp);
+    free(out);
+}
+
+// Runs of a pattern of period 1 to 7 between random bytes, the short offsets the decoder
+// copies in overlapping steps
+static void short_offsets(uint8_t *data)
+{
+    uint32_t seed = 1;
+    size_t period, i, size;
+
+    for (period = 1; period < 8; period++)
+    {
+        for (i = 0; i < 100; i++)
+            data[i] = (uint8_t)next(&seed);
+        for (size = 100 + period * 500; i < size; i++)
+            data[i] = data[i - period];
+        for (size += 100; i < size; i++)
+            data[i] = (uint8_t)next(&seed);
+        round_trip(data, 0, size);
+
+        // The run ending right at the end of the block
+        round_trip(data, 0, size - 100);
+    }
+}
+
+// Matches that start in the dictionary and run on into the block
+static void dictionary(uint8_t *data)
+{
+    uint32_t seed = 2;
+    size_t i;
+
+    fill_mixed(data, TEST_SIZE, 3);
+    round_trip(data, TEST_SIZE / 2, TEST_SIZE);
+
+    for (i = 0; i < 64; i++)
+        data[i] = (uint8_t)next(&seed);
+    for (; i < 4000; i++)
+        data[i] = data[i - 3];
+    round_trip(data, 1000, 4000);
+    round_trip(data, 1001, 1200);
+    round_trip(data, 4000, 4000);
+}
+
+static void malformed(void)
+{
+    // A match with offset 0, and one reaching before the start of the output
+    static const uint8_t zero_offset[] = {0x10, 'a', 0x00, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    static const uint8_t far_offset[] = {0x10, 'a', 0x09, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    static const uint8_t text[] = "a block of text, a block of text, a block of text, a block of text";
+    uint8_t comp[FAST_BOUND(sizeof(text))], out[sizeof(text)];
+    size_t csize, out_size, i;
+
+    TEST_CHECK(fast_decompress(nullptr, 0, zero_offset, sizeof(zero_offset), out, sizeof(out), &out_size) == -1);
+    TEST_CHECK(fast_decompress(nullptr, 0, far_offset, sizeof(far_offset), out, sizeof(out), &out_size) == -1);
+    TEST_CHECK(fast_decompress(text, 4, far_offset, sizeof(far_offset), out, sizeof(out), &out_size) == -1);
+    TEST_CHECK(fast_decompress(nullptr, 0, comp, 0, out, sizeof(out), &out_size) == -1);
+
+    // Cut anywhere, a block must not decode to the whole text
+    TEST_CHECK(fast_compress(text, 0, sizeof(text), comp, sizeof(comp), &csize) == 0);
+    for (i = 0; i < csize; i++)
+        TEST_CHECK(fast_decompress(nullptr, 0, comp, i, out, sizeof(out), &out_size) == -1 ||
+                   out_size < sizeof(text));
+}
+
+void test_fast(void)
+{
+    uint8_t *data = malloc(TEST_SIZE);
+    uint32_t seed = 4;
+    size_t i, size;
+
+    TEST_CHECK(data != nullptr);
+    if (data == nullptr)
+        return;
+
+    // Incompressible, all alike, and every small size around the end of block rules
+    for (i = 0; i < TEST_SIZE; i++)
+        data[i] = (uint8_t)next(&seed);
+    round_trip(data, 0, TEST_SIZE);
+    for (size = 0; size < 40; size++)
+        round_trip(data, 0, size);
+    memset(data, 'z', TEST_SIZE);
+    round_trip(data, 0, TEST_SIZE);
+    for (size = 0; size < 40; size++)
+        round_trip(data, 0, size);
+
+    short_offsets(data);
+    dictionary(data);
+    malformed();
+
+    for (i = 0; i < TEST_RANDOM_ROUNDS; i++)
+    {
+        size = next(&seed) % 5000;
+        fill_mixed(data, size, (uint32_t)i);
+        round_trip(data, i % 2 ? size / 3 : 0, size);
+    }
+
+    free(data);
+}
@@ -0,0 +1,8 @@
+#ifndef __TEST_FAST_H__
+#define __TEST_FAST_H__
+
+/// @brief Round trip data through fast_compress and fast_decompress, with and without a
+///        dictionary, and feed the decoder malformed blocks
+void test_fast(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "test_inflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitstream.h"
+#include "deflate.h"
+#include "inflate.h"
+#include "test.h"
+
+#define TEST_SIZE 100000
+#define TEST_TRAILER 16
+
+// Words drawn from a small vocabulary, compressible like text
+static void fill_text(uint8_t *data, const size_t size)
+{
+    static const char *words[] = {"the ", "archive ", "entry ", "stream ", "of ", "deflate ", "zip ", "\n"};
+    uint32_t x = 12345;
+    size_t i = 0, len;
+
+    while (i < size)
+    {
+        x = x * 1103515245 + 12345;
+        len = strlen(words[x >> 16 & 7]);
+        memcpy(data + i, words[x >> 16 & 7], len < size - i ? len : size - i);
+        i += len;
+    }
+}
+
+static void fill_random(uint8_t *data, const size_t size)
+{
+    uint32_t x = 67890;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = (uint8_t)(x >> 16);
+    }
+}
+
+// Compressed data followed by TEST_TRAILER bytes that are not part of the stream
+static uint8_t *compress(const uint8_t *data, const size_t size, const int level, size_t *csize)
+{
+    bitstream_t *bs = bitstream_new(size + 64);
+    uint8_t *out = nullptr;
+
+    if (bs != nullptr && deflate_compress(bs, data, size, level) == 0)
+    {
+        *csize = bitstream_byte_offset(bs) + (bitstream_bit_offset(bs) ? 1 : 0);
+        out = malloc(*csize + TEST_TRAILER);
+        if (out != nullptr)
+        {
+            memcpy(out, bs->stream, *csize);
+            memset(out + *csize, 0xa5, TEST_TRAILER);
+        }
+    }
+
+    bitstream_free(bs);
+    return out;
+}
+
+// Decode in small uneven pieces of input and output. Returns the last result of inflate_stream_update
+static int stream_decode(const uint8_t *src, const size_t src_size, uint8_t *dst, const size_t dst_cap,
+                         size_t *src_used, size_t *dst_size)
+{
+    inflate_stream_t *s = inflate_stream_new(nullptr);
+    size_t in = 0, out = 0, used, produced, chunk = 1;
+    int ret = 0;
+
+    if (s == nullptr)
+        return -1;
+
+    while (ret == 0)
+    {
+        chunk = chunk % 13 + 1;
+        used = src_size - in < chunk ? src_size - in : chunk;
+        ret = inflate_stream_update(s, src + in, used, &used, dst + out,
+                                    dst_cap - out < 2 * chunk + 3 ? dst_cap - out : 2 * chunk + 3, &produced);
+        in += used;
+        out += produced;
+        if (ret == 0 && in == src_size && used == 0 && produced == 0)
+            break;
+    }
+
+    inflate_stream_free(s);
+    *src_used = in;
+    *dst_size = out;
+    return ret;
+}
+
+static void round_trip(const uint8_t *data, const size_t size, const int level)
+{
+    uint8_t *comp, *out = malloc(size + 1);
+    size_t csize, used, out_size;
+
+    comp = compress(data, size, level, &csize);
+    TEST_CHECK(comp != nullptr && out != nullptr);
+    if (comp == nullptr || out == nullptr)
+        goto out;
+
+    // Bytes after the stream are left alone
+    TEST_CHECK(inflate_decompress(comp, csize + TEST_TRAILER, &used, out, size + 1, &out_size) == 0);
+    TEST_CHECK(used == csize && out_size == size && memcmp(out, data, size) == 0);
+
+    memset(out, 0, size);
+    TEST_CHECK(stream_decode(comp, csize + TEST_TRAILER, out, size + 1, &used, &out_size) == 1);
+    TEST_CHECK(used == csize && out_size == size && memcmp(out, data, size) == 0);
+
+    // Cut short, the stream never ends
+    TEST_CHECK(inflate_decompress(comp, csize - 1, nullptr, out, size + 1, &out_size) == -1);
+    TEST_CHECK(stream_decode(comp, csize - 1, out, size + 1, &used, &out_size) == 0);
+
+    // Too little room for the output
+    if (size > 0)
+        TEST_CHECK(inflate_decompress(comp, csize, nullptr, out, size - 1, &out_size) == -1);
+
+out:
+    free(comp);
+    free(out);
+}
+
+static void corrupt(void)
+{
+    // Final block of the reserved type 3
+    static const uint8_t reserved[] = {0x07, 0x00, 0x00};
+    // Stored block whose length and its complement disagree
+    static const uint8_t stored[] = {0x01, 0x05, 0x00, 0x00, 0x00, 'a', 'b', 'c', 'd', 'e'};
+    uint8_t out[64];
+    size_t used, out_size;
+
+    TEST_CHECK(inflate_decompress(reserved, sizeof(reserved), nullptr, out, sizeof(out), &out_size) == -1);
+    TEST_CHECK(stream_decode(reserved, sizeof(reserved), out, sizeof(out), &used, &out_size) == -1);
+    TEST_CHECK(inflate_decompress(stored, sizeof(stored), nullptr, out, sizeof(out), &out_size) == -1);
+    TEST_CHECK(stream_decode(stored, sizeof(stored), out, sizeof(out), &used, &out_size) == -1);
+    TEST_CHECK(inflate_decompress(stored, 0, nullptr, out, sizeof(out), &out_size) == -1);
+}
+
+void test_inflate(void)
+{
+    static const int levels[] = {DEFLATE_LEVEL_MIN, DEFLATE_LEVEL_DEFAULT, DEFLATE_LEVEL_MAX};
+    uint8_t *text = malloc(TEST_SIZE), *random = malloc(TEST_SIZE), *zeros = calloc(TEST_SIZE, 1);
+    size_t i;
+
+    TEST_CHECK(text != nullptr && random != nullptr && zeros != nullptr);
+    if (text != nullptr && random != nullptr && zeros != nullptr)
+    {
+        fill_text(text, TEST_SIZE);
+        fill_random(random, TEST_SIZE);
+        for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+        {
+            round_trip(text, 0, levels[i]);
+            round_trip(text, 1, levels[i]);
+            round_trip(text, TEST_SIZE, levels[i]);
+            round_trip(random, TEST_SIZE, levels[i]);
+            round_trip(zeros, TEST_SIZE, levels[i]);
+        }
+    }
+
+    corrupt();
+    free(text);
+    free(random);
+    free(zeros);
+}
@@ -0,0 +1,8 @@
+#ifndef __TEST_INFLATE_H__
+#define __TEST_INFLATE_H__
+
+/// @brief Round trip data through deflate_compress and both decompressors, and feed them
+///        corrupt and truncated streams
+void test_inflate(void);
+
+#endif
\ No newline at end of file
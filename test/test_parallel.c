@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+#include "test_parallel.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "parallel.h"
+#include "test.h"
+#include "unzip.h"
+#include "zip.h"
+
+#define TEST_PATH_SIZE 256
+#define TEST_MTIME 1700000000
+#define TEST_DATA_SIZE 3000
+#define TEST_NUM_FDS 16
+
+// Stored data holding what looks like a descriptor, which the extractor must see through
+static const uint8_t fake_descriptor[] = "text PK\x07\x08\x00\x00\x00\x00\x05\x00\x00\x00\x05\x00\x00\x00 more text";
+
+typedef struct
+{
+    const char *name;
+    size_t size;
+} test_file_t;
+
+// In archive order. The streamed archive stores the first two with their sizes in a data descriptor only
+static const test_file_t test_files[] = {
+    {"s/empty", 0},
+    {"s/data", sizeof(fake_descriptor) - 1},
+    {"d/random", TEST_DATA_SIZE},
+    {"d/text", TEST_DATA_SIZE},
+    {"d/dir/", 0},
+    {"d/last.txt", TEST_DATA_SIZE},
+};
+
+#define NUM_TEST_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+typedef struct
+{
+    int fd;
+    const uint8_t *data;
+    size_t size;
+} feeder_t;
+
+typedef struct
+{
+    size_t count;
+    char name[TEST_PATH_SIZE];
+} failures_t;
+
+static void put_le16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void fill(uint8_t *data, const size_t index)
+{
+    uint32_t x = (uint32_t)index;
+    size_t i;
+
+    if (index == 1)
+    {
+        memcpy(data, fake_descriptor, test_files[index].size);
+        return;
+    }
+
+    // Random bytes that the writer stores, and text it compresses
+    for (i = 0; i < test_files[index].size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = index == 2 ? (uint8_t)(x >> 16) : (uint8_t)"abcd efgh\n"[(x >> 16) % 10];
+    }
+}
+
+// Remove what an extraction left
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+// Compare an extracted file with what it was made from
+static bool extracted(const char *dest, const size_t index)
+{
+    uint8_t data[TEST_DATA_SIZE], out[TEST_DATA_SIZE + 1];
+    char path[TEST_PATH_SIZE];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dest, test_files[index].name);
+    if (test_files[index].name[strlen(test_files[index].name) - 1] == '/')
+        return access(path, F_OK) == 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    n = read(fd, out, sizeof(out));
+    close(fd);
+
+    fill(data, index);
+    return n == (ssize_t)test_files[index].size && memcmp(out, data, test_files[index].size) == 0;
+}
+
+// Make a new temporary directory to extract into or build files in
+static bool make_dest(char *dest)
+{
+    strcpy(dest, "/tmp/plzip_test.XXXXXX");
+    return mkdtemp(dest) != nullptr;
+}
+
+// Write the test files under dir, with the directories they are in
+static bool make_tree(const char *dir)
+{
+    uint8_t data[TEST_DATA_SIZE];
+    char path[TEST_PATH_SIZE];
+    size_t i, j, len;
+    bool ok = true;
+    FILE *f;
+
+    for (i = 0; ok && i < NUM_TEST_FILES; i++)
+    {
+        len = (size_t)snprintf(path, sizeof(path), "%s/%s", dir, test_files[i].name);
+        for (j = strlen(dir) + 1; j < len; j++)
+        {
+            if (path[j] != '/')
+                continue;
+            path[j] = '\0';
+            mkdir(path, 0755);
+            path[j] = '/';
+        }
+        if (path[len - 1] == '/')
+            continue;
+
+        fill(data, i);
+        f = fopen(path, "wb");
+        ok = f != nullptr && fwrite(data, 1, test_files[i].size, f) == test_files[i].size;
+        if (f != nullptr && fclose(f))
+            ok = false;
+    }
+
+    return ok;
+}
+
+// Read a whole file, its size left in size
+static uint8_t *load(const char *path, size_t *size)
+{
+    uint8_t *data = nullptr;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    if (fstat(fd, &st) == 0 && (data = malloc((size_t)st.st_size + 1)) != nullptr)
+    {
+        *size = (size_t)st.st_size;
+        if (read(fd, data, *size) != st.st_size)
+        {
+            free(data);
+            data = nullptr;
+        }
+    }
+
+    close(fd);
+    return data;
+}
+
+// Compress the test files under src on a pool of threads into a new temporary archive at path
+static int zip_files(const char *src, const size_t threads, char *path)
+{
+    parallel_options_t opts = {.level = DEFLATE_LEVEL_DEFAULT, .threads = threads};
+    char file[TEST_PATH_SIZE];
+    parallel_zip_t *pz = nullptr;
+    zip_writer_t *zw = nullptr;
+    int fd, ret = -1;
+    size_t i;
+    FILE *f;
+
+    strcpy(path, "/tmp/plzip_test.XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    f = fdopen(fd, "wb");
+    if (f == nullptr)
+    {
+        close(fd);
+        goto out;
+    }
+
+    zw = zip_writer_new(f, opts.level);
+    pz = zw != nullptr ? parallel_zip_new(zw, &opts) : nullptr;
+    for (i = 0; pz != nullptr && i < NUM_TEST_FILES; i++)
+    {
+        snprintf(file, sizeof(file), "%s/%s", src, test_files[i].name);
+        if (parallel_zip_add(pz, file, test_files[i].name))
+            break;
+    }
+    if (i == NUM_TEST_FILES && parallel_zip_finish(pz) == 0 && zip_writer_finish(zw) == 0)
+        ret = 0;
+
+    parallel_zip_free(pz);
+    zip_writer_free(zw);
+    if (fclose(f))
+        ret = -1;
+
+out:
+    if (ret)
+        unlink(path);
+    return ret;
+}
+
+// Check that the archive holds the test files in the order they were added
+static void check_archive(const unzip_t *uz)
+{
+    uint8_t data[TEST_DATA_SIZE], out[TEST_DATA_SIZE];
+    size_t i, len;
+
+    for (i = 0; i < NUM_TEST_FILES && i < uz->num_entries; i++)
+    {
+        len = strlen(test_files[i].name);
+        fill(data, i);
+        TEST_CHECK(uz->entries[i].name_len == len && memcmp(unzip_name(uz, i), test_files[i].name, len) == 0);
+        TEST_CHECK(uz->entries[i].size == test_files[i].size && unzip_extract(uz, i, out, sizeof(out)) == 0 &&
+                   memcmp(out, data, test_files[i].size) == 0);
+    }
+
+    // Random data does not shrink and is stored, text is compressed
+    TEST_CHECK(uz->num_entries > 3 && uz->entries[2].method == ZIP_METHOD_STORE &&
+               uz->entries[3].method == ZIP_METHOD_DEFLATE);
+}
+
+// Extract an archive of the test files on a pool of threads, check it only, then damage an entry
+static void unzip_files(const char *path)
+{
+    parallel_options_t opts = {.threads = 4};
+    bool failed[NUM_TEST_FILES] = {false};
+    char dest[TEST_PATH_SIZE];
+    const uint8_t *p;
+    unzip_t *uz;
+    uint8_t byte;
+    size_t i;
+    FILE *f;
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->num_entries == NUM_TEST_FILES);
+    if (uz == nullptr || uz->num_entries != NUM_TEST_FILES || !make_dest(dest))
+        goto out;
+
+    TEST_CHECK(parallel_unzip(uz, dest, &opts, failed) == 0);
+    for (i = 0; i < NUM_TEST_FILES; i++)
+        TEST_CHECK(!failed[i] && extracted(dest, i));
+    nftw(dest, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    TEST_CHECK(parallel_unzip(uz, nullptr, &opts, failed) == 0);
+
+    // The stored random data, whose damage only its CRC reveals
+    p = unzip_data(uz, 2);
+    TEST_CHECK(p != nullptr);
+    if (p == nullptr)
+        goto out;
+    f = fopen(path, "r+b");
+    TEST_CHECK(f != nullptr && fseeko(f, (off_t)(p - uz->map) + TEST_DATA_SIZE / 2, SEEK_SET) == 0 &&
+               fread(&byte, 1, 1, f) == 1);
+    if (f == nullptr)
+        goto out;
+    byte ^= 1;
+    TEST_CHECK(fseeko(f, -1, SEEK_CUR) == 0 && fwrite(&byte, 1, 1, f) == 1 && fclose(f) == 0);
+    unzip_close(uz);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && make_dest(dest));
+    if (uz == nullptr)
+        goto out;
+    TEST_CHECK(parallel_unzip(uz, dest, &opts, failed) == -1);
+    for (i = 0; i < NUM_TEST_FILES; i++)
+        TEST_CHECK(failed[i] == (i == 2) && (i == 2 || extracted(dest, i)));
+    nftw(dest, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    memset(failed, 0, sizeof(failed));
+    TEST_CHECK(parallel_unzip(uz, nullptr, &opts, failed) == -1 && failed[2]);
+
+out:
+    unzip_close(uz);
+}
+
+// Compress files on one thread and on several, which must agree byte for byte, and read them back
+static void zip_tree(void)
+{
+    char src[TEST_PATH_SIZE], path[TEST_PATH_SIZE], other[TEST_PATH_SIZE];
+    uint8_t *a = nullptr, *b = nullptr;
+    size_t a_size = 0, b_size = 0;
+    unzip_t *uz;
+
+    TEST_CHECK(make_dest(src));
+    TEST_CHECK(make_tree(src));
+    TEST_CHECK(zip_files(src, 1, other) == 0);
+    TEST_CHECK(zip_files(src, 4, path) == 0);
+    nftw(src, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+
+    a = load(other, &a_size);
+    b = load(path, &b_size);
+    TEST_CHECK(a != nullptr && b != nullptr && a_size == b_size && memcmp(a, b, a_size) == 0);
+    free(a);
+    free(b);
+    unlink(other);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->num_entries == NUM_TEST_FILES);
+    if (uz != nullptr)
+        check_archive(uz);
+    unzip_close(uz);
+
+    unzip_files(path);
+    unlink(path);
+}
+
+// A stored entry as streaming writers leave it: zero crc and sizes, then a descriptor
+static int write_stored_streamed(FILE *f, zip_writer_t *zw, const size_t index, const uint8_t *data)
+{
+    uint8_t hdr[ZIP_LOCAL_SIZE] = {0}, desc[ZIP_DESCRIPTOR_SIZE];
+    const test_file_t *t = &test_files[index];
+    zip_entry_t e = {
+        .offset = zw->offset,
+        .size = t->size,
+        .csize = t->size,
+        .crc = crc32(CRC32_INIT, data, t->size),
+        .name_len = (uint16_t)strlen(t->name),
+        .method = ZIP_METHOD_STORE,
+        .flags = ZIP_FLAG_DESCRIPTOR,
+    };
+
+    zip_entry_stamp(&e, TEST_MTIME, 0, false);
+    put_le32(hdr, ZIP_LOCAL_SIG);
+    put_le16(hdr + 4, ZIP_VERSION);
+    put_le16(hdr + 6, e.flags);
+    put_le32(hdr + 10, e.dos_time);
+    put_le16(hdr + 26, e.name_len);
+    put_le32(desc, ZIP_DESCRIPTOR_SIG);
+    put_le32(desc + 4, e.crc);
+    put_le32(desc + 8, (uint32_t)e.csize);
+    put_le32(desc + 12, (uint32_t)e.size);
+
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || fwrite(t->name, 1, e.name_len, f) != e.name_len ||
+        (t->size > 0 && fwrite(data, 1, t->size, f) != t->size) || fwrite(desc, 1, sizeof(desc), f) != sizeof(desc))
+        return -1;
+
+    zw->offset += sizeof(hdr) + e.name_len + t->size + sizeof(desc);
+    return zip_writer_keep(zw, &e, t->name);
+}
+
+// Build the test archive, check that the reader accepts it as well, and load it into memory
+static uint8_t *make_archive(size_t *size)
+{
+    uint8_t data[TEST_DATA_SIZE], *archive = nullptr;
+    char path[] = "/tmp/plzip_test.XXXXXX";
+    zip_writer_t *zw = nullptr;
+    bool ok = false;
+    unzip_t *uz;
+    size_t i;
+    FILE *f;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+        return nullptr;
+    f = fdopen(fd, "w+b");
+    if (f == nullptr)
+    {
+        close(fd);
+        goto out;
+    }
+
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    ok = zw != nullptr;
+    for (i = 0; ok && i < NUM_TEST_FILES; i++)
+    {
+        fill(data, i);
+        if (i < 2)
+            ok = write_stored_streamed(f, zw, i, data) == 0;
+        else if (i == 3)
+            ok = zip_writer_begin(zw, test_files[i].name, TEST_MTIME, 0) == 0 &&
+                 zip_writer_write(zw, data, test_files[i].size) == 0 && zip_writer_end(zw) == 0;
+        else
+            ok = zip_writer_add(zw, test_files[i].name, TEST_MTIME, 0, test_files[i].size ? data : nullptr,
+                                test_files[i].size) == 0;
+    }
+    ok = ok && zip_writer_finish(zw) == 0;
+
+    uz = ok ? unzip_open(path) : nullptr;
+    TEST_CHECK(uz != nullptr && uz->num_entries == NUM_TEST_FILES);
+    for (i = 0; uz != nullptr && i < uz->num_entries; i++)
+        TEST_CHECK(unzip_verify(uz, i) == 0);
+    unzip_close(uz);
+
+    *size = (size_t)zw->offset;
+    archive = ok ? malloc(*size) : nullptr;
+    if (archive != nullptr && (fseeko(f, 0, SEEK_SET) || fread(archive, 1, *size, f) != *size))
+    {
+        free(archive);
+        archive = nullptr;
+    }
+    fclose(f);
+
+out:
+    zip_writer_free(zw);
+    unlink(path);
+    return archive;
+}
+
+static void *feed(void *arg)
+{
+    const feeder_t *fd = arg;
+    size_t pos = 0;
+    ssize_t n;
+
+    while (pos < fd->size && (n = write(fd->fd, fd->data + pos, fd->size - pos)) > 0)
+        pos += (size_t)n;
+    close(fd->fd);
+    return nullptr;
+}
+
+static void record_failure(const char *name, void *arg)
+{
+    failures_t *f = arg;
+
+    f->count++;
+    snprintf(f->name, sizeof(f->name), "%s", name);
+}
+
+// Extract an archive written into a pipe by another thread, as from a download
+static int extract_piped(const uint8_t *archive, const size_t size, const char *dest, failures_t *failures)
+{
+    feeder_t feeder = {.data = archive, .size = size};
+    pthread_t tid;
+    int fds[2], ret;
+
+    if (pipe(fds))
+        return -2;
+    feeder.fd = fds[1];
+    if (pthread_create(&tid, nullptr, feed, &feeder))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -2;
+    }
+
+    ret = parallel_unzip_stream(fds[0], dest, record_failure, failures);
+    pthread_join(tid, nullptr);
+    close(fds[0]);
+    return ret;
+}
+
+static void unzip_stream(void)
+{
+    char dest[TEST_PATH_SIZE];
+    failures_t failures = {0};
+    uint8_t *archive;
+    size_t size, i;
+    const uint8_t *p;
+
+    archive = make_archive(&size);
+    TEST_CHECK(archive != nullptr);
+    if (archive == nullptr || !make_dest(dest))
+    {
+        free(archive);
+        return;
+    }
+
+    TEST_CHECK(extract_piped(archive, size, dest, &failures) == 0 && failures.count == 0);
+    for (i = 0; i < NUM_TEST_FILES; i++)
+        TEST_CHECK(extracted(dest, i));
+    nftw(dest, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+
+    // Only checked, nothing is written
+    TEST_CHECK(extract_piped(archive, size, nullptr, &failures) == 0 && failures.count == 0);
+
+    // A damaged entry of known size fails alone, the entries after it still come out
+    p = memmem(archive, size, test_files[2].name, strlen(test_files[2].name));
+    TEST_CHECK(p != nullptr);
+    if (p != nullptr && make_dest(dest))
+    {
+        archive[p - archive + strlen(test_files[2].name) + TEST_DATA_SIZE / 2] ^= 1;
+        TEST_CHECK(extract_piped(archive, size, dest, &failures) == -1);
+        TEST_CHECK(failures.count == 1 && strcmp(failures.name, test_files[2].name) == 0);
+        for (i = 3; i < NUM_TEST_FILES; i++)
+            TEST_CHECK(extracted(dest, i));
+        nftw(dest, remove_entry, TEST_NUM_FDS, FTW_DEPTH | FTW_PHYS);
+    }
+
+    free(archive);
+}
+
+void test_parallel(void)
+{
+    zip_tree();
+    unzip_stream();
+}
@@ -0,0 +1,8 @@
+#ifndef __TEST_PARALLEL_H__
+#define __TEST_PARALLEL_H__
+
+/// @brief Compress archives with parallel_zip and extract them with parallel_unzip, or through a pipe
+///        with parallel_unzip_stream
+void test_parallel(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,736 @@
+#include "test_zip.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "inflate.h"
+#include "test.h"
+#include "unzip.h"
+#include "zip.h"
+
+#define TEST_PATH_SIZE 64
+#define TEST_MTIME 1700000000
+// Entries of a ZIP64 archive start past 4 GiB of a sparse file
+#define TEST_ZIP64_OFFSET (5ull << 30)
+
+typedef struct
+{
+    const char *name;
+    size_t size; // bytes of text, 0 for an empty file or a directory
+    bool streamed;
+} test_entry_t;
+
+static const test_entry_t test_entries[] = {
+    {"a.txt", 50000, false},
+    {"empty", 0, false},
+    {"dir/", 0, false},
+    {"dir/b.txt", 3000, true},
+    {"dir/empty_streamed", 0, true},
+    {"dir/sub/c.txt", 1, false},
+};
+
+#define NUM_TEST_ENTRIES (sizeof(test_entries) / sizeof(test_entries[0]))
+// Entries of the archive an update or append starts from, the others are added to it
+#define NUM_OLD_ENTRIES 4
+
+static const char *index_names[] = {"dup", "a", "dir/", "dup", "b/dup", "a/"};
+
+#define NUM_INDEX_NAMES (sizeof(index_names) / sizeof(index_names[0]))
+#define TEST_INDEX_SLOTS 16 // zip_index_slots(NUM_INDEX_NAMES)
+
+static void fill(uint8_t *data, const size_t size, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        data[i] = (uint8_t)name[i % strlen(name)] ^ (uint8_t)(i / 97);
+}
+
+// Open a new temporary file, its path left in path
+static FILE *temp_file(char *path)
+{
+    int fd;
+    FILE *f;
+
+    strcpy(path, "/tmp/plzip_test.XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0)
+        return nullptr;
+
+    f = fdopen(fd, "w+b");
+    if (f == nullptr)
+    {
+        close(fd);
+        unlink(path);
+    }
+    return f;
+}
+
+static int add_entry(zip_writer_t *zw, const test_entry_t *t, uint8_t *data)
+{
+    // Only compressed entries can be streamed
+    fill(data, t->size, t->name);
+    if (!t->streamed || zw->level == 0)
+        return zip_writer_add(zw, t->name, TEST_MTIME, 0, t->size ? data : nullptr, t->size);
+
+    return zip_writer_begin(zw, t->name, TEST_MTIME, 0) || zip_writer_write(zw, data, t->size / 2) ||
+                   zip_writer_write(zw, data + t->size / 2, t->size - t->size / 2) || zip_writer_end(zw)
+               ? -1
+               : 0;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Check the local header, data and descriptor of the entry a central record at cd points to
+static void check_local(const uint8_t *zip, const size_t size, const uint8_t *cd, const test_entry_t *t,
+                        uint8_t *data, uint8_t *out)
+{
+    size_t offset = get_le32(cd + 42), csize = get_le32(cd + 20), len = strlen(t->name), used, out_size;
+    uint16_t method = get_le16(cd + 10), flags = get_le16(cd + 8);
+    const uint8_t *local = zip + offset, *p;
+
+    TEST_CHECK(offset + ZIP_LOCAL_SIZE + len + csize <= size);
+    if (offset + ZIP_LOCAL_SIZE + len + csize > size)
+        return;
+
+    TEST_CHECK(get_le32(local) == ZIP_LOCAL_SIG && get_le16(local + 6) == flags && get_le16(local + 8) == method);
+    TEST_CHECK(get_le16(local + 26) == len && get_le16(local + 28) == 0 && memcmp(local + 30, t->name, len) == 0);
+    p = local + ZIP_LOCAL_SIZE + len;
+
+    fill(data, t->size, t->name);
+    if (method == ZIP_METHOD_STORE)
+        TEST_CHECK(csize == t->size && memcmp(p, data, t->size) == 0);
+    else
+    {
+        TEST_CHECK(inflate_decompress(p, csize, &used, out, t->size, &out_size) == 0 && used == csize &&
+                   out_size == t->size && memcmp(out, data, t->size) == 0);
+    }
+
+    // Streamed entries only know their crc and sizes once the data is through
+    if (flags & ZIP_FLAG_DESCRIPTOR)
+    {
+        TEST_CHECK(get_le32(local + 14) == 0 && get_le32(local + 18) == 0 && get_le32(local + 22) == 0);
+        p += csize;
+        TEST_CHECK(p + ZIP_DESCRIPTOR_SIZE <= zip + size && get_le32(p) == ZIP_DESCRIPTOR_SIG &&
+                   get_le32(p + 4) == get_le32(cd + 16) && get_le32(p + 8) == csize &&
+                   get_le32(p + 12) == t->size);
+    }
+    else
+        TEST_CHECK(memcmp(local + 14, cd + 16, 12) == 0);
+}
+
+// Walk the archive from its end: the EOCD record, then the central directory and the entries it lists
+static void check_archive(const uint8_t *zip, const size_t size, const int level, uint8_t *data, uint8_t *out)
+{
+    const uint8_t *eocd = zip + size - ZIP_EOCD_SIZE, *cd;
+    size_t i, len, cd_size, cd_offset;
+
+    TEST_CHECK(size >= ZIP_EOCD_SIZE && get_le32(eocd) == ZIP_EOCD_SIG);
+    if (size < ZIP_EOCD_SIZE || get_le32(eocd) != ZIP_EOCD_SIG)
+        return;
+
+    cd_size = get_le32(eocd + 12);
+    cd_offset = get_le32(eocd + 16);
+    TEST_CHECK(get_le16(eocd + 8) == NUM_TEST_ENTRIES && get_le16(eocd + 10) == NUM_TEST_ENTRIES);
+    TEST_CHECK(cd_offset + cd_size == size - ZIP_EOCD_SIZE && get_le16(eocd + 20) == 0);
+    if (cd_offset + cd_size != size - ZIP_EOCD_SIZE)
+        return;
+
+    for (cd = zip + cd_offset, i = 0; i < NUM_TEST_ENTRIES; i++, cd += ZIP_CENTRAL_SIZE + len)
+    {
+        len = strlen(test_entries[i].name);
+        TEST_CHECK(cd + ZIP_CENTRAL_SIZE + len <= eocd && get_le32(cd) == ZIP_CENTRAL_SIG);
+        if (cd + ZIP_CENTRAL_SIZE + len > eocd || get_le32(cd) != ZIP_CENTRAL_SIG)
+            return;
+
+        TEST_CHECK(get_le16(cd + 28) == len && memcmp(cd + ZIP_CENTRAL_SIZE, test_entries[i].name, len) == 0);
+        TEST_CHECK(get_le32(cd + 24) == test_entries[i].size && get_le32(cd + 38) >> 16 != 0);
+        TEST_CHECK(get_le16(cd + 12) == (zip_dos_time(TEST_MTIME) & 0xffff) &&
+                   get_le16(cd + 14) == zip_dos_time(TEST_MTIME) >> 16);
+
+        fill(data, test_entries[i].size, test_entries[i].name);
+        TEST_CHECK(get_le32(cd + 16) == crc32(CRC32_INIT, data, test_entries[i].size));
+
+        // Entries with no data are stored unless streamed
+        TEST_CHECK(get_le16(cd + 10) == (level > 0 && (test_entries[i].size > 0 || test_entries[i].streamed)
+                                             ? ZIP_METHOD_DEFLATE
+                                             : ZIP_METHOD_STORE));
+        check_local(zip, size, cd, &test_entries[i], data, out);
+    }
+    TEST_CHECK(cd == eocd);
+}
+
+// Check that the reader finds entry i as written
+static void check_entry(unzip_t *uz, const size_t i, const test_entry_t *t, uint8_t *data, uint8_t *out)
+{
+    const zip_entry_t *e = &uz->entries[i];
+    size_t len = strlen(t->name);
+
+    TEST_CHECK(e->name_len == len && memcmp(unzip_name(uz, i), t->name, len) == 0);
+    TEST_CHECK(e->size == t->size);
+    TEST_CHECK(unzip_find(uz, t->name, len) == i);
+    TEST_CHECK(unzip_verify(uz, i) == 0);
+
+    fill(data, t->size, t->name);
+    TEST_CHECK(unzip_extract(uz, i, out, t->size) == 0 && memcmp(out, data, t->size) == 0);
+}
+
+// Write an archive of test entries from first up to last to a new temporary file
+static int write_archive(char *path, const int level, const size_t first, const size_t last, uint8_t *data)
+{
+    zip_writer_t *zw;
+    int ret = -1;
+    size_t i;
+    FILE *f;
+
+    f = temp_file(path);
+    if (f == nullptr)
+        return -1;
+
+    zw = zip_writer_new(f, level);
+    if (zw != nullptr)
+    {
+        for (i = first; i < last && add_entry(zw, &test_entries[i], data) == 0; i++)
+            ;
+        ret = i == last && zip_writer_finish(zw) == 0 ? 0 : -1;
+    }
+
+    zip_writer_free(zw);
+    if (fclose(f))
+        ret = -1;
+    if (ret)
+        unlink(path);
+    return ret;
+}
+
+static void round_trip(const int level)
+{
+    char path[TEST_PATH_SIZE];
+    uint8_t *data = malloc(50000), *out = malloc(50000);
+    unzip_t *uz;
+    size_t i;
+
+    TEST_CHECK(data != nullptr && out != nullptr);
+    if (data == nullptr || out == nullptr)
+        goto out;
+    TEST_CHECK(write_archive(path, level, 0, NUM_TEST_ENTRIES, data) == 0);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr);
+    if (uz != nullptr)
+    {
+        TEST_CHECK(uz->num_entries == NUM_TEST_ENTRIES);
+        check_archive(uz->map, uz->map_size, level, data, out);
+        for (i = 0; i < NUM_TEST_ENTRIES && i < uz->num_entries; i++)
+            check_entry(uz, i, &test_entries[i], data, out);
+        TEST_CHECK(unzip_find(uz, "missing", 7) == UNZIP_NOT_FOUND);
+        unzip_close(uz);
+    }
+    unlink(path);
+
+out:
+    free(data);
+    free(out);
+}
+
+// Flip a byte of stored data, which only the entry's CRC catches, and append an archive comment
+static void corrupt(void)
+{
+    char path[TEST_PATH_SIZE];
+    uint8_t *data = malloc(50000), *out = malloc(50000), byte;
+    unzip_t *uz;
+    size_t i;
+    FILE *f;
+
+    TEST_CHECK(data != nullptr && out != nullptr);
+    if (data == nullptr || out == nullptr || write_archive(path, 0, 0, NUM_TEST_ENTRIES, data))
+        goto out;
+
+    // The first entry's data follows its local header and name
+    f = fopen(path, "r+b");
+    TEST_CHECK(f != nullptr);
+    if (f == nullptr)
+        goto out_path;
+    TEST_CHECK(fseek(f, ZIP_LOCAL_SIZE + 5 + 100, SEEK_SET) == 0 && fread(&byte, 1, 1, f) == 1);
+    byte ^= 1;
+    TEST_CHECK(fseek(f, -1, SEEK_CUR) == 0 && fwrite(&byte, 1, 1, f) == 1);
+    TEST_CHECK(fseek(f, -2, SEEK_END) == 0 && fwrite("\5\0plzip", 1, 7, f) == 7);
+    TEST_CHECK(fclose(f) == 0);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->num_entries == NUM_TEST_ENTRIES);
+    if (uz != nullptr && uz->num_entries == NUM_TEST_ENTRIES)
+    {
+        TEST_CHECK(unzip_extract(uz, 0, out, test_entries[0].size) == -1);
+        TEST_CHECK(unzip_extract(uz, 0, out, test_entries[0].size - 1) == -1);
+        for (i = 1; i < NUM_TEST_ENTRIES; i++)
+            check_entry(uz, i, &test_entries[i], data, out);
+    }
+    unzip_close(uz);
+
+out_path:
+    unlink(path);
+out:
+    free(data);
+    free(out);
+}
+
+// One-at-a-time hashes of known names, as computed by the reference implementation
+static void index_hash(void)
+{
+    char name[300];
+
+    memset(name, 'x', sizeof(name));
+    TEST_CHECK(zip_index_hash("", 0) == 0 && zip_index_hash("a", 1) == 0xca2e9442u);
+    TEST_CHECK(zip_index_hash("\xc3\xa9t\xc3\xa9", 5) == 0x46fdbf25u);
+    TEST_CHECK(zip_index_hash(name, ZIP_INDEX_HASH_PREFIX) == 0xb6d443a0u &&
+               zip_index_hash(name, sizeof(name)) == 0xb6d443a0u);
+}
+
+// Write an archive of the index test names, each holding its own name
+static int write_names(char *path, const bool index)
+{
+    zip_writer_t *zw;
+    int ret = -1;
+    size_t i;
+    FILE *f;
+
+    f = temp_file(path);
+    if (f == nullptr)
+        return -1;
+
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    if (zw != nullptr)
+    {
+        zw->index = index;
+        for (i = 0; i < NUM_INDEX_NAMES && zip_writer_add(zw, index_names[i], TEST_MTIME, 0,
+                                                          (const uint8_t *)index_names[i],
+                                                          strlen(index_names[i])) == 0;
+             i++)
+            ;
+        ret = i == NUM_INDEX_NAMES && zip_writer_finish(zw) == 0 ? 0 : -1;
+    }
+
+    zip_writer_free(zw);
+    if (fclose(f))
+        ret = -1;
+    if (ret)
+        unlink(path);
+    return ret;
+}
+
+// Every name is found at its entry: equal names in entry order, so the first of them wins
+static void find_names(unzip_t *uz)
+{
+    TEST_CHECK(unzip_find(uz, "dup", 3) == 0 && unzip_find(uz, "b/dup", 5) == 4);
+    TEST_CHECK(unzip_find(uz, "a", 1) == 1 && unzip_find(uz, "a/", 2) == 5 && unzip_find(uz, "dir/", 4) == 2);
+    TEST_CHECK(unzip_find(uz, "dir", 3) == UNZIP_NOT_FOUND && unzip_find(uz, "", 0) == UNZIP_NOT_FOUND);
+}
+
+// Look entries up through an index carried by the archive, and through one built at the first lookup
+static void name_index(const bool stored)
+{
+    static const uint32_t hashes[] = {0x3e564e3au, 0xca2e9442u, 0xdff65d08u, 0x3e564e3au, 0xe4b8cbb6u, 0x7c178ac6u};
+    char path[TEST_PATH_SIZE];
+    unzip_t *uz;
+    size_t i, used = 0;
+
+    TEST_CHECK(write_names(path, stored) == 0);
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr);
+    if (uz == nullptr)
+        goto out;
+    TEST_CHECK(uz->num_entries == NUM_INDEX_NAMES && uz->slots_mapped == stored);
+
+    find_names(uz);
+    TEST_CHECK(uz->slots != nullptr && uz->slots_mapped == stored && uz->num_slots == zip_index_slots(uz->num_entries));
+
+    // A stored index holds the same hashes on every host
+    for (i = 0; uz->slots != nullptr && i < uz->num_slots; i++)
+        if (uz->slots[i].index != ZIP_INDEX_EMPTY)
+        {
+            TEST_CHECK(uz->slots[i].index < uz->num_entries && uz->slots[i].hash == hashes[uz->slots[i].index]);
+            used++;
+        }
+    TEST_CHECK(used == uz->num_entries);
+    unzip_close(uz);
+
+out:
+    unlink(path);
+}
+
+static size_t slot_of(const zip_index_slot_t *slots, const uint32_t index)
+{
+    size_t i;
+
+    for (i = 0; i < TEST_INDEX_SLOTS - 1 && slots[i].index != index; i++)
+        ;
+    return i;
+}
+
+// A stored index that does not match the entries, as a foreign or damaged one may not, is
+// left unused and lookups go through a built index instead
+static void stale_index(void)
+{
+    zip_index_slot_t slots[TEST_INDEX_SLOTS], patched[TEST_INDEX_SLOTS];
+    char path[TEST_PATH_SIZE];
+    size_t i, s, offset = 0;
+    unzip_t *uz;
+    int fd;
+
+    TEST_CHECK(write_names(path, true) == 0);
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->slots_mapped && uz->num_slots == TEST_INDEX_SLOTS);
+    if (uz != nullptr && uz->slots_mapped && uz->num_slots == TEST_INDEX_SLOTS)
+    {
+        offset = (size_t)((const uint8_t *)uz->slots - uz->map);
+        memcpy(slots, uz->slots, sizeof(slots));
+    }
+    unzip_close(uz);
+    fd = open(path, O_RDWR);
+    TEST_CHECK(offset > 0 && fd >= 0);
+    if (offset == 0 || fd < 0)
+        goto out;
+
+    for (i = 0; i < 5; i++)
+    {
+        memcpy(patched, slots, sizeof(slots));
+        switch (i)
+        {
+        case 0: // an entry is missing, so its probe would miss
+            patched[slot_of(slots, 1)].index = ZIP_INDEX_EMPTY;
+            break;
+        case 1: // a hash differs from the hash of the name
+            patched[slot_of(slots, 4)].hash ^= 1;
+            break;
+        case 2: // a slot points past the entries
+            patched[slot_of(slots, 2)].index = NUM_INDEX_NAMES;
+            break;
+        case 3: // an entry is in two slots, another in none
+            patched[slot_of(slots, 5)].index = 1;
+            break;
+        case 4: // an entry sits before its home slot, beyond a free one
+            s = slot_of(slots, 1);
+            patched[s].index = ZIP_INDEX_EMPTY;
+            for (s = (patched[s].hash - 1) & (TEST_INDEX_SLOTS - 1); patched[s].index != ZIP_INDEX_EMPTY;
+                 s = (s - 1) & (TEST_INDEX_SLOTS - 1))
+                ;
+            patched[s] = slots[slot_of(slots, 1)];
+            break;
+        }
+
+        TEST_CHECK(pwrite(fd, patched, sizeof(patched), (off_t)offset) == (ssize_t)sizeof(patched));
+        uz = unzip_open(path);
+        TEST_CHECK(uz != nullptr && !uz->slots_mapped);
+        if (uz != nullptr)
+        {
+            find_names(uz);
+            TEST_CHECK(!uz->slots_mapped);
+        }
+        unzip_close(uz);
+    }
+
+    // The slots as written are used again
+    TEST_CHECK(pwrite(fd, slots, sizeof(slots), (off_t)offset) == (ssize_t)sizeof(slots));
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->slots_mapped);
+    unzip_close(uz);
+    close(fd);
+
+out:
+    unlink(path);
+}
+
+static bool has_zip64_eocd(const unzip_t *uz)
+{
+    return uz->map_size >= ZIP_EOCD_SIZE + ZIP64_LOCATOR_SIZE &&
+           get_le32(uz->map + uz->map_size - ZIP_EOCD_SIZE - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIG;
+}
+
+// More entries than the 16 bit count holds, stored as only the count matters
+static void zip64_entries(void)
+{
+    size_t num = ZIP_ENTRIES_MAX + 16, i;
+    char path[TEST_PATH_SIZE], name[16];
+    zip_writer_t *zw;
+    unzip_t *uz;
+    FILE *f;
+
+    f = temp_file(path);
+    TEST_CHECK(f != nullptr);
+    if (f == nullptr)
+        return;
+
+    zw = zip_writer_new(f, 0);
+    TEST_CHECK(zw != nullptr);
+    if (zw == nullptr)
+        goto out;
+    for (i = 0; i < num; i++)
+    {
+        snprintf(name, sizeof(name), "e%05zu", i);
+        if (zip_writer_add(zw, name, TEST_MTIME, 0, (const uint8_t *)name, i % 2 ? strlen(name) : 0))
+            break;
+    }
+    TEST_CHECK(i == num);
+    TEST_CHECK(zip_writer_finish(zw) == 0);
+    zip_writer_free(zw);
+    fflush(f);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr);
+    if (uz != nullptr)
+    {
+        TEST_CHECK(uz->num_entries == num && has_zip64_eocd(uz));
+        snprintf(name, sizeof(name), "e%05zu", num - 1);
+        i = unzip_find(uz, name, strlen(name));
+        TEST_CHECK(i == num - 1 && unzip_verify(uz, i) == 0 && uz->entries[i].size == (i % 2 ? strlen(name) : 0));
+        unzip_close(uz);
+    }
+
+out:
+    fclose(f);
+    unlink(path);
+}
+
+// Local headers and the central directory beyond 4 GiB, written after a hole
+static void zip64_offsets(void)
+{
+    char path[TEST_PATH_SIZE];
+    uint8_t *data = malloc(50000), *out = malloc(50000);
+    zip_writer_t *zw;
+    unzip_t *uz;
+    size_t i;
+    FILE *f;
+
+    f = temp_file(path);
+    TEST_CHECK(f != nullptr && data != nullptr && out != nullptr);
+    if (f == nullptr || data == nullptr || out == nullptr)
+        goto out;
+
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    TEST_CHECK(zw != nullptr && fseeko(f, (off_t)TEST_ZIP64_OFFSET, SEEK_SET) == 0);
+    if (zw == nullptr)
+        goto out_file;
+    zw->offset = TEST_ZIP64_OFFSET;
+    for (i = 0; i < NUM_TEST_ENTRIES; i++)
+        TEST_CHECK(add_entry(zw, &test_entries[i], data) == 0);
+    TEST_CHECK(zip_writer_finish(zw) == 0);
+    zip_writer_free(zw);
+    fflush(f);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr);
+    if (uz != nullptr)
+    {
+        TEST_CHECK(uz->num_entries == NUM_TEST_ENTRIES && uz->cd_offset > ZIP_OFFSET_MAX && has_zip64_eocd(uz));
+        for (i = 0; i < NUM_TEST_ENTRIES && i < uz->num_entries; i++)
+        {
+            TEST_CHECK(uz->entries[i].offset >= TEST_ZIP64_OFFSET);
+            check_entry(uz, i, &test_entries[i], data, out);
+        }
+        unzip_close(uz);
+    }
+
+out_file:
+    fclose(f);
+    unlink(path);
+out:
+    free(data);
+    free(out);
+}
+
+// Already compressed data is stored, compressed formats that still compress get the fastest level
+static void choose_level(void)
+{
+    char path[TEST_PATH_SIZE];
+    uint8_t *data = malloc(8192);
+    uint32_t x = 1;
+    zip_writer_t *zw;
+    unzip_t *uz;
+    size_t i;
+    FILE *f;
+
+    TEST_CHECK(data != nullptr);
+    if (data == nullptr)
+        return;
+
+    fill(data, 8192, "text");
+    TEST_CHECK(zip_choose_level("a.txt", data, 8192, 6) == 6);
+    TEST_CHECK(zip_choose_level("a.txt", data, 8192, 0) == 0 && zip_choose_level("a.txt", data, 0, 6) == 0);
+    TEST_CHECK(zip_choose_level("a.ZIP", data, 8192, 6) == DEFLATE_LEVEL_MIN);
+    TEST_CHECK(zip_choose_level("a.zip/b", data, 8192, 6) == 6 && zip_choose_level("zip", data, 8192, 6) == 6);
+    memcpy(data, "\x89PNG\r\n\x1a\n", 8);
+    TEST_CHECK(zip_choose_level("a.txt", data, 8192, 6) == 0);
+    memcpy(data, "RIFF1234WEBP", 12);
+    TEST_CHECK(zip_choose_level("a", data, 8192, 6) == 0 && zip_choose_level("a", data, 11, 6) == 6);
+
+    for (i = 0; i < 8192; i++)
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = (uint8_t)(x >> 16);
+    }
+    TEST_CHECK(zip_choose_level("a.txt", data, 8192, 6) == 0);
+
+    // The writer stores what it would not compress unless told to compress everything
+    f = temp_file(path);
+    TEST_CHECK(f != nullptr);
+    if (f == nullptr)
+        goto out;
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    TEST_CHECK(zw != nullptr && zw->choose);
+    if (zw != nullptr)
+    {
+        TEST_CHECK(zip_writer_add(zw, "random", TEST_MTIME, 0, data, 8192) == 0);
+        zw->choose = false;
+        TEST_CHECK(zip_writer_add(zw, "forced", TEST_MTIME, 0, data, 8192) == 0);
+        TEST_CHECK(zip_writer_finish(zw) == 0);
+    }
+    zip_writer_free(zw);
+    fflush(f);
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->num_entries == 2);
+    if (uz != nullptr && uz->num_entries == 2)
+    {
+        TEST_CHECK(uz->entries[0].method == ZIP_METHOD_STORE && uz->entries[1].method == ZIP_METHOD_DEFLATE);
+        TEST_CHECK(unzip_verify(uz, 0) == 0 && unzip_verify(uz, 1) == 0);
+    }
+    unzip_close(uz);
+    fclose(f);
+    unlink(path);
+
+out:
+    free(data);
+}
+
+// Check an archive holding every test entry, the first ones with the data of old untouched
+static void check_updated(const char *path, const unzip_t *old, uint8_t *data, uint8_t *out)
+{
+    const uint8_t *a, *b;
+    unzip_t *uz;
+    size_t i;
+
+    uz = unzip_open(path);
+    TEST_CHECK(uz != nullptr && uz->num_entries == NUM_TEST_ENTRIES);
+    if (uz == nullptr || uz->num_entries != NUM_TEST_ENTRIES)
+    {
+        unzip_close(uz);
+        return;
+    }
+
+    for (i = 0; i < NUM_TEST_ENTRIES; i++)
+        check_entry(uz, i, &test_entries[i], data, out);
+    for (i = 0; i < NUM_OLD_ENTRIES; i++)
+    {
+        a = unzip_data(old, i);
+        b = unzip_data(uz, i);
+        TEST_CHECK(a != nullptr && b != nullptr && uz->entries[i].csize == old->entries[i].csize &&
+                   uz->entries[i].crc == old->entries[i].crc && memcmp(a, b, old->entries[i].csize) == 0);
+    }
+
+    unzip_close(uz);
+}
+
+// Rewrite an archive copying its entries' compressed data, then append to it in place
+static void update(void)
+{
+    char path[TEST_PATH_SIZE], new_path[TEST_PATH_SIZE];
+    uint8_t *data = malloc(50000), *out = malloc(50000);
+    const uint8_t *p;
+    zip_writer_t *zw;
+    unzip_t *uz = nullptr;
+    size_t i;
+    FILE *f;
+    int fd;
+
+    TEST_CHECK(data != nullptr && out != nullptr);
+    if (data == nullptr || out == nullptr || write_archive(path, DEFLATE_LEVEL_DEFAULT, 0, NUM_OLD_ENTRIES, data))
+        goto out;
+
+    uz = unzip_open(path);
+    fd = open(path, O_RDONLY);
+    f = temp_file(new_path);
+    TEST_CHECK(uz != nullptr && fd >= 0 && f != nullptr);
+    if (uz == nullptr || fd < 0 || f == nullptr)
+        goto out_update;
+
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    TEST_CHECK(zw != nullptr);
+    for (i = 0; zw != nullptr && i < uz->num_entries; i++)
+    {
+        p = unzip_data(uz, i);
+        TEST_CHECK(p != nullptr &&
+                   zip_writer_add_copy(zw, &uz->entries[i], unzip_name(uz, i), fd, (uint64_t)(p - uz->map)) == 0);
+    }
+    for (i = NUM_OLD_ENTRIES; zw != nullptr && i < NUM_TEST_ENTRIES; i++)
+        TEST_CHECK(add_entry(zw, &test_entries[i], data) == 0);
+    TEST_CHECK(zw != nullptr && zip_writer_finish(zw) == 0);
+    zip_writer_free(zw);
+    fclose(f);
+    f = nullptr;
+    check_updated(new_path, uz, data, out);
+    unlink(new_path);
+
+    // Appending writes over the old central directory, after the entries left in place
+    f = fopen(path, "r+b");
+    TEST_CHECK(f != nullptr && fseeko(f, (off_t)uz->cd_offset, SEEK_SET) == 0);
+    if (f == nullptr)
+        goto out_update;
+
+    zw = zip_writer_new(f, DEFLATE_LEVEL_DEFAULT);
+    TEST_CHECK(zw != nullptr);
+    if (zw != nullptr)
+    {
+        zw->offset = uz->cd_offset;
+        for (i = 0; i < uz->num_entries; i++)
+            TEST_CHECK(zip_writer_keep(zw, &uz->entries[i], unzip_name(uz, i)) == 0);
+        for (i = NUM_OLD_ENTRIES; i < NUM_TEST_ENTRIES; i++)
+            TEST_CHECK(add_entry(zw, &test_entries[i], data) == 0);
+        TEST_CHECK(zip_writer_finish(zw) == 0 && ftruncate(fileno(f), (off_t)zw->offset) == 0);
+        zip_writer_free(zw);
+    }
+    TEST_CHECK(fclose(f) == 0);
+    f = nullptr;
+    check_updated(path, uz, data, out);
+
+out_update:
+    if (f != nullptr)
+    {
+        fclose(f);
+        unlink(new_path);
+    }
+    if (fd >= 0)
+        close(fd);
+    unzip_close(uz);
+    unlink(path);
+out:
+    free(data);
+    free(out);
+}
+
+void test_zip(void)
+{
+    round_trip(0);
+    round_trip(DEFLATE_LEVEL_DEFAULT);
+    corrupt();
+    index_hash();
+    name_index(false);
+    name_index(true);
+    stale_index();
+    zip64_entries();
+    zip64_offsets();
+    choose_level();
+    update();
+}
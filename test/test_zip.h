@@ -0,0 +1,7 @@
+#ifndef __TEST_ZIP_H__
+#define __TEST_ZIP_H__
+
+/// @brief Write archives with zip_writer and read them back with unzip
+void test_zip(void);
+
+#endif
\ No newline at end of file